@@ -56,6 +56,10 @@ AboutDialog::AboutDialog(QWidget *parent):QDialog(parent) {
 		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- SHIFT + Mouse Wheel: Changing cicle size of brush</span></p>"
 		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- SPACE: Run watershed algorithm</span></p>"
 		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- Right Mouse Click on image : Captures and selects the label at the mouse coordinate.</span></p>"
+		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- S: Toggle the superpixel brush (click or drag paints whole superpixels)</span></p>"
+		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- P: Polygon tool (click the vertices, click the first one, double click or ENTER to close, drag a vertex to edit, DELETE on a vertex removes the polygon)</span></p>"
+		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- G / SHIFT + G: GrabCut the selected box / all the boxes into their label</span></p>"
+		"<p style=\" margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px;\"><span style=\" font-size:10pt;\">- F12: Show/hide the performance overlay</span></p>"
 		"<p style=\"-qt-paragraph-type:empty; margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px; -qt-block-indent:0; text-indent:0px; font-size:10pt;\"><br /></p>"
 	"</body></html>");
 
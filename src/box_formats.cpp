@@ -0,0 +1,592 @@
+#include "box_formats.h"
+#include "dataset_index.h"
+#include "polygon.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QXmlStreamReader>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// images converted together ; bounds the memory of a conversion
+static const int CONVERSION_CHUNK = 1024;
+
+QString vocFile(const QString &image_file) {
+	QFileInfo file(image_file);
+	return file.dir().absolutePath() + "/xml/" + file.baseName() + ".xml";
+}
+
+std::string vocHeader(const QString &image_file, int width, int height) {
+	QFileInfo file(image_file);
+	std::string base = file.baseName().toStdString();
+	return "<annotation>\n"
+		"\t<folder>0</folder>\n"
+		"\t<filename>" + base + "</filename>\n"
+		"\t<path>" + file.dir().absolutePath().toStdString() + "/" + base + "</path>\n"
+		"\t<source>\n"
+		"\t\t<database>Unknown</database>\n"
+		"\t</source>\n"
+		"\t<size>\n"
+		"\t\t<width>" + std::to_string(width) + "</width>\n"
+		"\t\t<height>" + std::to_string(height) + "</height>\n"
+		"\t\t<depth>3</depth>\n"
+		"\t</size>\n"
+		"    <segmented>0</segmented>\n";
+}
+
+bool readVocBoxes(const QString &xml_file, BoxStore &boxes) {
+	QFile file(xml_file);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return false;
+	QXmlStreamReader xml(&file);
+	QString name;
+	int xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+	bool in_object = false;
+	while (!xml.atEnd()) {
+		xml.readNext();
+		if (xml.isStartElement()) {
+			if (xml.name() == "object") {
+				in_object = true;
+				name.clear();
+				xmin = ymin = xmax = ymax = 0;
+			} else if (in_object && xml.name() == "name") {
+				name = xml.readElementText();
+			} else if (in_object && xml.name() == "xmin") {
+				xmin = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "ymin") {
+				ymin = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "xmax") {
+				xmax = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "ymax") {
+				ymax = xml.readElementText().toInt();
+			}
+		} else if (xml.isEndElement() && xml.name() == "object") {
+			in_object = false;
+			boxes.add(cv::Point(xmin, ymin), cv::Point(xmax, ymax), name.toStdString());
+		}
+	}
+	return !xml.hasError();
+}
+
+// the polygons of the xml, which a conversion of the boxes must keep
+static std::vector<AnnotationPolygon> readVocPolygons(const QString &xml_file) {
+	std::vector<AnnotationPolygon> polygons;
+	QFile file(xml_file);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return polygons;
+	QXmlStreamReader xml(&file);
+	QString name;
+	std::vector<cv::Point> points;
+	int x = 0, y = 0;
+	bool in_polygon = false;
+	while (!xml.atEnd()) {
+		xml.readNext();
+		if (xml.isStartElement()) {
+			if (xml.name() == "polygon") {
+				in_polygon = true;
+				name.clear();
+				points.clear();
+			} else if (in_polygon && xml.name() == "name") {
+				name = xml.readElementText();
+			} else if (in_polygon && xml.name() == "pt") {
+				x = y = 0;
+			} else if (in_polygon && xml.name() == "x") {
+				x = xml.readElementText().toInt();
+			} else if (in_polygon && xml.name() == "y") {
+				y = xml.readElementText().toInt();
+			}
+		} else if (xml.isEndElement() && in_polygon && xml.name() == "pt") {
+			points.push_back(cv::Point(x, y));
+		} else if (xml.isEndElement() && xml.name() == "polygon") {
+			in_polygon = false;
+			AnnotationPolygon polygon(name.toStdString());
+			for (cv::Point p : points)
+				polygon.addPoint(p);
+			if (polygon.size() >= 3)
+				polygons.push_back(polygon);
+		}
+	}
+	return polygons;
+}
+
+bool writeVocBoxes(const QString &xml_file, const QString &image_file, cv::Size size, const BoxStore &boxes) {
+	std::string text = vocHeader(image_file, size.width, size.height);
+	boxes.appendXML(text);
+	for (const AnnotationPolygon &polygon : readVocPolygons(xml_file))
+		text += polygon.toXML();
+	text += "\n</annotation>";
+	QDir().mkpath(QFileInfo(xml_file).absolutePath());
+	QFile file(xml_file);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	return file.write(text.data(), qint64(text.size())) == qint64(text.size());
+}
+
+QString yoloFile(const QString &image_file) {
+	QFileInfo file(image_file);
+	return file.dir().absolutePath() + "/labels/" + file.baseName() + ".txt";
+}
+
+QString yoloClassesFile(const QString &dir) {
+	return dir + "/labels/classes.txt";
+}
+
+bool readYoloBoxes(const QString &txt_file, cv::Size size, const QStringList &classes, BoxStore &boxes) {
+	QFile file(txt_file);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return false;
+	while (!file.atEnd()) {
+		QByteArray line = file.readLine();
+		int index;
+		double cx, cy, w, h;
+		if (sscanf(line.constData(), "%d %lf %lf %lf %lf", &index, &cx, &cy, &w, &h) != 5)
+			continue;
+		if (index < 0 || index >= classes.size())
+			continue;
+		cx *= size.width; w *= size.width;
+		cy *= size.height; h *= size.height;
+		boxes.add(cv::Point(int(std::lround(cx - w / 2)), int(std::lround(cy - h / 2))),
+		          cv::Point(int(std::lround(cx + w / 2)), int(std::lround(cy + h / 2))),
+		          classes[index].toStdString());
+	}
+	return true;
+}
+
+bool writeYoloBoxes(const QString &txt_file, cv::Size size, const QHash<QString, int> &class_index, const BoxStore &boxes, int *skipped) {
+	if (size.area() <= 0)
+		return false;
+	QByteArray text;
+	char line[128];
+	for (int i = 0; i < boxes.size(); i++) {
+		int index = class_index.value(QString::fromStdString(boxes.name(i)), -1);
+		if (index < 0) {
+			if (skipped != NULL)
+				(*skipped)++;
+			continue;
+		}
+		cv::Rect r = boxes.rect(i);
+		int n = snprintf(line, sizeof(line), "%d %.6f %.6f %.6f %.6f\n", index,
+		                 (r.x + r.width / 2.) / size.width, (r.y + r.height / 2.) / size.height,
+		                 double(r.width) / size.width, double(r.height) / size.height);
+		text.append(line, n);
+	}
+	QDir().mkpath(QFileInfo(txt_file).absolutePath());
+	QFile file(txt_file);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	return file.write(text) == text.size();
+}
+
+// -- COCO ---------------------------------------------------------------
+
+namespace {
+
+// Minimal scanner of the json structure : values are skipped, not parsed.
+struct JsonScanner {
+	const char * p  ;
+	const char * end;
+
+	void skipSpace() {
+		while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+			p++;
+	}
+	bool expect(char c) {
+		skipSpace();
+		if (p >= end || *p != c)
+			return false;
+		p++;
+		return true;
+	}
+	bool skipString() {
+		if (p >= end || *p != '"')
+			return false;
+		for (p++; p < end; p++) {
+			if (*p == '\\')
+				p++;
+			else if (*p == '"') {
+				p++;
+				return true;
+			}
+		}
+		return false;
+	}
+	bool readKey(QByteArray *key) {
+		skipSpace();
+		const char * begin = p;
+		if (!skipString())
+			return false;
+		*key = QByteArray(begin + 1, int(p - begin - 2));
+		return expect(':');
+	}
+	bool skipValue() {
+		skipSpace();
+		if (p >= end)
+			return false;
+		if (*p == '"')
+			return skipString();
+		if (*p != '{' && *p != '[') {
+			while (p < end && *p != ',' && *p != '}' && *p != ']')
+				p++;
+			return true;
+		}
+		int depth = 0;
+		while (p < end) {
+			if (*p == '"') {
+				if (!skipString())
+					return false;
+				continue;
+			}
+			if (*p == '{' || *p == '[')
+				depth++;
+			else if (*p == '}' || *p == ']') {
+				depth--;
+				if (depth == 0) {
+					p++;
+					return true;
+				}
+			}
+			p++;
+		}
+		return false;
+	}
+};
+
+// Integer value of "key" in the text of an object, without nested objects
+// holding the same key (true of the image_id of COCO annotations).
+bool integerField(const char *begin, const char *end, const char *key, qint64 *value) {
+	const size_t length = strlen(key);
+	for (const char * p = begin; p + length + 2 < end; p++) {
+		if (*p != '"' || memcmp(p + 1, key, length) != 0 || p[length + 1] != '"')
+			continue;
+		p += length + 2;
+		while (p < end && (*p == ' ' || *p == ':' || *p == '\t' || *p == '\n' || *p == '\r'))
+			p++;
+		*value = strtoll(p, NULL, 10);
+		return true;
+	}
+	return false;
+}
+
+} // namespace
+
+void CocoIndex::close() {
+	if (_data != NULL)
+		_file.unmap(const_cast<uchar*>(reinterpret_cast<const uchar*>(_data)));
+	_file.close();
+	_data = NULL;
+	_size = 0;
+	_annotation_count = 0;
+	_image_ids.clear();
+	_sizes.clear();
+	_annotations.clear();
+	_categories.clear();
+}
+
+bool CocoIndex::open(const QString &json_file) {
+	close();
+	_file.setFileName(json_file);
+	if (!_file.open(QIODevice::ReadOnly))
+		return false;
+	_size = _file.size();
+	_data = reinterpret_cast<const char*>(_file.map(0, _size));
+	if (_data == NULL)
+		return false;
+
+	JsonScanner scanner = { _data, _data + _size };
+	if (!scanner.expect('{'))
+		return false;
+	QByteArray key;
+	while (scanner.readKey(&key)) {
+		scanner.skipSpace();
+		const bool listed = key == "images" || key == "annotations" || key == "categories";
+		if (!listed || !scanner.expect('[')) {
+			if (!scanner.skipValue())
+				return false;
+		} else {
+			scanner.skipSpace();
+			if (scanner.p < scanner.end && *scanner.p == ']')
+				scanner.p++;
+			else while (true) {
+				scanner.skipSpace();
+				const char * begin = scanner.p;
+				if (!scanner.skipValue())
+					return false;
+				const char * end = scanner.p;
+				if (key == "annotations") {
+					qint64 image_id;
+					if (integerField(begin, end, "image_id", &image_id)) {
+						Range range = { qint64(begin - _data), qint32(end - begin) };
+						_annotations[image_id].push_back(range);
+						_annotation_count++;
+					}
+				} else {
+					QJsonObject object = QJsonDocument::fromJson(QByteArray::fromRawData(begin, int(end - begin))).object();
+					qint64 id = qint64(object.value("id").toDouble());
+					if (key == "images") {
+						_image_ids[QFileInfo(object.value("file_name").toString()).fileName()] = id;
+						_sizes[id] = cv::Size(object.value("width").toInt(), object.value("height").toInt());
+					} else {
+						_categories[id] = object.value("name").toString();
+					}
+				}
+				if (scanner.expect(']'))
+					break;
+				if (!scanner.expect(','))
+					return false;
+			}
+		}
+		if (!scanner.expect(','))
+			break;
+	}
+	return true;
+}
+
+cv::Size CocoIndex::imageSize(const QString &image_name) const {
+	return _sizes.value(_image_ids.value(image_name, -1));
+}
+
+bool CocoIndex::boxes(const QString &image_name, BoxStore &boxes) const {
+	if (!isOpen() || !_image_ids.contains(image_name))
+		return false;
+	const QVector<Range> ranges = _annotations.value(_image_ids.value(image_name));
+	for (const Range &range : ranges) {
+		QJsonObject object = QJsonDocument::fromJson(QByteArray::fromRawData(_data + range.begin, range.size)).object();
+		QJsonArray bbox = object.value("bbox").toArray();
+		if (bbox.size() != 4)
+			continue;
+		double x = bbox[0].toDouble(), y = bbox[1].toDouble(), w = bbox[2].toDouble(), h = bbox[3].toDouble();
+		QString name = _categories.value(qint64(object.value("category_id").toDouble()));
+		boxes.add(cv::Point(int(std::lround(x)), int(std::lround(y))),
+		          cv::Point(int(std::lround(x + w)), int(std::lround(y + h))), name.toStdString());
+	}
+	return true;
+}
+
+static QByteArray jsonString(const QString &text) {
+	QByteArray array = QJsonDocument(QJsonArray() << text).toJson(QJsonDocument::Compact);
+	return array.mid(1, array.size() - 2);
+}
+
+// -- Conversion -----------------------------------------------------------
+
+namespace {
+
+struct ImageBoxes {
+	QString  name ;
+	cv::Size size ;
+	BoxStore boxes;
+	int      skipped = 0;
+	bool     found = false; // the image has an annotation in the source format
+	bool     ok = true;
+};
+
+struct ConvertImage {
+	typedef ImageBoxes result_type;
+
+	QString           dir         ;
+	QString           from        ;
+	QString           to          ;
+	const CocoIndex * coco        ;
+	QStringList       yolo_classes;
+	QHash<QString, int> class_index;
+
+	ImageBoxes operator()(const QString &name) const {
+		ImageBoxes result;
+		result.name = name;
+		const QString image_file = dir + "/" + name;
+		if (from == "coco")
+			result.size = coco->imageSize(name);
+		if (result.size.area() <= 0) {
+			QSize size = QImageReader(image_file).size();
+			result.size = cv::Size(size.width(), size.height());
+		}
+		if (from == "voc")
+			result.found = readVocBoxes(vocFile(image_file), result.boxes);
+		else if (from == "yolo")
+			result.found = readYoloBoxes(yoloFile(image_file), result.size, yolo_classes, result.boxes);
+		else
+			result.found = coco->boxes(name, result.boxes);
+
+		// an image without annotation is not an image without boxes : its
+		// annotation in the destination format, if any, is left as it is
+		if (!result.found)
+			return result;
+		if (to == "voc")
+			result.ok = writeVocBoxes(vocFile(image_file), image_file, result.size, result.boxes);
+		else if (to == "yolo")
+			result.ok = writeYoloBoxes(yoloFile(image_file), result.size, class_index, result.boxes, &result.skipped);
+		return result;
+	}
+};
+
+} // namespace
+
+bool convertBoxes(const QString &dir, const QString &from_arg, const QString &to_arg, const Id2Labels &id_labels, BoxConversion *result, QString *error) {
+	const QString from = from_arg.endsWith(".json", Qt::CaseInsensitive) ? QString("coco") : from_arg;
+	const QString to = to_arg.endsWith(".json", Qt::CaseInsensitive) ? QString("coco") : to_arg;
+	const QStringList formats = { "voc", "yolo", "coco" };
+	if (!formats.contains(from) || !formats.contains(to)) {
+		*error = "formats are voc, yolo or a .json COCO file";
+		return false;
+	}
+
+	ConvertImage convert;
+	convert.dir = dir;
+	convert.from = from;
+	convert.to = to;
+	CocoIndex coco;
+	convert.coco = &coco;
+	if (from == "coco" && !coco.open(from_arg)) {
+		*error = "can't read " + from_arg;
+		return false;
+	}
+	if (from == "yolo") {
+		QFile classes(yoloClassesFile(dir));
+		if (!classes.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			*error = "can't read " + classes.fileName();
+			return false;
+		}
+		QTextStream in(&classes);
+		while (!in.atEnd())
+			convert.yolo_classes << in.readLine().trimmed();
+	}
+
+	// YOLO classes and COCO categories : the labels with boxes in mind, by id
+	QList<const LabelInfo*> labels = id_labels.labels();
+	QByteArray categories;
+	QStringList class_names;
+	for (const LabelInfo * label : labels) {
+		if (label->id == 0)
+			continue;
+		convert.class_index[label->name] = class_names.size();
+		class_names << label->name;
+		if (!categories.isEmpty())
+			categories += ",";
+		categories += "{\"id\":" + QByteArray::number(label->id) + ",\"name\":" + jsonString(label->name) + ",\"supercategory\":" + jsonString(label->categorie) + "}";
+	}
+	if (to == "yolo") {
+		QDir().mkpath(dir + "/labels");
+		QFile classes(yoloClassesFile(dir));
+		if (!classes.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+			*error = "can't write " + classes.fileName();
+			return false;
+		}
+		classes.write((class_names.join("\n") + "\n").toUtf8());
+	}
+
+	// COCO : the images are written as they come, the annotations go to a
+	// side file appended at the end. The output replaces to_arg once complete,
+	// which may be the COCO file being read.
+	QFile images_out(to_arg + ".tmp"), annotations_out(to_arg + ".annotations.tmp");
+	auto fail = [&](const QString &message) {
+		if (to == "coco") {
+			images_out.remove();
+			annotations_out.remove();
+		}
+		*error = message;
+		return false;
+	};
+	if (to == "coco") {
+		if (!images_out.open(QIODevice::WriteOnly | QIODevice::Truncate) || !annotations_out.open(QIODevice::ReadWrite | QIODevice::Truncate))
+			return fail("can't write " + to_arg);
+		images_out.write("{\"images\":[");
+	}
+
+	const QStringList files = imageFiles(dir);
+	qint64 annotation_id = 0;
+	int image_id = 0;
+	char buffer[256];
+	for (int start = 0; start < files.size(); start += CONVERSION_CHUNK) {
+		QList<ImageBoxes> chunk = QtConcurrent::blockingMapped<QList<ImageBoxes> >(files.mid(start, CONVERSION_CHUNK), convert);
+		for (int i = 0; i < chunk.size(); i++) {
+			const ImageBoxes & image = chunk[i];
+			if (!image.found) {
+				result->missing++;
+				continue;
+			}
+			result->images++;
+			result->skipped += image.skipped;
+			result->boxes += image.boxes.size() - image.skipped;
+			if (!image.ok)
+				return fail("can't write the boxes of " + image.name);
+			if (to != "coco")
+				continue;
+			if (++image_id > 1)
+				images_out.write(",");
+			images_out.write("{\"id\":" + QByteArray::number(image_id) + ",\"file_name\":" + jsonString(image.name)
+				+ ",\"width\":" + QByteArray::number(image.size.width) + ",\"height\":" + QByteArray::number(image.size.height) + "}");
+			for (int b = 0; b < image.boxes.size(); b++) {
+				const LabelInfo * label = id_labels.find(QString::fromStdString(image.boxes.name(b)));
+				if (label == NULL) {
+					result->skipped++;
+					result->boxes--;
+					continue;
+				}
+				cv::Rect r = image.boxes.rect(b);
+				int n = snprintf(buffer, sizeof(buffer),
+					"%s{\"id\":%lld,\"image_id\":%d,\"category_id\":%d,\"bbox\":[%d,%d,%d,%d],\"area\":%lld,\"iscrowd\":0}",
+					annotation_id > 0 ? "," : "", (long long)(annotation_id + 1), image_id, label->id,
+					r.x, r.y, r.width, r.height, (long long)r.width * r.height);
+				annotations_out.write(buffer, n);
+				annotation_id++;
+			}
+		}
+	}
+
+	if (to == "coco") {
+		images_out.write("],\"annotations\":[");
+		annotations_out.seek(0);
+		while (!annotations_out.atEnd())
+			images_out.write(annotations_out.read(1 << 20));
+		annotations_out.remove();
+		images_out.write("],\"categories\":[" + categories + "]}");
+		if (!images_out.flush() || images_out.error() != QFile::NoError)
+			return fail("can't write " + to_arg);
+		images_out.close();
+		coco.close();
+		QFile::remove(to_arg);
+		if (!images_out.rename(to_arg))
+			return fail("can't write " + to_arg);
+	}
+	return true;
+}
+
+int runConvertBoxesCommand(const QStringList &arguments) {
+	int index = arguments.indexOf("--convert-boxes");
+	if (index < 0 || index + 3 >= arguments.size()) {
+		std::cerr << "usage: PixelAnnotationTool --convert-boxes <dir> <voc|yolo|coco.json> <voc|yolo|coco.json> [--config <config.json>]" << std::endl;
+		return 2;
+	}
+	Name2Labels labels = defaulfLabels();
+	int config = arguments.indexOf("--config");
+	if (config >= 0 && config + 1 < arguments.size() && !labels.readFile(arguments[config + 1])) {
+		std::cerr << "can't open " << arguments[config + 1].toStdString() << std::endl;
+		return 1;
+	}
+	Id2Labels id_labels = getId2Label(labels);
+
+	BoxConversion conversion;
+	QString error;
+	if (!convertBoxes(arguments[index + 1], arguments[index + 2], arguments[index + 3], id_labels, &conversion, &error)) {
+		std::cerr << error.toStdString() << std::endl;
+		return 1;
+	}
+	std::cout << conversion.images << " images, " << conversion.boxes << " boxes";
+	if (conversion.skipped > 0)
+		std::cout << ", " << conversion.skipped << " boxes skipped (name not in the labels)";
+	if (conversion.missing > 0)
+		std::cout << ", " << conversion.missing << " images without " << arguments[index + 2].toStdString() << " annotation left as they are";
+	std::cout << std::endl;
+	return 0;
+}
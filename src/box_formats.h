@@ -0,0 +1,81 @@
+#ifndef BOX_FORMATS_H
+#define BOX_FORMATS_H
+
+#include <opencv2/core/core.hpp>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <string>
+
+#include "box_store.h"
+#include "labels.h"
+
+// Box annotations of the images of a directory, in the Pascal VOC format of
+// the tool (xml/<base>.xml), in YOLO (labels/<base>.txt, the classes in
+// labels/classes.txt) or in COCO (a single json for the directory).
+
+QString vocFile(const QString &image_file);
+// <annotation> up to the first <object>, the objects and </annotation> follow
+std::string vocHeader(const QString &image_file, int width, int height);
+bool readVocBoxes(const QString &xml_file, BoxStore &boxes);
+// keeps the <polygon> elements of an existing xml_file
+bool writeVocBoxes(const QString &xml_file, const QString &image_file, cv::Size size, const BoxStore &boxes);
+
+QString yoloFile(const QString &image_file);
+QString yoloClassesFile(const QString &dir);
+// classes : name of each class index
+bool readYoloBoxes(const QString &txt_file, cv::Size size, const QStringList &classes, BoxStore &boxes);
+bool writeYoloBoxes(const QString &txt_file, cv::Size size, const QHash<QString, int> &class_index, const BoxStore &boxes, int *skipped = NULL);
+
+// Byte ranges of the elements of a COCO json, so that the boxes of one image
+// are read without parsing the whole file. The file is mapped ; opening it
+// scans the structure once and only parses the images and categories, the
+// annotations being filed by the image_id found in their text.
+// Once open, the queries are thread safe.
+class CocoIndex {
+public:
+	bool open(const QString &json_file);
+	void close();
+	bool isOpen() const { return _data != NULL; }
+	QString file() const { return _file.fileName(); }
+	int  imageCount() const { return _image_ids.size(); }
+	qint64 annotationCount() const { return _annotation_count; }
+	// by file name, without directory
+	bool contains(const QString &image_name) const { return _image_ids.contains(image_name); }
+	cv::Size imageSize(const QString &image_name) const;
+	bool boxes(const QString &image_name, BoxStore &boxes) const;
+
+private:
+	struct Range {
+		qint64 begin;
+		qint32 size ;
+	};
+	QFile   _file;
+	const char * _data = NULL;
+	qint64  _size = 0;
+	qint64  _annotation_count = 0;
+	QHash<QString, qint64>          _image_ids  ;
+	QHash<qint64, cv::Size>         _sizes      ;
+	QHash<qint64, QVector<Range> >  _annotations;
+	QHash<qint64, QString>          _categories ;
+};
+
+struct BoxConversion {
+	int    images  = 0;
+	qint64 boxes   = 0;
+	qint64 skipped = 0; // boxes whose name is not a label of the configuration
+	int    missing = 0; // images without annotation in the source format, not converted
+};
+
+// from and to are "voc", "yolo" or a COCO .json file. The images are read and
+// written by chunks spread over the global thread pool ; the COCO output is
+// streamed in the order of the images, so memory stays bounded by a chunk.
+// The YOLO classes and COCO categories are the labels of id_labels.
+bool convertBoxes(const QString &dir, const QString &from, const QString &to, const Id2Labels &id_labels, BoxConversion *result, QString *error);
+
+// Headless entry point : PixelAnnotationTool --convert-boxes <dir> <from> <to> [--config <config.json>]
+int runConvertBoxesCommand(const QStringList &arguments);
+
+#endif // BOX_FORMATS_H
@@ -0,0 +1,64 @@
+#include "box_refine.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+
+BoxRefineJob makeBoxRefineJob(const cv::Mat &bgr, const cv::Mat &labels, cv::Rect box, int label_id) {
+	BoxRefineJob job;
+	cv::Rect bounds(0, 0, bgr.cols, bgr.rows);
+	// GrabCut needs some background around the box to learn its model
+	int margin = std::max(8, std::max(box.width, box.height) / 10);
+	job.box = box & bounds;
+	job.roi = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & bounds;
+	job.label_id = label_id;
+	if (job.box.area() > 0) {
+		job.image = bgr(job.roi).clone();
+		job.labels = labels(job.roi).clone();
+	}
+	return job;
+}
+
+// Seeds : outside the box is background, pixels already painted with the
+// box label are foreground, pixels of another label are background, and
+// the rest of the box is probably foreground.
+BoxRefineResult refineBox(const BoxRefineJob &job) {
+	BoxRefineResult result;
+	result.roi = job.roi;
+	result.label_id = job.label_id;
+	result.labels = job.labels;
+	if (job.image.empty() || job.box.width < 2 || job.box.height < 2)
+		return result;
+
+	cv::Mat mask(job.roi.size(), CV_8UC1, cv::Scalar(cv::GC_BGD));
+	cv::Rect box = job.box - job.roi.tl();
+	mask(box).setTo(cv::Scalar(cv::GC_PR_FGD));
+	for (int y = box.y; y < box.y + box.height; y++) {
+		const ushort * label = job.labels.ptr<ushort>(y);
+		uchar * seed = mask.ptr<uchar>(y);
+		for (int x = box.x; x < box.x + box.width; x++) {
+			if (label[x] == job.label_id)
+				seed[x] = cv::GC_FGD;
+			else if (label[x] != 0)
+				seed[x] = cv::GC_BGD;
+		}
+	}
+
+	if (cv::countNonZero(mask == cv::GC_BGD) == 0)
+		return result; // box covering the whole image and nothing else labeled
+	if (cv::countNonZero(mask & 1) == 0)
+		return result; // box fully painted with other labels
+
+	// runs in a worker : an exception would only surface in the GUI thread
+	cv::Mat bgd_model, fgd_model;
+	try {
+		cv::grabCut(job.image, mask, box, bgd_model, fgd_model, 3, cv::GC_INIT_WITH_MASK);
+	} catch (const cv::Exception &) {
+		return result;
+	}
+
+	// GC_FGD (1) and GC_PR_FGD (3) are the only odd values
+	cv::Mat foreground = mask & 1;
+	result.foreground = foreground * 255;
+	return result;
+}
@@ -0,0 +1,27 @@
+#ifndef BOX_REFINE_H
+#define BOX_REFINE_H
+
+#include <opencv2/core/core.hpp>
+
+// GrabCut refinement of one bounding box into pixels of its label.
+// The job owns copies of the image and label planes cropped to the ROI, so
+// it can run in a worker thread while the canvas keeps being edited.
+struct BoxRefineJob {
+	cv::Rect roi     ; // box plus a margin, in image coordinates
+	cv::Rect box     ; // in image coordinates
+	int      label_id;
+	cv::Mat  image   ; // BGR, cropped to roi
+	cv::Mat  labels  ; // CV_16UC1, cropped to roi
+};
+
+struct BoxRefineResult {
+	cv::Rect roi       ;
+	int      label_id  ;
+	cv::Mat  foreground; // CV_8UC1, 255 where the label goes, cropped to roi
+	cv::Mat  labels    ; // the labels the job started from, to skip the pixels edited since
+};
+
+BoxRefineJob makeBoxRefineJob(const cv::Mat &bgr, const cv::Mat &labels, cv::Rect box, int label_id);
+BoxRefineResult refineBox(const BoxRefineJob &job);
+
+#endif // BOX_REFINE_H
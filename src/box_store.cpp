@@ -0,0 +1,175 @@
+#include "box_store.h"
+#include "boundingbox.h"
+
+#include <QDateTime>
+#include <QDomDocument>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+// corners closer than this grab the corner rather than the box
+static const int CORNER_DISTANCE = 15;
+
+// splitmix64 ; boxes are created from the converter's worker threads too
+quint64 newBoxId() {
+	static std::atomic<quint64> state((quint64(std::random_device()()) << 32) ^ quint64(QDateTime::currentMSecsSinceEpoch()));
+	quint64 z = state.fetch_add(0x9E3779B97F4A7C15ULL) + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void BoxStore::clear() {
+	_min_x.clear(); _min_y.clear(); _max_x.clear(); _max_y.clear();
+	_label.clear();
+	_id.clear();
+	_selected = -1;
+}
+
+void BoxStore::reserve(int count) {
+	_min_x.reserve(count); _min_y.reserve(count); _max_x.reserve(count); _max_y.reserve(count);
+	_label.reserve(count);
+	_id.reserve(count);
+}
+
+int BoxStore::_intern(const std::string &name) {
+	std::unordered_map<std::string, int>::const_iterator it = _name_index.find(name);
+	if (it != _name_index.end())
+		return it->second;
+	_names.push_back(name);
+	_name_index[name] = int(_names.size()) - 1;
+	return int(_names.size()) - 1;
+}
+
+int BoxStore::add(cv::Point a, cv::Point b, const std::string &name) {
+	_min_x.push_back(std::min(a.x, b.x));
+	_max_x.push_back(std::max(a.x, b.x));
+	_min_y.push_back(std::min(a.y, b.y));
+	_max_y.push_back(std::max(a.y, b.y));
+	_label.push_back(_intern(name));
+	_id.push_back(newBoxId());
+	return size() - 1;
+}
+
+void BoxStore::erase(int i) {
+	_min_x.erase(_min_x.begin() + i);
+	_min_y.erase(_min_y.begin() + i);
+	_max_x.erase(_max_x.begin() + i);
+	_max_y.erase(_max_y.begin() + i);
+	_label.erase(_label.begin() + i);
+	_id.erase(_id.begin() + i);
+	if (_selected == i)
+		_selected = -1;
+	else if (_selected > i)
+		_selected--;
+}
+
+bool BoxStore::contains(int i, cv::Point p) const {
+	return p.x >= _min_x[i] && p.y >= _min_y[i] && p.x <= _max_x[i] && p.y <= _max_y[i];
+}
+
+bool BoxStore::grabCorner(int i, cv::Point p) {
+	for (int corner = 0; corner < 4; corner++) {
+		const bool max_x = (corner & 1) != 0, max_y = (corner & 2) != 0;
+		const int dx = (max_x ? _max_x[i] : _min_x[i]) - p.x;
+		const int dy = (max_y ? _max_y[i] : _min_y[i]) - p.y;
+		if (dx * dx + dy * dy < CORNER_DISTANCE * CORNER_DISTANCE) {
+			_grab_max_x = max_x;
+			_grab_max_y = max_y;
+			return true;
+		}
+	}
+	return false;
+}
+
+void BoxStore::move(int i, int dx, int dy) {
+	_min_x[i] += dx; _max_x[i] += dx;
+	_min_y[i] += dy; _max_y[i] += dy;
+}
+
+void BoxStore::resize(int i, int dx, int dy) {
+	(_grab_max_x ? _max_x[i] : _min_x[i]) += dx;
+	(_grab_max_y ? _max_y[i] : _min_y[i]) += dy;
+}
+
+void BoxStore::appendXML(std::string &xml) const {
+	char coordinates[256];
+	for (int i = 0; i < size(); i++) {
+		xml += "\t<object>\n\t\t<name>";
+		xml += name(i);
+		xml += "</name>\n\t\t<pose>Unspecified</pose>\n\t\t<truncated>0</truncated>\n\t\t<difficult>0</difficult>\n";
+		snprintf(coordinates, sizeof(coordinates),
+		         "\t\t<bndbox>\n\t\t\t<xmin>%d</xmin>\n\t\t\t<ymin>%d</ymin>\n\t\t\t<xmax>%d</xmax>\n\t\t\t<ymax>%d</ymax>\n\t\t</bndbox>\n",
+		         _min_x[i], _min_y[i], _max_x[i], _max_y[i]);
+		xml += coordinates;
+		xml += "    \t</object>\n";
+	}
+}
+
+static int childInt(const QDomElement &parent, const QString &tag) {
+	return parent.firstChildElement(tag).text().toInt();
+}
+
+void BoxStore::parseXML(const QDomElement &root) {
+	for (QDomElement object = root.firstChildElement("object"); !object.isNull(); object = object.nextSiblingElement("object")) {
+		// the name is a child of <object>, not of <bndbox>
+		QDomElement bndbox = object.firstChildElement("bndbox");
+		add(cv::Point(childInt(bndbox, "xmin"), childInt(bndbox, "ymin")),
+		    cv::Point(childInt(bndbox, "xmax"), childInt(bndbox, "ymax")),
+		    object.firstChildElement("name").text().toStdString());
+	}
+}
+
+int runBoxBenchmark(const QStringList &arguments) {
+	int count = 100000;
+	int index = arguments.indexOf("--bench-boxes");
+	if (index >= 0 && index + 1 < arguments.size() && arguments[index + 1].toInt() > 0)
+		count = arguments[index + 1].toInt();
+
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int> coordinate(0, 4000);
+	const char * names[] = { "car", "person", "bicycle", "traffic sign", "truck" };
+	std::vector<cv::Point> corners(2 * count);
+	for (cv::Point &p : corners)
+		p = cv::Point(coordinate(random), coordinate(random));
+
+	QElapsedTimer timer;
+	timer.start();
+	std::vector<BoundingBox> legacy;
+	std::string legacy_xml;
+	for (int i = 0; i < count; i++)
+		legacy.push_back(BoundingBox(corners[2 * i], corners[2 * i + 1], names[i % 5]));
+	for (BoundingBox &b : legacy)
+		legacy_xml += b.toXML();
+	qint64 legacy_ms = timer.elapsed();
+
+	timer.restart();
+	BoxStore store;
+	store.reserve(count);
+	for (int i = 0; i < count; i++)
+		store.add(corners[2 * i], corners[2 * i + 1], names[i % 5]);
+	qint64 build_ms = timer.elapsed();
+	timer.restart();
+	std::string xml = "<annotation>\n";
+	store.appendXML(xml);
+	xml += "\n</annotation>";
+	qint64 export_ms = timer.elapsed();
+
+	timer.restart();
+	QDomDocument document;
+	document.setContent(QByteArray::fromRawData(xml.data(), int(xml.size())));
+	BoxStore imported;
+	imported.parseXML(document.firstChildElement());
+	qint64 import_ms = timer.elapsed();
+
+	std::cout << count << " boxes" << std::endl;
+	std::cout << "BoundingBox build + toXML : " << legacy_ms << " ms" << std::endl;
+	std::cout << "BoxStore build            : " << build_ms << " ms" << std::endl;
+	std::cout << "BoxStore export           : " << export_ms << " ms, " << xml.size() / 1024 << " KB" << std::endl;
+	std::cout << "BoxStore import (QDom)    : " << import_ms << " ms" << std::endl;
+	return imported.size() == count ? 0 : 1;
+}
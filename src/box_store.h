@@ -0,0 +1,66 @@
+#ifndef BOX_STORE_H
+#define BOX_STORE_H
+
+#include <opencv2/core/core.hpp>
+#include <QtGlobal>
+#include <QStringList>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class QDomElement;
+
+// 64-bit box id from a splitmix64 sequence seeded once per run.
+quint64 newBoxId();
+
+// Bounding boxes of an image, stored by columns : the coordinates in flat
+// arrays, each name interned once, 64-bit ids. Boxes are addressed by
+// their index, the drawing order.
+class BoxStore {
+public:
+	int  size() const { return int(_id.size()); }
+	bool empty() const { return _id.empty(); }
+	void clear();
+	void reserve(int count);
+	// The corners may be given in any order. Returns the index of the box.
+	int  add(cv::Point a, cv::Point b, const std::string &name);
+	void erase(int i);
+
+	cv::Point minPoint(int i) const { return cv::Point(_min_x[i], _min_y[i]); }
+	cv::Point maxPoint(int i) const { return cv::Point(_max_x[i], _max_y[i]); }
+	cv::Rect  rect(int i) const { return cv::Rect(minPoint(i), maxPoint(i)); }
+	const std::string & name(int i) const { return _names[_label[i]]; }
+	quint64   id(int i) const { return _id[i]; }
+
+	bool contains(int i, cv::Point p) const;
+	// Grabs the corner of box i near p (if any), the one resize() moves.
+	bool grabCorner(int i, cv::Point p);
+	void move(int i, int dx, int dy);
+	void resize(int i, int dx, int dy);
+
+	int  selected() const { return _selected; }
+	void select(int i) { _selected = i; }
+	void unselect() { _selected = -1; }
+
+	// Pascal VOC <object> elements
+	void appendXML(std::string &xml) const;
+	void parseXML(const QDomElement &root);
+
+private:
+	int _intern(const std::string &name);
+
+	std::vector<int>     _min_x, _min_y, _max_x, _max_y;
+	std::vector<int>     _label; // index in _names
+	std::vector<quint64> _id   ;
+	std::vector<std::string> _names;
+	std::unordered_map<std::string, int> _name_index;
+	int  _selected = -1;
+	bool _grab_max_x = false; // corner grabbed by grabCorner()
+	bool _grab_max_y = false;
+};
+
+// Headless entry point : PixelAnnotationTool --bench-boxes [count]
+// Times building, exporting and importing count boxes.
+int runBoxBenchmark(const QStringList &arguments);
+
+#endif // BOX_STORE_H
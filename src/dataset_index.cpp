@@ -0,0 +1,295 @@
+#include "dataset_index.h"
+#include "utils.h"
+#include "box_formats.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+static const quint32 INDEX_MAGIC   = 0x50415449; // "PATI"
+static const quint32 INDEX_VERSION = 1;
+
+QString annotationCacheDir(const QString &dir) {
+	return dir + "/.pixel_annotation";
+}
+
+QStringList imageFiles(const QString &dir) {
+	static QStringList ext_img = { "png","jpg","bmp","pgm","jpeg" ,"jpe" ,"jp2" ,"pbm" ,"ppm" ,"tiff" ,"tif" };
+	QStringList result;
+	QStringList files = QDir(dir).entryList(QDir::Files, QDir::Name);
+	for (int i = 0; i < files.size(); i++) {
+		if (files[i].size() < 4)
+			continue;
+		if (!ext_img.contains(files[i].section(".", -1, -1).toLower()))
+			continue;
+		if (files[i].toLower().indexOf("_mask.png") > -1)
+			continue;
+		if (files[i].toLower().endsWith("_instanceids.png"))
+			continue;
+		result << files[i];
+	}
+	return result;
+}
+
+QString annotationCacheFile(const QString &image_file, const QString &suffix) {
+	QFileInfo info(image_file);
+	return annotationCacheDir(info.absolutePath()) + "/" + info.fileName() + suffix;
+}
+
+void touchCacheFile(QFile &file) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+	file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#else
+	Q_UNUSED(file);
+#endif
+}
+
+void pruneAnnotationCache(const QString &dir, const QString &pattern, qint64 max_bytes) {
+	QFileInfoList files = QDir(annotationCacheDir(dir)).entryInfoList(QStringList() << pattern, QDir::Files);
+	qint64 total = 0;
+	for (int i = 0; i < files.size(); i++)
+		total += files[i].size();
+	if (total <= max_bytes)
+		return;
+	std::sort(files.begin(), files.end(), [](const QFileInfo &a, const QFileInfo &b) {
+		return a.lastModified() < b.lastModified();
+	});
+	// a file still mapped can't be removed on Windows, it is then kept
+	for (int i = 0; i < files.size() && total > max_bytes; i++) {
+		if (QFile::remove(files[i].absoluteFilePath()))
+			total -= files[i].size();
+	}
+}
+
+ImageIndexEntry::ImageIndexEntry() {
+	mask_mtime = 0;
+	pixel_count = 0;
+}
+
+qint64 ImageIndexEntry::labeledPixels() const {
+	return pixel_count - label_pixels.value(0, 0);
+}
+
+double ImageIndexEntry::coverage() const {
+	if (pixel_count == 0)
+		return 0.;
+	return double(labeledPixels()) / double(pixel_count);
+}
+
+int ImageIndexEntry::boxCount() const {
+	int count = 0;
+	for (QMap<QString, int>::const_iterator it = box_counts.begin(); it != box_counts.end(); ++it)
+		count += it.value();
+	return count;
+}
+
+bool ImageIndexEntry::contains(const QString &name, const Id2Labels &id_labels) const {
+	if (box_counts.value(name, 0) > 0)
+		return true;
+	const LabelInfo * label = id_labels.find(name);
+	return label != NULL && label_pixels.value(label->id, 0) > 0;
+}
+
+static QDataStream & operator<<(QDataStream &out, const ImageIndexEntry &entry) {
+	out << entry.image << entry.mask_mtime << entry.mask_hash << entry.pixel_count
+		<< entry.label_pixels << entry.box_counts;
+	return out;
+}
+
+static QDataStream & operator>>(QDataStream &in, ImageIndexEntry &entry) {
+	in >> entry.image >> entry.mask_mtime >> entry.mask_hash >> entry.pixel_count
+		>> entry.label_pixels >> entry.box_counts;
+	return in;
+}
+
+static QByteArray serialize(const ImageIndexEntry &entry) {
+	QByteArray record;
+	QDataStream out(&record, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_5_0);
+	out << entry;
+	return record;
+}
+
+static void writeHeader(QIODevice *device) {
+	QDataStream out(device);
+	out << INDEX_MAGIC << INDEX_VERSION;
+}
+
+DatasetIndex::DatasetIndex(const QString &dir) : _dir(dir) {}
+
+QString DatasetIndex::indexFile(const QString &dir) {
+	return annotationCacheDir(dir) + "/index.bin";
+}
+
+bool DatasetIndex::load() {
+	_entries.clear();
+	QFile file(indexFile(_dir));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream in(&file);
+	quint32 magic, version;
+	in >> magic >> version;
+	if (in.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != INDEX_VERSION)
+		return false;
+
+	int records = 0;
+	while (!in.atEnd()) {
+		QByteArray record;
+		in >> record;
+		if (in.status() != QDataStream::Ok)
+			break; // truncated tail, keep what was read
+		QDataStream rin(record);
+		rin.setVersion(QDataStream::Qt_5_0);
+		ImageIndexEntry entry;
+		rin >> entry;
+		if (rin.status() != QDataStream::Ok)
+			continue;
+		_entries[entry.image] = entry;
+		records++;
+	}
+	file.close();
+
+	if (records > 2 * _entries.size() + 64)
+		compact();
+	return true;
+}
+
+bool DatasetIndex::compact() const {
+	QDir().mkpath(annotationCacheDir(_dir));
+	QSaveFile file(indexFile(_dir));
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	writeHeader(&file);
+	QDataStream out(&file);
+	for (QHash<QString, ImageIndexEntry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+		out << serialize(it.value());
+	return file.commit();
+}
+
+bool DatasetIndex::_append(const QList<ImageIndexEntry> &entries) const {
+	QDir().mkpath(annotationCacheDir(_dir));
+	QFile file(indexFile(_dir));
+	bool is_new = !file.exists() || file.size() == 0;
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+		return false;
+	if (is_new)
+		writeHeader(&file);
+	QDataStream out(&file);
+	for (int i = 0; i < entries.size(); i++)
+		out << serialize(entries[i]);
+	file.close();
+	return true;
+}
+
+void DatasetIndex::update(const ImageIndexEntry &entry) {
+	update(QList<ImageIndexEntry>() << entry);
+}
+
+void DatasetIndex::update(const QList<ImageIndexEntry> &entries) {
+	if (entries.isEmpty())
+		return;
+	for (int i = 0; i < entries.size(); i++)
+		_entries[entries[i].image] = entries[i];
+	if (!_append(entries))
+		qWarning("Couldn't update the dataset index of %s", qPrintable(_dir));
+}
+
+namespace {
+
+// Entry of an image from its files ; an empty entry when the mask can't be read.
+struct IndexImage {
+	typedef ImageIndexEntry result_type;
+
+	QString dir;
+
+	ImageIndexEntry operator()(const QString &name) const {
+		const QString image_file = dir + "/" + name;
+		cv::Mat id = loadLabelImage(dir + "/" + QFileInfo(name).baseName() + "_mask.png");
+		if (id.empty())
+			return ImageIndexEntry();
+		LabelHistogram histogram;
+		histogram.add(id);
+		BoxStore boxes;
+		readVocBoxes(vocFile(image_file), boxes);
+		QStringList box_names;
+		for (int i = 0; i < boxes.size(); i++)
+			box_names << QString::fromStdString(boxes.name(i));
+		return DatasetIndex::makeEntry(image_file, id, histogram.counts(), box_names);
+	}
+};
+
+} // namespace
+
+// Images with a mask that have no entry, or whose mask changed since their
+// entry (e.g. annotated before the index existed, or by another tool).
+QStringList DatasetIndex::staleImages() const {
+	QStringList stale;
+	const QStringList files = imageFiles(_dir);
+	for (int i = 0; i < files.size(); i++) {
+		QFileInfo mask(_dir + "/" + QFileInfo(files[i]).baseName() + "_mask.png");
+		if (!mask.exists())
+			continue;
+		const ImageIndexEntry * entry = find(files[i]);
+		if (entry == NULL || entry->mask_mtime != mask.lastModified().toMSecsSinceEpoch())
+			stale << files[i];
+	}
+	return stale;
+}
+
+QFuture<ImageIndexEntry> DatasetIndex::scan(const QStringList &images) const {
+	IndexImage index_image;
+	index_image.dir = _dir;
+	return QtConcurrent::mapped(images, index_image);
+}
+
+// Adds the entries of a scan, except those of unreadable masks and those
+// already replaced by a newer save. Returns the number of entries added.
+int DatasetIndex::addScanned(const QList<ImageIndexEntry> &entries) {
+	QList<ImageIndexEntry> added;
+	for (int i = 0; i < entries.size(); i++) {
+		if (entries[i].image.isEmpty())
+			continue;
+		const ImageIndexEntry * entry = find(entries[i].image);
+		if (entry != NULL && entry->mask_mtime >= entries[i].mask_mtime)
+			continue;
+		added << entries[i];
+	}
+	update(added);
+	return added.size();
+}
+
+const ImageIndexEntry * DatasetIndex::find(const QString &image) const {
+	QHash<QString, ImageIndexEntry>::const_iterator it = _entries.find(image);
+	if (it == _entries.end())
+		return NULL;
+	return &it.value();
+}
+
+ImageIndexEntry DatasetIndex::makeEntry(const QString &image_file, const cv::Mat &mask_id, const QMap<int, qint64> &label_pixels, const QStringList &box_names) {
+	QFileInfo file(image_file);
+	ImageIndexEntry entry;
+	entry.image = file.fileName();
+	entry.pixel_count = qint64(mask_id.cols) * mask_id.rows;
+
+	QFileInfo mask_file(file.dir().absolutePath() + "/" + file.baseName() + "_mask.png");
+	if (mask_file.exists())
+		entry.mask_mtime = mask_file.lastModified().toMSecsSinceEpoch();
+
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	for (int y = 0; y < mask_id.rows; y++)
+		hash.addData(reinterpret_cast<const char*>(mask_id.ptr<ushort>(y)), mask_id.cols * int(sizeof(ushort)));
+	entry.mask_hash = hash.result();
+	entry.label_pixels = label_pixels;
+
+	for (int i = 0; i < box_names.size(); i++)
+		entry.box_counts[box_names[i]]++;
+	return entry;
+}
@@ -0,0 +1,76 @@
+#ifndef DATASET_INDEX_H
+#define DATASET_INDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QFuture>
+#include <QFile>
+
+#include <opencv2/core/core.hpp>
+
+#include "labels.h"
+
+// Statistics of one annotated image, kept in the per-directory index so the
+// image tree can be filtered and sorted without opening any mask or xml file.
+struct ImageIndexEntry {
+	QString            image        ; // file name, relative to the directory
+	qint64             mask_mtime   ; // last modification of _mask.png (ms since epoch)
+	QByteArray         mask_hash    ; // md5 of the label plane
+	qint64             pixel_count  ;
+	QMap<int, qint64>  label_pixels ; // label id -> number of pixels
+	QMap<QString, int> box_counts   ; // object name -> number of boxes
+
+	ImageIndexEntry();
+	qint64 labeledPixels() const;
+	double coverage() const;
+	int    boxCount() const;
+	bool   contains(const QString &name, const Id2Labels &id_labels) const;
+};
+
+// Index of a directory, stored in <dir>/.pixel_annotation/index.bin.
+// The file is append only : every update() appends one record and the last
+// record of an image wins. It is compacted when loaded if too many records
+// are stale, so saving one image never rewrites the whole index.
+class DatasetIndex {
+public:
+	explicit DatasetIndex(const QString &dir);
+
+	bool load();
+	bool compact() const;
+	void update(const ImageIndexEntry &entry);
+	void update(const QList<ImageIndexEntry> &entries);
+	// images with a mask and no entry, or whose mask changed since their entry
+	QStringList staleImages() const;
+	// entries of the images, computed on all cores ; empty when a mask can't be read
+	QFuture<ImageIndexEntry> scan(const QStringList &images) const;
+	int  addScanned(const QList<ImageIndexEntry> &entries);
+	const ImageIndexEntry * find(const QString &image) const;
+	const QHash<QString, ImageIndexEntry> & entries() const { return _entries; }
+	QString dir() const { return _dir; }
+
+	static QString indexFile(const QString &dir);
+	// label_pixels : pixels of each label id, as maintained by ImageMask
+	static ImageIndexEntry makeEntry(const QString &image_file, const cv::Mat &mask_id, const QMap<int, qint64> &label_pixels, const QStringList &box_names);
+
+private:
+	bool _append(const QList<ImageIndexEntry> &entries) const;
+
+	QString                         _dir;
+	QHash<QString, ImageIndexEntry> _entries;
+};
+
+QString annotationCacheDir(const QString &dir);
+// images of a directory (file names), masks excluded
+QStringList imageFiles(const QString &dir);
+// <dir>/.pixel_annotation/<image file name><suffix>
+QString annotationCacheFile(const QString &image_file, const QString &suffix);
+// Marks an open cache file as just used (Qt >= 5.10 ; else the files are pruned by age).
+void touchCacheFile(QFile &file);
+// Removes the least recently used files of the cache of dir matching pattern
+// (e.g. "*.raw") until they take at most max_bytes.
+void pruneAnnotationCache(const QString &dir, const QString &pattern, qint64 max_bytes);
+
+#endif // DATASET_INDEX_H
@@ -0,0 +1,290 @@
+#include "dataset_stats.h"
+#include "dataset_index.h"
+#include "label_cache.h"
+#include "utils.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QXmlStreamReader>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iostream>
+
+ImageStats::ImageStats() : has_mask(false), width(0), height(0) {}
+
+double ImageStats::unlabeledRatio() const {
+	return pixelCount() > 0 ? double(label_pixels.value(0, 0)) / pixelCount() : 1.;
+}
+
+static void readBoxes(const QString &xml_file, ImageStats &stats) {
+	QFile file(xml_file);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return;
+	QXmlStreamReader xml(&file);
+	BoxStats box;
+	int xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+	bool in_object = false;
+	while (!xml.atEnd()) {
+		xml.readNext();
+		if (xml.isStartElement()) {
+			if (xml.name() == "object") {
+				in_object = true;
+				box.name.clear();
+				xmin = ymin = xmax = ymax = 0;
+			} else if (in_object && xml.name() == "name") {
+				box.name = xml.readElementText();
+			} else if (in_object && xml.name() == "xmin") {
+				xmin = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "ymin") {
+				ymin = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "xmax") {
+				xmax = xml.readElementText().toInt();
+			} else if (in_object && xml.name() == "ymax") {
+				ymax = xml.readElementText().toInt();
+			}
+		} else if (xml.isEndElement() && xml.name() == "object") {
+			in_object = false;
+			box.width = std::abs(xmax - xmin);
+			box.height = std::abs(ymax - ymin);
+			stats.boxes << box;
+		}
+	}
+}
+
+ImageStats computeImageStats(const QString &image_file) {
+	QFileInfo file(image_file);
+	QString dir = file.dir().absolutePath();
+	ImageStats stats;
+	stats.image = file.fileName();
+
+	QString mask_file = dir + "/" + file.baseName() + "_mask.png";
+	if (QFile::exists(mask_file)) {
+		std::shared_ptr<QFile> mapping;
+		cv::Mat id = LabelPlaneCache::map(mask_file, mapping);
+		if (id.empty())
+			id = loadLabelImage(mask_file);
+		if (!id.empty()) {
+			stats.has_mask = true;
+			stats.width = id.cols;
+			stats.height = id.rows;
+			LabelHistogram histogram;
+			histogram.add(id);
+			stats.label_pixels = histogram.counts();
+		}
+	}
+	readBoxes(dir + "/xml/" + file.baseName() + ".xml", stats);
+	return stats;
+}
+
+QList<ImageStats> computeDatasetStats(const QString &dir) {
+	QStringList files = imageFiles(dir);
+	for (int i = 0; i < files.size(); i++)
+		files[i] = QDir(dir).absoluteFilePath(files[i]);
+	return QtConcurrent::blockingMapped<QList<ImageStats> >(files, computeImageStats);
+}
+
+static QString labelName(const Id2Labels &id_labels, int id) {
+	const LabelInfo * label = id_labels.find(id);
+	return label != NULL ? label->name : QString();
+}
+
+// box areas are bucketed by powers of two of their side : <8, <16, ... >=1024
+static const int BOX_BUCKETS = 9;
+static int boxBucket(const BoxStats &box) {
+	double side = std::sqrt(double(box.width) * box.height);
+	int bucket = 0;
+	for (int limit = 8; bucket < BOX_BUCKETS - 1 && side >= limit; limit *= 2)
+		bucket++;
+	return bucket;
+}
+static QString boxBucketName(int bucket) {
+	return bucket == BOX_BUCKETS - 1 ? QString(">=%1").arg(8 << (bucket - 1)) : QString("<%1").arg(8 << bucket);
+}
+
+struct LabelTotals {
+	qint64 pixels = 0;
+	int    images = 0;
+};
+
+struct BoxTotals {
+	int    count = 0;
+	qint64 width_sum = 0, height_sum = 0;
+	int    min_width = INT_MAX, min_height = INT_MAX, max_width = 0, max_height = 0;
+	int    buckets[BOX_BUCKETS] = {};
+};
+
+static void aggregate(const QList<ImageStats> &stats, QMap<int, LabelTotals> &labels, QMap<QString, BoxTotals> &boxes, qint64 &pixels, qint64 &unlabeled) {
+	pixels = unlabeled = 0;
+	for (const ImageStats &image : stats) {
+		pixels += image.pixelCount();
+		unlabeled += image.label_pixels.value(0, 0);
+		for (QMap<int, qint64>::const_iterator it = image.label_pixels.begin(); it != image.label_pixels.end(); ++it) {
+			labels[it.key()].pixels += it.value();
+			labels[it.key()].images++;
+		}
+		for (const BoxStats &box : image.boxes) {
+			BoxTotals & t = boxes[box.name];
+			t.count++;
+			t.width_sum += box.width;
+			t.height_sum += box.height;
+			t.min_width = std::min(t.min_width, box.width);
+			t.min_height = std::min(t.min_height, box.height);
+			t.max_width = std::max(t.max_width, box.width);
+			t.max_height = std::max(t.max_height, box.height);
+			t.buckets[boxBucket(box)]++;
+		}
+	}
+}
+
+static bool writeJson(const QString &file_name, const QList<ImageStats> &stats, const Id2Labels &id_labels) {
+	QMap<int, LabelTotals> labels;
+	QMap<QString, BoxTotals> boxes;
+	qint64 pixels, unlabeled;
+	aggregate(stats, labels, boxes, pixels, unlabeled);
+
+	QJsonObject root;
+	root["images"] = stats.size();
+	root["pixels"] = double(pixels);
+	root["unlabeled_ratio"] = pixels > 0 ? double(unlabeled) / pixels : 1.;
+
+	QJsonArray label_array;
+	for (QMap<int, LabelTotals>::const_iterator it = labels.begin(); it != labels.end(); ++it) {
+		QJsonObject label;
+		label["id"] = it.key();
+		label["name"] = labelName(id_labels, it.key());
+		label["pixels"] = double(it.value().pixels);
+		label["ratio"] = pixels > 0 ? double(it.value().pixels) / pixels : 0.;
+		label["images"] = it.value().images;
+		label_array.append(label);
+	}
+	root["labels"] = label_array;
+
+	QJsonArray box_array;
+	for (QMap<QString, BoxTotals>::const_iterator it = boxes.begin(); it != boxes.end(); ++it) {
+		const BoxTotals & t = it.value();
+		QJsonObject box;
+		box["name"] = it.key();
+		box["count"] = t.count;
+		box["mean_width"] = double(t.width_sum) / t.count;
+		box["mean_height"] = double(t.height_sum) / t.count;
+		box["min_width"] = t.min_width;
+		box["min_height"] = t.min_height;
+		box["max_width"] = t.max_width;
+		box["max_height"] = t.max_height;
+		QJsonObject buckets;
+		for (int b = 0; b < BOX_BUCKETS; b++)
+			buckets[boxBucketName(b)] = t.buckets[b];
+		box["size_distribution"] = buckets;
+		box_array.append(box);
+	}
+	root["boxes"] = box_array;
+
+	QJsonArray image_array;
+	for (const ImageStats &image : stats) {
+		QJsonObject object;
+		object["image"] = image.image;
+		object["width"] = image.width;
+		object["height"] = image.height;
+		object["coverage"] = image.pixelCount() > 0 ? double(image.labeledPixels()) / image.pixelCount() : 0.;
+		object["unlabeled_ratio"] = image.unlabeledRatio();
+		object["boxes"] = image.boxes.size();
+		QJsonObject label_pixels;
+		for (QMap<int, qint64>::const_iterator it = image.label_pixels.begin(); it != image.label_pixels.end(); ++it)
+			label_pixels[QString::number(it.key())] = double(it.value());
+		object["label_pixels"] = label_pixels;
+		image_array.append(object);
+	}
+	root["per_image"] = image_array;
+
+	QFile file(file_name);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	return file.write(QJsonDocument(root).toJson()) > 0;
+}
+
+static bool writeCsv(const QString &file_name, const QList<ImageStats> &stats, const Id2Labels &id_labels) {
+	QMap<int, LabelTotals> labels;
+	QMap<QString, BoxTotals> boxes;
+	qint64 pixels, unlabeled;
+	aggregate(stats, labels, boxes, pixels, unlabeled);
+	QString base = file_name.left(file_name.size() - 4);
+
+	QFile label_file(base + "_labels.csv");
+	if (!label_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	QTextStream label_out(&label_file);
+	label_out << "id,name,pixels,ratio,images\n";
+	for (QMap<int, LabelTotals>::const_iterator it = labels.begin(); it != labels.end(); ++it) {
+		label_out << it.key() << "," << csvField(labelName(id_labels, it.key())) << "," << it.value().pixels << ","
+			<< (pixels > 0 ? double(it.value().pixels) / pixels : 0.) << "," << it.value().images << "\n";
+	}
+
+	QFile image_file(base + "_images.csv");
+	if (!image_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	QTextStream image_out(&image_file);
+	image_out << "image,width,height,labeled_pixels,coverage,unlabeled_ratio,boxes\n";
+	for (const ImageStats &image : stats) {
+		image_out << csvField(image.image) << "," << image.width << "," << image.height << "," << image.labeledPixels() << ","
+			<< (image.pixelCount() > 0 ? double(image.labeledPixels()) / image.pixelCount() : 0.) << ","
+			<< image.unlabeledRatio() << "," << image.boxes.size() << "\n";
+	}
+
+	QFile box_file(base + "_boxes.csv");
+	if (!box_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	QTextStream box_out(&box_file);
+	box_out << "name,count,mean_width,mean_height,min_width,min_height,max_width,max_height";
+	for (int b = 0; b < BOX_BUCKETS; b++)
+		box_out << ",side" << boxBucketName(b);
+	box_out << "\n";
+	for (QMap<QString, BoxTotals>::const_iterator it = boxes.begin(); it != boxes.end(); ++it) {
+		const BoxTotals & t = it.value();
+		box_out << csvField(it.key()) << "," << t.count << "," << double(t.width_sum) / t.count << "," << double(t.height_sum) / t.count
+			<< "," << t.min_width << "," << t.min_height << "," << t.max_width << "," << t.max_height;
+		for (int b = 0; b < BOX_BUCKETS; b++)
+			box_out << "," << t.buckets[b];
+		box_out << "\n";
+	}
+	return true;
+}
+
+bool writeDatasetStats(const QString &file, const QList<ImageStats> &stats, const Id2Labels &id_labels) {
+	if (file.endsWith(".csv", Qt::CaseInsensitive))
+		return writeCsv(file, stats, id_labels);
+	return writeJson(file, stats, id_labels);
+}
+
+int runStatsCommand(const QStringList &arguments) {
+	int index = arguments.indexOf("--stats");
+	if (index < 0 || index + 2 >= arguments.size()) {
+		std::cerr << "usage: PixelAnnotationTool --stats <dir> <output.json|output.csv> [--config <config.json>]" << std::endl;
+		return 2;
+	}
+	QString dir = arguments[index + 1];
+	QString output = arguments[index + 2];
+
+	Name2Labels labels = defaulfLabels();
+	int config = arguments.indexOf("--config");
+	if (config >= 0 && config + 1 < arguments.size() && !labels.readFile(arguments[config + 1])) {
+		std::cerr << "can't open " << arguments[config + 1].toStdString() << std::endl;
+		return 1;
+	}
+	Id2Labels id_labels = getId2Label(labels);
+
+	QList<ImageStats> stats = computeDatasetStats(dir);
+	if (!writeDatasetStats(output, stats, id_labels)) {
+		std::cerr << "can't write " << output.toStdString() << std::endl;
+		return 1;
+	}
+	std::cout << stats.size() << " images -> " << output.toStdString() << std::endl;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef DATASET_STATS_H
+#define DATASET_STATS_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QMap>
+
+#include "labels.h"
+
+struct BoxStats {
+	QString name  ;
+	int     width ;
+	int     height;
+};
+
+// Statistics of one image, read from its _mask.png and xml/<name>.xml.
+struct ImageStats {
+	QString           image       ; // file name, relative to the directory
+	bool              has_mask    ;
+	int               width       ;
+	int               height      ;
+	QMap<int, qint64> label_pixels; // label id -> number of pixels
+	QList<BoxStats>   boxes       ;
+
+	ImageStats();
+	qint64 pixelCount() const { return qint64(width) * height; }
+	qint64 labeledPixels() const { return pixelCount() - label_pixels.value(0, 0); }
+	double unlabeledRatio() const;
+};
+
+ImageStats computeImageStats(const QString &image_file);
+
+// Runs computeImageStats on every image of the directory with the global
+// thread pool, blocking. The GUI runs the same work through a QFutureWatcher.
+QList<ImageStats> computeDatasetStats(const QString &dir);
+
+// The output format follows the extension : a single .json document, or
+// <base>_labels.csv, <base>_images.csv and <base>_boxes.csv for .csv.
+bool writeDatasetStats(const QString &file, const QList<ImageStats> &stats, const Id2Labels &id_labels);
+
+// Headless entry point : PixelAnnotationTool --stats <dir> <output.json|.csv> [--config <config.json>]
+int runStatsCommand(const QStringList &arguments);
+
+#endif // DATASET_STATS_H
@@ -0,0 +1,259 @@
+#include "edit_journal.h"
+#include "dataset_index.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char JOURNAL_MAGIC[4] = { 'P', 'A', 'T', 'J' };
+static const quint32 JOURNAL_VERSION = 1;
+
+enum JournalRecord {
+	RECORD_PATCH = 1,
+	RECORD_BOXES = 2,
+	RECORD_POLYGONS = 3
+};
+
+QString journalFile(const QString &image_file) {
+	return annotationCacheFile(image_file, ".journal");
+}
+
+static void writeRecords(QString file_name, QByteArray data, bool start_over) {
+	QDir().mkpath(QFileInfo(file_name).absolutePath());
+	QFile file(file_name);
+	QIODevice::OpenMode mode = QIODevice::WriteOnly | (start_over ? QIODevice::Truncate : QIODevice::Append);
+	if (!file.open(mode))
+		return;
+	file.write(data);
+	file.flush();
+#ifdef Q_OS_WIN
+	_commit(file.handle());
+#else
+	fsync(file.handle());
+#endif
+}
+
+EditJournal::~EditJournal() {
+	close();
+}
+
+void EditJournal::open(const QString &file, bool keep) {
+	close();
+	_file = file;
+	_buffer.clear();
+	_start_over = !keep;
+	if (!keep)
+		QFile::remove(_file);
+}
+
+void EditJournal::close() {
+	if (!isOpen())
+		return;
+	flush();
+	_pending.waitForFinished();
+	if (!_buffer.isEmpty()) // a write was still running at the flush
+		writeRecords(_file, _buffer, _start_over);
+	_buffer.clear();
+	_file.clear();
+}
+
+void EditJournal::discard() {
+	if (!isOpen())
+		return;
+	_pending.waitForFinished();
+	_buffer.clear();
+	QFile::remove(_file);
+	_start_over = true;
+}
+
+void EditJournal::flush() {
+	if (_buffer.isEmpty() || _pending.isRunning())
+		return;
+	_pending = QtConcurrent::run(writeRecords, _file, _buffer, _start_over);
+	_buffer.clear();
+	_start_over = false;
+}
+
+// record : type, payload size, payload, checksum of the payload
+void EditJournal::_append(quint8 type, const QByteArray &payload) {
+	if (!isOpen())
+		return;
+	QDataStream out(&_buffer, QIODevice::WriteOnly | QIODevice::Append);
+	if (_start_over && _buffer.isEmpty()) {
+		out.writeRawData(JOURNAL_MAGIC, 4);
+		out << JOURNAL_VERSION;
+	}
+	out << type << quint32(payload.size());
+	out.writeRawData(payload.constData(), payload.size());
+	out << qChecksum(payload.constData(), payload.size());
+}
+
+// Runs of equal labels in raster order over the rect, so a stroke or a
+// fill costs a few bytes per row.
+void EditJournal::appendPatch(cv::Rect rect, const cv::Mat &labels) {
+	if (!isOpen() || rect.area() == 0 || labels.size() != rect.size() || labels.type() != CV_16UC1)
+		return;
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << qint32(rect.x) << qint32(rect.y) << qint32(rect.width) << qint32(rect.height);
+	ushort current = labels.at<ushort>(0, 0);
+	quint32 length = 0;
+	for (int y = 0; y < labels.rows; y++) {
+		const ushort * line = labels.ptr<ushort>(y);
+		for (int x = 0; x < labels.cols; x++) {
+			if (line[x] != current) {
+				out << quint16(current) << length;
+				current = line[x];
+				length = 0;
+			}
+			length++;
+		}
+	}
+	out << quint16(current) << length;
+	_append(RECORD_PATCH, payload);
+}
+
+void EditJournal::appendBoxes(const BoxStore &boxes) {
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << quint32(boxes.size());
+	for (int i = 0; i < boxes.size(); i++) {
+		cv::Point a = boxes.minPoint(i), c = boxes.maxPoint(i);
+		out << QString::fromStdString(boxes.name(i)) << qint32(a.x) << qint32(a.y) << qint32(c.x) << qint32(c.y);
+	}
+	_append(RECORD_BOXES, payload);
+}
+
+void EditJournal::appendPolygons(const std::vector<AnnotationPolygon> &polygons) {
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << quint32(polygons.size());
+	for (const AnnotationPolygon &polygon : polygons) {
+		out << QString::fromStdString(polygon.getName()) << quint32(polygon.size());
+		for (cv::Point p : polygon.getPoints())
+			out << qint32(p.x) << qint32(p.y);
+	}
+	_append(RECORD_POLYGONS, payload);
+}
+
+static bool replayPatch(const QByteArray &payload, cv::Mat &id) {
+	QDataStream in(payload);
+	qint32 x, y, width, height;
+	in >> x >> y >> width >> height;
+	cv::Rect rect(x, y, width, height);
+	if (in.status() != QDataStream::Ok || rect.area() <= 0 || (rect & cv::Rect(0, 0, id.cols, id.rows)) != rect)
+		return false;
+	cv::Mat region(rect.size(), CV_16UC1);
+	ushort * out = region.ptr<ushort>();
+	const qint64 total = qint64(rect.area());
+	qint64 filled = 0;
+	while (filled < total) {
+		quint16 label;
+		quint32 length;
+		in >> label >> length;
+		if (in.status() != QDataStream::Ok || length == 0 || filled + length > total)
+			return false;
+		std::fill(out + filled, out + filled + length, ushort(label));
+		filled += length;
+	}
+	region.copyTo(id(rect));
+	return true;
+}
+
+static bool replayBoxes(const QByteArray &payload, BoxStore *boxes) {
+	QDataStream in(payload);
+	quint32 count;
+	in >> count;
+	BoxStore result;
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+		QString name;
+		qint32 x1, y1, x2, y2;
+		in >> name >> x1 >> y1 >> x2 >> y2;
+		result.add(cv::Point(x1, y1), cv::Point(x2, y2), name.toStdString());
+	}
+	if (in.status() != QDataStream::Ok)
+		return false;
+	*boxes = result;
+	return true;
+}
+
+static bool replayPolygons(const QByteArray &payload, std::vector<AnnotationPolygon> *polygons) {
+	QDataStream in(payload);
+	quint32 count;
+	in >> count;
+	std::vector<AnnotationPolygon> result;
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+		QString name;
+		quint32 points;
+		in >> name >> points;
+		AnnotationPolygon polygon(name.toStdString());
+		for (quint32 j = 0; j < points && in.status() == QDataStream::Ok; j++) {
+			qint32 x, y;
+			in >> x >> y;
+			polygon.addPoint(cv::Point(x, y));
+		}
+		result.push_back(polygon);
+	}
+	if (in.status() != QDataStream::Ok)
+		return false;
+	polygons->swap(result);
+	return true;
+}
+
+int EditJournal::replay(const QString &file_name, cv::Mat &id, BoxStore *boxes, bool *has_boxes,
+                        std::vector<AnnotationPolygon> *polygons, bool *has_polygons) {
+	*has_boxes = false;
+	*has_polygons = false;
+	QFile file(file_name);
+	if (id.empty() || id.type() != CV_16UC1 || !file.open(QIODevice::ReadOnly))
+		return 0;
+	QDataStream in(&file);
+	char magic[4];
+	quint32 version = 0;
+	if (in.readRawData(magic, 4) != 4 || memcmp(magic, JOURNAL_MAGIC, 4) != 0)
+		return 0;
+	in >> version;
+	if (version != JOURNAL_VERSION)
+		return 0;
+
+	int records = 0;
+	while (!in.atEnd()) {
+		quint8 type;
+		quint32 size;
+		quint16 checksum;
+		in >> type >> size;
+		if (in.status() != QDataStream::Ok || size > quint32(file.size()))
+			break;
+		QByteArray payload(int(size), 0);
+		if (in.readRawData(payload.data(), int(size)) != int(size))
+			break;
+		in >> checksum;
+		if (in.status() != QDataStream::Ok || checksum != qChecksum(payload.constData(), payload.size()))
+			break;
+		if (type == RECORD_PATCH && !replayPatch(payload, id))
+			break;
+		if (type == RECORD_BOXES) {
+			if (!replayBoxes(payload, boxes))
+				break;
+			*has_boxes = true;
+		}
+		if (type == RECORD_POLYGONS) {
+			if (!replayPolygons(payload, polygons))
+				break;
+			*has_polygons = true;
+		}
+		records++;
+	}
+	return records;
+}
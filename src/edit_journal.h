@@ -0,0 +1,55 @@
+#ifndef EDIT_JOURNAL_H
+#define EDIT_JOURNAL_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+#include <QByteArray>
+#include <QFuture>
+#include <vector>
+
+#include "box_store.h"
+#include "polygon.h"
+
+// Append-only journal of the edits made to an image since its last save,
+// so that a crash only loses the edits not yet flushed. The records are
+// the undo patches (rect and run-length encoded labels) and snapshots of
+// the boxes and of the polygons. Appending only encodes into a memory buffer ; flush() hands
+// the buffer to a worker thread which writes and syncs it.
+class EditJournal {
+public:
+	~EditJournal();
+
+	// keep appends to the journal already in the file (it was just
+	// replayed), otherwise any previous journal is removed.
+	void open(const QString &file, bool keep);
+	// Flushes and waits for the pending write.
+	void close();
+	// The edits were saved : the journal is removed.
+	void discard();
+	bool isOpen() const { return !_file.isEmpty(); }
+	bool hasPending() const { return !_buffer.isEmpty(); }
+
+	void appendPatch(cv::Rect rect, const cv::Mat &labels);
+	void appendBoxes(const BoxStore &boxes);
+	void appendPolygons(const std::vector<AnnotationPolygon> &polygons);
+	void flush();
+
+	// Applies the records of a journal to id (CV_16UC1) and returns their
+	// count. A torn record at the end (crash while writing) ends the replay.
+	// *boxes gets the last box snapshot, if any (*has_boxes), and *polygons
+	// the last polygon snapshot (*has_polygons), without their label patches.
+	static int replay(const QString &file, cv::Mat &id, BoxStore *boxes, bool *has_boxes,
+	                  std::vector<AnnotationPolygon> *polygons, bool *has_polygons);
+
+private:
+	void _append(quint8 type, const QByteArray &payload);
+
+	QString      _file      ;
+	QByteArray   _buffer    ;
+	bool         _start_over = false; // the next write truncates and starts with the header
+	QFuture<void> _pending  ;
+};
+
+QString journalFile(const QString &image_file);
+
+#endif // EDIT_JOURNAL_H
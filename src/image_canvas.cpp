@@ -1,11 +1,21 @@
 
 #include "image_canvas.h"
 #include "main_window.h"
+#include "trace.h"
+#include "recolor.h"
+#include "label_cache.h"
+#include "box_formats.h"
 
 #include <QtDebug>
 #include <QtWidgets>
 #include <fstream>
+#include <cmath>
 #include <QtXml>
+#include <QtConcurrent>
+
+// tiled images above this size are annotated one window at a time
+static const qint64 LARGE_IMAGE_PIXELS = qint64(16384) * 16384;
+static const int    WINDOW_SIZE        = 4096;
 
 ImageCanvas::ImageCanvas(MainWindow *ui) :
     QLabel() ,
@@ -24,14 +34,26 @@ ImageCanvas::ImageCanvas(MainWindow *ui) :
 
 	_undo_list.clear();
 	_undo_index = 0;
-	_undo = false;
 
     _scroll_parent->setBackgroundRole(QPalette::Dark);
     _scroll_parent->setWidget(this);
     _operation_mode = DRAW_MODE;
+	connect(&_superpixel_watcher, SIGNAL(finished()), this, SLOT(_superpixelsReady()));
+	connect(&_livewire_watcher, SIGNAL(finished()), this, SLOT(_livewireCostReady()));
+	connect(&_refine_watcher, SIGNAL(finished()), this, SLOT(_boxRefinementReady()));
+	connect(&_propagation_watcher, SIGNAL(finished()), this, SLOT(_propagationReady()));
+	_frame_timer.setSingleShot(true);
+	_frame_timer.setTimerType(Qt::PreciseTimer);
+	connect(&_frame_timer, SIGNAL(timeout()), this, SLOT(_serveFrame()));
+	_journal_timer.setSingleShot(true);
+	_journal_timer.setInterval(1000);
+	connect(&_journal_timer, SIGNAL(timeout()), this, SLOT(_flushJournal()));
 }
 
 ImageCanvas::~ImageCanvas() {
+    // _boxRefinementReady won't be called anymore
+    if (_refine_pending)
+        QApplication::restoreOverrideCursor();
     _scroll_parent->deleteLater();
 }
 
@@ -49,37 +71,75 @@ void ImageCanvas::_initPixmap() {
 void ImageCanvas::loadImage(const QString &filename) {
 	if (!_image.isNull() )
 		saveMask();
+	_journal.close();
+	PAT_TRACE_SCOPE("loadImage");
 
 	_img_file = filename;
 	QFileInfo file(_img_file);
 	if (!file.exists()) return;
 
-	_image = mat2QImage(cv::imread(_img_file.toStdString()));
-    _orig_image = _image.copy();
+	std::shared_ptr<ImageSource> source = openImageSource(_img_file);
+	_source.reset();
+	if (source->isTiled() && qint64(source->size().width) * source->size().height > LARGE_IMAGE_PIXELS) {
+		_source = source;
+		_tiled_mask = TiledMask(TiledMask::tileDir(_img_file));
+		_window_index = 0;
+		_window = cv::Rect(0, 0, std::min(WINDOW_SIZE, source->size().width), std::min(WINDOW_SIZE, source->size().height));
+		_image = mat2QImage(_source->read(_window));
+	} else {
+		_image = mat2QImage(source->read(cv::Rect(cv::Point(), source->size())));
+	}
 	
 	_mask_file = file.dir().absolutePath()+ "/" + file.baseName() + "_mask.png";
 	_watershed_file = file.dir().absolutePath()+ "/" + file.baseName() + "_watershed_mask.png";
     _annotation_file = file.dir().absolutePath()+ "/xml/" + file.baseName() + ".xml";
     
 	_watershed = ImageMask(_image.size());
-	_undo_list.clear();
-	_undo_index = 0;
-	if (QFile(_mask_file).exists()) {
+	_polygons.clear();
+	_open_polygon = AnnotationPolygon();
+	_disagreement = QImage();
+	_instances = loadInstanceIds(instanceFile(_img_file));
+	_instance_edges = QImage();
+	if (_windowed()) {
+		// boxes and polygons are not supported in window mode, their xml is left untouched
+		box_list.clear();
+		_loadWindow();
+	} else if (QFile(_mask_file).exists()) {
 		_mask = ImageMask(_mask_file,_ui->id_labels);
         //_ui->runWatershed(this);// button_watershed->released());
 		_ui->checkbox_manuel_mask->setChecked(true);
-		_undo_list.push_back(_mask);
-		_undo_index++;
+		_resetUndo();
 	} else {
 		clearMask();
 	}
-    parseXML(_annotation_file);
-	_ui->undo_action->setEnabled(false);
-	_ui->redo_action->setEnabled(false);
+	if (!_windowed()) {
+		// an xml, even without boxes, takes precedence over the COCO index
+		if (QFile::exists(_annotation_file))
+			parseXML(_annotation_file);
+		else
+			_ui->cocoBoxes(_img_file, box_list);
+	}
+	_initPolygonUnders();
+	if (!_windowed())
+		_openJournal();
     
 	setPixmap(QPixmap::fromImage(_image));
 	resize(_scale *_image.size());
-    redrawBoundingBox();
+
+	_superpixels = Superpixels();
+	_superpixel_edges = QImage();
+	_superpixel_file.clear();
+	_requestSuperpixels();
+	_propagation_file.clear();
+	_requestPropagation();
+	_livewire_cost = cv::Mat();
+	_livewire_file.clear();
+	_livewire_search.clear();
+	_livewire_contour.clear();
+	_livewire_tail.clear();
+	_requestLivewireCost();
+	if (_instanceMode())
+		_updateInstances();
 }
 
 void ImageCanvas::parseXML(QString file_name){
@@ -87,39 +147,58 @@ void ImageCanvas::parseXML(QString file_name){
     QDomDocument document;
     // Open a file for reading
     QFile file(file_name);
+    // no xml yet : the image has no boxes
     if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
-    {
-        std::cout << "cant find file."<<file_name.toStdString()<<std::endl;
         return;
-    }else{
+    else{
         // loading
         if(!document.setContent(&file))
         {
-            std::cout << "Failed to load the file for reading.";
+            qWarning("Couldn't parse %s", qPrintable(file_name));
             return;
         }
         file.close();
     }
     // Getting root element
     QDomElement root = document.firstChildElement();
-    QDomNodeList nodes = root.elementsByTagName("object");
-    for(int i = 0; i < nodes.count(); i++){
-        QDomElement boundbox_node = nodes.at(i).toElement().elementsByTagName("bndbox").at(0).toElement();
-        QString name = boundbox_node.elementsByTagName("name").at(0).firstChild().toText().data();
-        int min_x = boundbox_node.elementsByTagName("xmin").at(0).firstChild().toText().data().toInt();
-        int max_x = boundbox_node.elementsByTagName("xmax").at(0).firstChild().toText().data().toInt();
-        int min_y = boundbox_node.elementsByTagName("ymin").at(0).firstChild().toText().data().toInt();
-        int max_y = boundbox_node.elementsByTagName("ymax").at(0).firstChild().toText().data().toInt();
-        box_list.push_back(BoundingBox(cv::Point(min_x,min_y),cv::Point(max_x, max_y),name.toStdString()));
+    box_list.parseXML(root);
+    QDomNodeList polygon_nodes = root.elementsByTagName("polygon");
+    for(int i = 0; i < polygon_nodes.count(); i++){
+        QDomElement polygon_node = polygon_nodes.at(i).toElement();
+        QString name = polygon_node.elementsByTagName("name").at(0).firstChild().toText().data();
+        AnnotationPolygon polygon(name.toStdString());
+        QDomNodeList pts = polygon_node.elementsByTagName("pt");
+        for(int j = 0; j < pts.count(); j++){
+            int x = pts.at(j).toElement().elementsByTagName("x").at(0).firstChild().toText().data().toInt();
+            int y = pts.at(j).toElement().elementsByTagName("y").at(0).firstChild().toText().data().toInt();
+            polygon.addPoint(cv::Point(x, y));
+        }
+        if(polygon.size() >= 3)
+            _polygons.push_back(polygon);
     }
     return;
 }
 
 void ImageCanvas::saveMask() {
-	if (isFullZero(_mask.id))
+	PAT_TRACE_SCOPE("saveMask");
+	if (_windowed()) {
+		if (!_undo_list.isEmpty())
+			_tiled_mask.write(_window, _mask.id);
+		_markSaved();
 		return;
+	}
+	if (!_mask.hasLabels() && !QFile::exists(_mask_file)) {
+		// no mask file for an image never labeled, its boxes and polygons are still saved
+		if (!box_list.empty() || !_polygons.empty() || QFile::exists(_annotation_file))
+			saveAnnotation();
+		_markSaved();
+		return;
+	}
 
-	_mask.id.save(_mask_file);
+	// a taxonomy with more than 256 labels always gets 16-bit masks
+	saveLabelImage(_mask_file, _mask.id, _ui->id_labels.maxId() > 255);
+	_mask.detachMapping();
+	LabelPlaneCache::store(_mask_file, _mask.id, _mask.color, _ui->paletteHash());
 //	if (!_watershed.id.isNull()) {
 //        QImage watershed = _watershed.id;
 ////         if (!_ui->checkbox_border_ws->isChecked()) {
@@ -131,52 +210,189 @@ void ImageCanvas::saveMask() {
 //		idToColor(watershed, _ui->id_labels).save(color_file);
 //	}
     QString color_file = file.dir().absolutePath() + "/" + file.baseName() + "_color_mask.png";
-    _mask.color.save(color_file);
+    saveColorMask(color_file, _mask.color, _ui->paletteHash());
+    if (_instanceMode() && !_windowed()) {
+        _updateInstances();
+        if (!saveInstanceIds(instanceFile(_img_file), _instances))
+            _ui->statusBar()->showMessage(tr("Instance ids do not fit in 16 bits (label id > 65), %1 not written").arg(instanceFile(_img_file)), 5000);
+    }
     saveAnnotation();
+    QStringList box_names;
+    for (int i = 0; i < box_list.size(); i++)
+        box_names << QString::fromStdString(box_list.name(i));
+    // the label counts are maintained by the mask, no need to scan it again
+    QMap<int, qint64> label_pixels;
+    for (size_t id = 0; id < _mask.label_pixels.size(); id++) {
+        if (_mask.label_pixels[id] > 0)
+            label_pixels[int(id)] = _mask.label_pixels[id];
+    }
+    _ui->updateDatasetIndex(_img_file, DatasetIndex::makeEntry(_img_file, _mask.id, label_pixels, box_names));
+    _markSaved();
+}
+
+void ImageCanvas::_markSaved() {
+    _journal.discard();
     _undo_list.clear();
     _undo_index = 0;
+    _ui->undo_action->setEnabled(false);
+    _ui->redo_action->setEnabled(false);
     _ui->setStarAtNameOfTab(false);
 }
 
+// Mask of the current window, read from the mask tiles.
+void ImageCanvas::_loadWindow() {
+	_mask = ImageMask(_image.size());
+	_mask.setRegion(cv::Rect(0, 0, _window.width, _window.height), _tiled_mask.read(_window));
+	_mask.updateColor(_ui->id_labels);
+	_resetUndo();
+	cv::Size size = _source->size();
+	_ui->statusBar()->showMessage(tr("Region %1,%2 %3x%4 of %5x%6 (Alt+Left/Right to move)")
+		.arg(_window.x).arg(_window.y).arg(_window.width).arg(_window.height)
+		.arg(size.width).arg(size.height));
+}
+
+// Windows are visited row by row, overlapping by a quarter so that objects
+// on a border can be finished in the next window.
+void ImageCanvas::_moveWindow(int step) {
+	if (!_windowed())
+		return;
+	cv::Size size = _source->size();
+	const int stride_x = WINDOW_SIZE * 3 / 4;
+	const int stride_y = WINDOW_SIZE * 3 / 4;
+	const int columns = std::max(1, (size.width - _window.width + stride_x - 1) / stride_x + 1);
+	const int rows = std::max(1, (size.height - _window.height + stride_y - 1) / stride_y + 1);
+	int index = _window_index + step;
+	if (index < 0 || index >= columns * rows)
+		return;
+	if (isNotSaved()) {
+		QMessageBox::StandardButton reply = QMessageBox::question(this, tr("Current region is not saved"),
+			tr("You will leave the current region, Would you like to save it before ?"), QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel);
+		if (reply == QMessageBox::Cancel)
+			return;
+		if (reply == QMessageBox::Yes)
+			saveMask();
+	}
+	_window_index = index;
+	_window.x = std::min((index % columns) * stride_x, size.width - _window.width);
+	_window.y = std::min((index / columns) * stride_y, size.height - _window.height);
+	_image = mat2QImage(_source->read(_window));
+	_watershed = ImageMask(_image.size());
+	_disagreement = QImage();
+	_loadWindow();
+	setPixmap(QPixmap::fromImage(_image));
+	resize(_scale *_image.size());
+	update();
+}
+
+void ImageCanvas::nextWindow() {
+	_moveWindow(1);
+}
+
+void ImageCanvas::previousWindow() {
+	_moveWindow(-1);
+}
+
 void ImageCanvas::saveAnnotation(){
     QFileInfo file(_img_file);
-    //create text
-    std::string text ="<annotation>\n\
-	<folder>0</folder>\n\
-	<filename>"+ file.baseName().toStdString()+"</filename>\n\
-	<path>"+file.dir().absolutePath().toStdString() + "/" + file.baseName().toStdString()+"</path>\n\
-	<source>\n\
-	\t<database>Unknown</database>\n\
-	</source>\n\
-	<size>\n\
-	\t<width>"+std::to_string(width())+"</width>\n\
-	\t<height>"+std::to_string(height())+"</height>\n\
-	\t<depth>3</depth>\n\
-	</size>\n\
-    <segmented>0</segmented>\n";
-    for(BoundingBox b:box_list){
-        text+=b.toXML();
+    //create text, with the size of the image rather than of the zoomed view
+    std::string text = vocHeader(_img_file, _image.width(), _image.height());
+    box_list.appendXML(text);
+    for(const AnnotationPolygon &polygon : _polygons){
+        text+=polygon.toXML();
     }
     text = text+ "\n</annotation>";
     std::string file_name = file.dir().absolutePath().toStdString() + "/xml/"+file.baseName().toStdString()+".xml";
     std::ofstream out(file_name);
     out << text;
     out.close();
-    std::cout<<"saving xml"<<file_name<<std::endl;
 }
 
 void ImageCanvas::scaleChanged(double scale) {
 	_scale  = scale ;
 	resize(_scale * _image.size());
-	repaint();
+	_scheduleFrame();
 }
 
 void ImageCanvas::alphaChanged(double alpha) {
 	_alpha = alpha;
-	repaint();
+	_scheduleFrame();
+}
+
+// Input only asks for a frame : whatever the rate of the events, the canvas
+// is composited at most once per display refresh, with the latest state.
+// Brush samples are all kept and rasterized when the frame is painted.
+void ImageCanvas::_scheduleFrame() {
+	_frame_requests++;
+	if (_frame_timer.isActive())
+		return;
+	// the canvas is a child widget : only its top level window has a handle
+	QWindow * handle = window()->windowHandle();
+	QScreen * screen = handle != NULL ? handle->screen() : QGuiApplication::primaryScreen();
+	qreal rate = screen != NULL ? screen->refreshRate() : 60.;
+	int period = qBound(4, qRound(1000. / std::max<qreal>(rate, 1.)), 50);
+	qint64 elapsed = _last_frame.isValid() ? _last_frame.elapsed() : period;
+	_frame_timer.start(int(std::max<qint64>(0, period - elapsed)));
+}
+
+void ImageCanvas::_serveFrame() {
+	_frames_served++;
+	_frames_coalesced += std::max(0, _frame_requests - 1);
+	PAT_TRACE_COUNTER("frames_served", _frames_served);
+	PAT_TRACE_COUNTER("frames_coalesced", _frames_coalesced);
+	_frame_requests = 0;
+	_last_frame.start();
+	// the search runs once per frame, before the paint is queued
+	_flushLivewire();
+	update();
+}
+
+// Brings the RGB32 display copy of a mask up to date, converting only the
+// part of the colors that changed since the last paint.
+static void syncRender(ImageMask &mask, QImage &render) {
+	if (render.size() != mask.color.size() || render.format() != QImage::Format_RGB32) {
+		render = mask.color.convertToFormat(QImage::Format_RGB32);
+	} else if (mask.color_dirty.area() > 0) {
+		PAT_TRACE_SCOPE("syncRender");
+		const cv::Rect r = mask.color_dirty & cv::Rect(0, 0, render.width(), render.height());
+		for (int y = r.y; y < r.y + r.height; y++) {
+			const uchar * src = mask.color.constScanLine(y) + 3 * r.x;
+			QRgb * dst = reinterpret_cast<QRgb*>(render.scanLine(y)) + r.x;
+			for (int x = 0; x < r.width; x++)
+				dst[x] = qRgb(src[3 * x], src[3 * x + 1], src[3 * x + 2]);
+		}
+	}
+	mask.color_dirty = cv::Rect();
+}
+
+// Boxes are drawn over the image at paint time, the selected one in red.
+void ImageCanvas::_drawBoxes(QPainter &painter) {
+	const bool marking = _operation_mode == BOX_SELECTED || _operation_mode == BOX_MOVING || _operation_mode == BOX_RESIZING;
+	const int marked = marking ? getSelectedBox() : -1;
+	painter.save();
+	painter.setOpacity(1.);
+	painter.setBrush(Qt::NoBrush);
+	for (int i = 0; i < box_list.size(); i++) {
+		cv::Point a = box_list.minPoint(i);
+		cv::Point b = box_list.maxPoint(i);
+		painter.setPen(QPen(i == marked ? Qt::red : Qt::blue, 2));
+		painter.drawRect(QRect(QPoint(a.x, a.y), QPoint(b.x, b.y)));
+	}
+	if (_operation_mode == BOX_CREATING && _button_is_pressed && start_x > -1 && start_y > -1) {
+		painter.setPen(QPen(Qt::blue, 2));
+		painter.drawRect(QRect(QPoint(start_x, start_y), QPoint(_box_preview_end.x, _box_preview_end.y)).normalized());
+	}
+	painter.restore();
 }
 
 void ImageCanvas::paintEvent(QPaintEvent *event) {
+#ifdef PIXEL_ANNOTATION_TRACING
+	qint64 frame_start = Trace::instance().now();
+	if (_frame_clock.isValid())
+		PAT_TRACE_COUNTER("frame_interval_us", _frame_clock.nsecsElapsed() / 1000);
+	_frame_clock.start();
+#endif
+	PAT_TRACE_SCOPE("paintEvent");
+	_flushStroke();
 	QPainter painter(this);
 	painter.setRenderHint(QPainter::Antialiasing, false);
 	QRect rect = painter.viewport();
@@ -186,15 +402,30 @@ void ImageCanvas::paintEvent(QPaintEvent *event) {
 		painter.setViewport(rect.x(), rect.y(), size.width(), size.height());
 		painter.setWindow(pixmap()->rect());
 	}
-	painter.drawImage(QPoint(0, 0), _image);
+	// the label's pixmap is _image in the display format
+	painter.drawPixmap(QPoint(0, 0), *pixmap());
 	painter.setOpacity(_alpha);
 
-	if (!_mask.id.isNull() && _ui->checkbox_manuel_mask->isChecked()) {
-		painter.drawImage(QPoint(0, 0), _mask.color);
+	if (!_mask.isNull() && _ui->checkbox_manuel_mask->isChecked()) {
+		syncRender(_mask, _mask_render);
+		painter.drawImage(QPoint(0, 0), _mask_render);
 	}
 		
-	if (!_watershed.id.isNull() && _ui->checkbox_watershed_mask->isChecked()) {
-		painter.drawImage(QPoint(0, 0), _watershed.color);
+	if (!_watershed.isNull() && _ui->checkbox_watershed_mask->isChecked()) {
+		syncRender(_watershed, _watershed_render);
+		painter.drawImage(QPoint(0, 0), _watershed_render);
+	}
+
+	if (!_disagreement.isNull()) {
+		painter.drawImage(QPoint(0, 0), _disagreement);
+	}
+
+	if (_superpixelMode() && !_superpixel_edges.isNull()) {
+		painter.drawImage(QPoint(0, 0), _superpixel_edges);
+	}
+
+	if (_instanceMode() && !_instance_edges.isNull()) {
+		painter.drawImage(QPoint(0, 0), _instance_edges);
 	}
 
 	if (_mouse_pos.x() > 10 && _mouse_pos.y() > 10 && 
@@ -203,10 +434,49 @@ void ImageCanvas::paintEvent(QPaintEvent *event) {
 		painter.setBrush(QBrush(_color.color));
 		painter.setPen(QPen(QBrush(_color.color), 1.0));
 		painter.drawEllipse(_mouse_pos.x() / _scale - _pen_size / 2, _mouse_pos.y() / _scale - _pen_size / 2, _pen_size, _pen_size);
-		painter.end();
 	}
+	_drawBoxes(painter);
+	_drawPolygons(painter);
+	_drawLivewire(painter);
+	painter.end();
+#ifdef PIXEL_ANNOTATION_TRACING
+	_last_paint_us = Trace::instance().now() - frame_start;
+	if (_ui->perf_overlay_action->isChecked())
+		_drawPerfOverlay();
+#endif
 }
 
+#ifdef PIXEL_ANNOTATION_TRACING
+void ImageCanvas::_drawPerfOverlay() {
+	QStringList lines;
+	qint64 interval = 0;
+	QList<QPair<QString, qint64> > counters = Trace::instance().counters();
+	for (int i = 0; i < counters.size(); i++) {
+		if (counters[i].first == "frame_interval_us")
+			interval = counters[i].second;
+	}
+	lines << QString("paint %1 ms  frame %2 ms").arg(_last_paint_us / 1000., 0, 'f', 2).arg(interval / 1000., 0, 'f', 1);
+	lines << QString("frames %1 served  %2 coalesced").arg(_frames_served).arg(_frames_coalesced);
+	QList<QPair<QString, qint64> > durations = Trace::instance().lastDurations();
+	for (int i = 0; i < durations.size(); i++) {
+		if (durations[i].first != "paintEvent")
+			lines << QString("%1 %2 ms").arg(durations[i].first).arg(durations[i].second / 1000., 0, 'f', 2);
+	}
+
+	QPainter painter(this);
+	QFontMetrics metrics(painter.font());
+	QRect box(visibleRegion().boundingRect().topLeft() + QPoint(4, 4), QSize(0, 0));
+	for (int i = 0; i < lines.size(); i++)
+		box.setWidth(std::max(box.width(), metrics.width(lines[i]) + 8));
+	box.setHeight(lines.size() * metrics.height() + 8);
+	painter.setOpacity(0.75);
+	painter.fillRect(box, Qt::black);
+	painter.setOpacity(1.);
+	painter.setPen(Qt::green);
+	painter.drawText(box.adjusted(4, 4, -4, -4), Qt::AlignLeft | Qt::AlignTop, lines.join("\n"));
+}
+#endif
+
 cv::Point ImageCanvas::getXYonImage(QMouseEvent *e){
     return getXYonImage(e->x(), e->y());
 }
@@ -226,71 +496,42 @@ cv::Point ImageCanvas::getXYonImage(int x_gui, int y_gui){
 
 
 int ImageCanvas::getSelectedBox(){
-    for(int i =0;i<box_list.size();i++){
-        if(box_list[i].is_selected()){
-            return i;
-        }
-    }
-    return -1;
+    return box_list.selected();
 }
 
 //remember e is xy of gui
 //xy should be converted of the image
 
-void ImageCanvas::drawBoundingBox(BoundingBox b){
-    cv::Mat _image_mat = qImage2Mat(_image);
-    b.draw(_image_mat);
-    _image = mat2QImage(_image_mat);
-    update();
-}
-
-void ImageCanvas::drawMarkedBoundingBox(BoundingBox b){
-    cv::Mat _image_mat = qImage2Mat(_image);
-    b.draw_marked(_image_mat);
-    _image = mat2QImage(_image_mat);
-    update();
-}
-
 void ImageCanvas::mousePressEvent(QMouseEvent * e) {
 	setFocus();
     cv::Point p = getXYonImage(e);
-    std::cout<<"clicked"<<p<<" operation:"<<_operation_mode<<" modifiers:"<<e->modifiers()<<std::endl;
 	if (e->button() == Qt::LeftButton) {
 		_button_is_pressed = true;
         if(_operation_mode == BOX_SELECTED){
             int idx = getSelectedBox();
             if(idx == -1){
-                std::cout<<"no box selected"<<std::endl;
                 return;
             }
-            std::cout<<"selected index"<<idx<<std::endl;
-            redrawBoundingBox(idx);
-            _buffer_image = _image.copy();
-            if(box_list[idx].isWithinResizingArea(p)){
-                int corner_idx = box_list[idx].selectPoint(p);
-                cv::Point start_p = box_list[idx].getFourCorners()[corner_idx];
-                std::cout<<"resizing selecting corner"<<start_p<<std::endl;
+            if(box_list.grabCorner(idx, p)){
                 start_x = p.x;
                 start_y = p.y;
                 _operation_mode = BOX_RESIZING;
-                drawMarkedBoundingBox(box_list[idx]);
+                update();
                 return;
-            }else if(box_list[idx].isWithinBoundingBox(p)){
-                std::cout<<"operation moving"<<std::endl;
+            }else if(box_list.contains(idx, p)){
                 start_x = p.x;
                 start_y = p.y;
                 _operation_mode = BOX_MOVING;
-                drawMarkedBoundingBox(box_list[idx]);
+                update();
                 return;
             }else if(e->modifiers() == BBOX_MODIFIER){\
-                box_list[idx].unselect();
-                redrawBoundingBox();
+                box_list.unselect();
                 _operation_mode = BOX_CREATING;
                 _startMarkingBoundingBox(e);
             }else{
                 //unmark
-                box_list[idx].unselect();
-                drawBoundingBox(box_list[idx]);
+                box_list.unselect();
+                update();
                 _operation_mode = BOX_UNSELECTING;
                 return;
             }
@@ -298,13 +539,16 @@ void ImageCanvas::mousePressEvent(QMouseEvent * e) {
             if(FILL_IN_MODIFIER==e->modifiers()){
                 _fill(e);
                 return;
+            }else if (BBOX_MODIFIER==e->modifiers() && _windowed()){
+                _ui->statusBar()->showMessage(tr("Boxes are not available in window mode"), 3000);
+                return;
             }else if (BBOX_MODIFIER==e->modifiers() && _cid != -1){
                 //check if its within range
                 for(int i =0; i< box_list.size();i++){
-                    if(box_list[i].isWithinBoundingBox(getXYonImage(e))){
+                    if(box_list.contains(i, getXYonImage(e))){
                         _operation_mode = BOX_SELECTED;
-                        box_list[i].select();
-                        drawMarkedBoundingBox(box_list[i]);
+                        box_list.select(i);
+                        update();
                         return;
                     }
                 }
@@ -312,8 +556,20 @@ void ImageCanvas::mousePressEvent(QMouseEvent * e) {
                 _operation_mode = BOX_CREATING;
                 _startMarkingBoundingBox(e);
                 return;
+            }else if(_ui->livewire_action->isChecked() && _windowed()){
+                _ui->statusBar()->showMessage(tr("Livewire is not available in window mode"), 3000);
+                return;
+            }else if(_livewireMode()){
+                _livewirePress(e);
+                return;
+            }else if(_ui->polygon_action->isChecked() && _windowed()){
+                _ui->statusBar()->showMessage(tr("Polygons are not available in window mode"), 3000);
+                return;
+            }else if(_polygonMode()){
+                _polygonPress(e);
+                return;
             }else{
-                _drawFillCircle(e);
+                _beginStroke(e);
                 return;
             }
         }
@@ -326,34 +582,32 @@ void ImageCanvas::mouseMoveEvent(QMouseEvent * e) {
 	_mouse_pos.setX(e->x());
 	_mouse_pos.setY(e->y());
     cv::Point cur_pt = getXYonImage(e);
+	if (!_livewire_contour.empty()) {
+		_livewire_cursor = _strokePoint(e);
+		_livewire_moved = true;
+	}
 	if (_button_is_pressed){ 
-        std::cout<<"moved to "<<cur_pt<<std::endl;
         if(_operation_mode == BOX_MOVING){
             int x_diff = cur_pt.x - start_x;
             int y_diff = cur_pt.y - start_y;
-            _image = _buffer_image.copy();
-            box_list[getSelectedBox()].move(x_diff, y_diff);//_drawBoundingBox(e);
+            box_list.move(getSelectedBox(), x_diff, y_diff);
             start_x = cur_pt.x;
             start_y = cur_pt.y;
-            drawMarkedBoundingBox(box_list[getSelectedBox()]);
-            box_list[getSelectedBox()].printBoxParam();
         }else if(_operation_mode == BOX_RESIZING){
             int x_diff = cur_pt.x - start_x;
             int y_diff = cur_pt.y - start_y;
-            _image = _buffer_image.copy();
-            box_list[getSelectedBox()].resize(x_diff, y_diff);
+            box_list.resize(getSelectedBox(), x_diff, y_diff);
             start_x = cur_pt.x;
             start_y = cur_pt.y;
-            //std::cout<<"box resized";
-            //box_list[getSelectedBox()].printBoxParam();
-            drawMarkedBoundingBox(box_list[getSelectedBox()]);
         }else if(_operation_mode == BOX_CREATING){
-            _drawBoundingBox(e);
+            _box_preview_end = cur_pt;
+        }else if(_edit_vertex >= 0){
+            _polygons[_edit_polygon].movePoint(_edit_vertex, _strokePoint(e));
         }else{
-            _drawFillCircle(e);
+            _continueStroke(e);
         }
     }
-	update();
+	_scheduleFrame();
 }
 
 void ImageCanvas::reset(int operation){
@@ -361,66 +615,62 @@ void ImageCanvas::reset(int operation){
     start_y =-1;
     _operation_mode = operation;
     if(operation == DRAW_MODE){
-        for(BoundingBox b: box_list){
-            b.unselect();
-        }
+        box_list.unselect();
     }
-    redrawBoundingBox();
     update();
 }
 
 void ImageCanvas::mouseReleaseEvent(QMouseEvent * e) {
+	if(e->button() == Qt::LeftButton && _polygon_press) {
+		_button_is_pressed = false;
+		_polygon_press = false;
+		if (_edit_vertex >= 0) {
+			_rasterizePolygon(_polygons[_edit_polygon]);
+			_edit_polygon = _edit_vertex = -1;
+			_polygons_changed = true;
+			_pushUndo();
+			update();
+		}
+		return;
+	}
 	if(e->button() == Qt::LeftButton) {
-        std::cout<<"mouse released"<<getXYonImage(e)<<std::endl;
 		_button_is_pressed = false;
+		_endStroke();
+		const bool boxes_changed = _operation_mode == BOX_CREATING || _operation_mode == BOX_MOVING || _operation_mode == BOX_RESIZING;
         if(_operation_mode == DRAW_MODE){
             
         }
         if(_operation_mode == BOX_CREATING && this-> start_x > -1 && this-> start_y > -1){
-                BoundingBox b(cv::Point(start_x, start_y), getXYonImage(e),getObjectString());
-                if(b.getWidth()> 5 && b.getHeight()> 5){
-                    box_list.push_back(b);
-                    std::cout<<"creating bounding box "<< b.getMinMinPoint()<<b.getMaxMaxPoint()<<std::endl;
+                cv::Point end = getXYonImage(e);
+                if(std::abs(end.x - start_x) > 5 && std::abs(end.y - start_y) > 5){
+                    box_list.add(cv::Point(start_x, start_y), end, getObjectString());
                 }
                 reset();
         }
         if(_operation_mode == BOX_MOVING || _operation_mode == BOX_RESIZING){
             reset(BOX_SELECTED);
-            drawMarkedBoundingBox(box_list[getSelectedBox()]);
         }
         if(_operation_mode == BOX_UNSELECTING){
             reset();
             _operation_mode = DRAW_MODE;
         }
-		if (_undo) {
-			QMutableListIterator<ImageMask> it(_undo_list);
-			int i = 0;
-			while (it.hasNext()) {
-				it.next();
-				if (i++ >= _undo_index)
-					it.remove();
-			}
-			_undo = false;
-			_ui->redo_action->setEnabled(false);
-		}
-		_undo_list.push_back(_mask);
-		_undo_index++;
+		_pushUndo();
+		if (boxes_changed)
+			_journalBoxes();
         _ui->setStarAtNameOfTab(true);
-		_ui->undo_action->setEnabled(true);
 	}
 
 	if (e->button() == Qt::RightButton) { // selection of label
-		QColor color = _mask.id.pixel(_mouse_pos / _scale);
-		const LabelInfo * label = _ui->id_labels[color.red()];
-
-		if (!_watershed.id.isNull() && _ui->checkbox_watershed_mask->isChecked()) {
-			QColor color = QColor(_watershed.id.pixel(_mouse_pos / _scale));
-			QMap<int, const LabelInfo*>::const_iterator it = _ui->id_labels.find(color.red());
-			if (it != _ui->id_labels.end()) {
-				label = it.value();
+		QPoint p = _mouse_pos / _scale;
+		const LabelInfo * label = _ui->id_labels.find(_mask.labelAt(p.x(), p.y()));
+
+		if (!_watershed.isNull() && _ui->checkbox_watershed_mask->isChecked()) {
+			const LabelInfo * watershed_label = _ui->id_labels.find(_watershed.labelAt(p.x(), p.y()));
+			if (watershed_label != NULL) {
+				label = watershed_label;
 			}
 		}
-		if(label->item != NULL)
+		if(label != NULL && label->item != NULL)
 			emit(_ui->list_label->currentItemChanged(label->item, NULL));
 		refresh();
 	}
@@ -432,30 +682,371 @@ void ImageCanvas::mouseReleaseEvent(QMouseEvent * e) {
         int y = p.y;
 
 		_mask.exchangeLabel(x, y, _ui->id_labels, _color);
+		_pushUndo();
 		update();
 	}
 }
 
 
+void ImageCanvas::mouseDoubleClickEvent(QMouseEvent * e) {
+	if (e->button() == Qt::LeftButton && _polygonMode() && _open_polygon.size() > 0) {
+		// the release that follows must not push another undo step
+		_polygon_press = true;
+		_button_is_pressed = true;
+		_closePolygon();
+		return;
+	}
+	if (e->button() == Qt::LeftButton && _livewireMode() && !_livewire_contour.empty()) {
+		_polygon_press = true;
+		_button_is_pressed = true;
+		_closeLivewire();
+		return;
+	}
+	mousePressEvent(e);
+}
+
 void ImageCanvas::setSizePen(int pen_size) {
 	_pen_size = pen_size;
 }
 
 
 
-void ImageCanvas::_drawFillCircle(QMouseEvent * e) {
+cv::Point ImageCanvas::_strokePoint(QMouseEvent * e) {
 	cv::Point p = getXYonImage(e);
-    int x = p.x;
-    int y = p.y;
-    if (_pen_size > 0) {
-		_mask.drawFillCircle(x, y, _pen_size, _color);
+	if (_pen_size > 0)
+		p += cv::Point(_pen_size / 2, _pen_size / 2);
+	return p;
+}
+
+// Mouse samples are only queued here ; they are rasterized once per frame
+// by _flushStroke() as a continuous polyline of the pen size.
+void ImageCanvas::_beginStroke(QMouseEvent * e) {
+	_stroke_samples.clear();
+	if (_superpixelMode() && !_superpixels.empty()) {
+		cv::Point p = _strokePoint(e);
+		_stroke_segments.assign(_superpixels.count(), 0);
+		_paintSegments(p, p);
+		_stroke_anchor = p;
+		_stroke_has_anchor = true;
+		_stroke_active = true;
+		update();
+		return;
+	}
+	_stroke_samples.push_back(_strokePoint(e));
+	_stroke_has_anchor = false;
+	_stroke_active = true;
+	update();
+}
+
+void ImageCanvas::_continueStroke(QMouseEvent * e) {
+	if (!_stroke_active)
+		return;
+	cv::Point p = _strokePoint(e);
+	if (!_stroke_segments.empty()) {
+		_paintSegments(_stroke_anchor, p);
+		_stroke_anchor = p;
+		return;
+	}
+	if (!_stroke_samples.empty() && _stroke_samples.back() == p)
+		return;
+	_stroke_samples.push_back(p);
+}
+
+void ImageCanvas::_flushStroke() {
+	if (_stroke_samples.empty())
+		return;
+	PAT_TRACE_SCOPE("flushStroke");
+	PAT_TRACE_COUNTER("stroke_samples", _stroke_samples.size());
+	if (_stroke_has_anchor)
+		_stroke_samples.insert(_stroke_samples.begin(), _stroke_anchor);
+	_mask.drawStroke(_stroke_samples, _pen_size, _color);
+	_ui->labelCountsChanged();
+	_stroke_anchor = _stroke_samples.back();
+	_stroke_has_anchor = true;
+	_stroke_samples.clear();
+}
+
+void ImageCanvas::_endStroke() {
+	_flushStroke();
+	_stroke_active = false;
+	_stroke_has_anchor = false;
+	_stroke_segments.clear();
+}
+
+bool ImageCanvas::_superpixelMode() const {
+	return _ui->superpixel_action->isChecked();
+}
+
+// The superpixels are only computed (or read from the cache) while the mode
+// is enabled, in a worker thread so loading an image stays instantaneous.
+void ImageCanvas::_requestSuperpixels() {
+	if (_windowed() || !_superpixelMode() || _image.isNull() || _superpixel_file == _img_file)
+		return;
+	_superpixel_file = _img_file;
+	// qImage2Mat returns a deep copy owned by the worker
+	_superpixel_watcher.setFuture(QtConcurrent::run(loadOrComputeSuperpixels, _img_file, qImage2Mat(_image)));
+}
+
+void ImageCanvas::_superpixelsReady() {
+	if (_superpixel_file != _img_file)
+		return;
+	Superpixels superpixels = _superpixel_watcher.result();
+	if (superpixels.labels.size() != _mask.id.size())
+		return;
+	_superpixels = superpixels;
+	_superpixel_edges = _superpixels.boundaries(qRgba(255, 255, 0, 255));
+	update();
+}
+
+// In sequence mode, a frame without mask starts from the mask of the
+// previous frame warped by the optical flow, computed in a worker thread.
+void ImageCanvas::_requestPropagation() {
+	if (!_ui->sequence_action->isChecked() || _windowed() || _image.isNull() || _propagation_file == _img_file)
+		return;
+	if (QFile(_mask_file).exists() || !_undo_list.isEmpty())
+		return;
+	_propagation_file = _img_file;
+	_propagation_watcher.setFuture(QtConcurrent::run(propagateFromPreviousFrame, _img_file));
+}
+
+void ImageCanvas::_propagationReady() {
+	PropagatedMask propagated = _propagation_watcher.result();
+	if (propagated.image_file != _img_file || propagated.id.empty())
+		return;
+	// the annotator started on this frame in the meantime
+	if (propagated.id.size() != _mask.id.size() || !_undo_list.isEmpty())
+		return;
+	_mask.setRegion(cv::Rect(0, 0, _mask.id.cols, _mask.id.rows), propagated.id);
+	_mask.updateColor(_ui->id_labels);
+	_pushUndo();
+	_ui->statusBar()->showMessage(tr("Mask propagated from %1").arg(QFileInfo(propagated.previous_file).fileName()), 3000);
+	update();
+}
+
+bool ImageCanvas::_instanceMode() const {
+	return _ui->instance_action->isChecked();
+}
+
+// Splits the mask into instances, keeping the ids of the previous ones.
+void ImageCanvas::_updateInstances() {
+	if (_mask.id.empty() || _windowed())
+		return;
+	_instances = instanceIds(_mask.id, _instances);
+	_instance_edges = instanceBoundaries(_instances, qRgba(255, 255, 255, 255));
+}
+
+void ImageCanvas::instanceModeChanged(bool enabled) {
+	if (enabled)
+		_updateInstances();
+	update();
+}
+
+// A journal newer than the saved mask holds the edits of a session that
+// ended without saving : they are replayed as one undo step.
+void ImageCanvas::_openJournal() {
+	QString file = journalFile(_img_file);
+	QFileInfo journal(file);
+	QFileInfo mask(_mask_file);
+	bool replay = journal.exists() && (!mask.exists() || journal.lastModified() >= mask.lastModified());
+	if (replay) {
+		PAT_TRACE_SCOPE("replayJournal");
+		cv::Mat id = _mask.id.clone();
+		BoxStore boxes;
+		bool has_boxes = false;
+		std::vector<AnnotationPolygon> polygons;
+		bool has_polygons = false;
+		int records = EditJournal::replay(file, id, &boxes, &has_boxes, &polygons, &has_polygons);
+		cv::Rect changed = diffRect(_mask.id, id);
+		if (changed.area() > 0) {
+			_mask.setRegion(changed, id(changed));
+			_mask.updateColor(_ui->id_labels, changed);
+		}
+		if (has_polygons) {
+			// their label patches are taken from the replayed labels, as when loaded from the xml
+			std::vector<AnnotationPolygon> saved = _committed_polygons;
+			_polygons = polygons;
+			_initPolygonUnders();
+			_committed_polygons = saved;
+			_polygons_changed = true;
+		}
+		_pushUndo();
+		if (has_boxes)
+			box_list = boxes;
+		replay = records > 0;
+		if (replay) {
+			_ui->setStarAtNameOfTab(true);
+			_ui->statusBar()->showMessage(tr("%1 unsaved edits restored").arg(records), 5000);
+		}
+	}
+	_journal.open(file, replay);
+}
+
+void ImageCanvas::_journalPatch(cv::Rect rect, const cv::Mat &labels) {
+	if (!_journal.isOpen())
+		return;
+	_journal.appendPatch(rect, labels);
+	if (!_journal_timer.isActive())
+		_journal_timer.start();
+}
+
+void ImageCanvas::_journalPolygons() {
+	if (!_journal.isOpen())
+		return;
+	_journal.appendPolygons(_polygons);
+	if (!_journal_timer.isActive())
+		_journal_timer.start();
+}
+
+void ImageCanvas::_journalBoxes() {
+	if (!_journal.isOpen())
+		return;
+	_journal.appendBoxes(box_list);
+	if (!_journal_timer.isActive())
+		_journal_timer.start();
+}
+
+// About once a second ; a write still running is caught up at the next tick.
+void ImageCanvas::_flushJournal() {
+	_journal.flush();
+	if (_journal.hasPending())
+		_journal_timer.start();
+}
+
+// the cost map is not computed for windows
+bool ImageCanvas::_livewireMode() const {
+	return _ui->livewire_action->isChecked() && !_windowed();
+}
+
+void ImageCanvas::livewireModeChanged(bool enabled) {
+	if (enabled) {
+		_requestLivewireCost();
 	} else {
-		_mask.drawPixel(x, y, _color);
-	} 
+		_livewire_contour.clear();
+		_livewire_tail.clear();
+	}
+	update();
+}
+
+// The edge cost map is computed (or read from the cache) once per image,
+// in a worker thread, while the mode is enabled.
+void ImageCanvas::_requestLivewireCost() {
+	if (_windowed() || !_livewireMode() || _image.isNull() || _livewire_file == _img_file)
+		return;
+	_livewire_file = _img_file;
+	_livewire_watcher.setFuture(QtConcurrent::run(loadOrComputeLivewireCost, _img_file, qImage2Mat(_image)));
+}
+
+void ImageCanvas::_livewireCostReady() {
+	if (_livewire_file != _img_file)
+		return;
+	cv::Mat cost = _livewire_watcher.result();
+	if (cost.size() != _mask.id.size())
+		return;
+	_livewire_cost = cost;
+}
+
+// Each click anchors the path followed so far ; clicking the first anchor
+// (or double clicking) closes the boundary and fills it.
+void ImageCanvas::_livewirePress(QMouseEvent * e) {
+	_polygon_press = true;
+	if (_livewire_cost.empty()) {
+		_ui->statusBar()->showMessage(tr("The edge map of the image is being computed"), 2000);
+		return;
+	}
+	cv::Point p = _strokePoint(e);
+	if (_livewire_contour.empty()) {
+		if (_ui->id_labels.find(_cid) == NULL)
+			return;
+		_livewire_search.reset(_livewire_cost, p);
+		_livewire_contour.push_back(_livewire_search.anchor());
+		_livewire_tail.clear();
+		update();
+		return;
+	}
+	const cv::Point start = _livewire_contour.front();
+	const int radius = _polygonVertexRadius();
+	if (_livewire_contour.size() > 2 && std::abs(p.x - start.x) <= radius && std::abs(p.y - start.y) <= radius) {
+		_closeLivewire();
+		return;
+	}
+	std::vector<cv::Point> path = _livewire_search.pathTo(p);
+	if (path.size() > 1)
+		_livewire_contour.insert(_livewire_contour.end(), path.begin() + 1, path.end());
+	_livewire_search.reset(_livewire_cost, _livewire_contour.back());
+	_livewire_tail.clear();
+	update();
+}
+
+void ImageCanvas::_closeLivewire() {
+	const LabelInfo * label = _ui->id_labels.find(_cid);
+	if (_livewire_contour.size() > 2 && label != NULL) {
+		PAT_TRACE_SCOPE("closeLivewire");
+		std::vector<cv::Point> closing = _livewire_search.pathTo(_livewire_contour.front());
+		if (closing.size() > 2)
+			_livewire_contour.insert(_livewire_contour.end(), closing.begin() + 1, closing.end() - 1);
+		ColorMask cm;
+		cm.id = label->id;
+		cm.color = label->color;
+		_mask.fillPolygon(_livewire_contour, cm);
+		_pushUndo();
+	}
+	_livewire_contour.clear();
+	_livewire_tail.clear();
+	update();
+}
+
+void ImageCanvas::_flushLivewire() {
+	if (!_livewire_moved)
+		return;
+	_livewire_moved = false;
+	if (_livewire_contour.empty() || _livewire_search.empty())
+		return;
+	PAT_TRACE_SCOPE("livewireSearch");
+	_livewire_tail = _livewire_search.pathTo(_livewire_cursor);
+}
+
+void ImageCanvas::_drawLivewire(QPainter &painter) {
+	if (_livewire_contour.empty())
+		return;
+	painter.setOpacity(1.);
+	QPen pen(_color.color, 2);
+	pen.setCosmetic(true);
+	painter.setPen(pen);
+	QPolygon points;
+	for (cv::Point p : _livewire_contour)
+		points << QPoint(p.x, p.y);
+	for (cv::Point p : _livewire_tail)
+		points << QPoint(p.x, p.y);
+	painter.drawPolyline(points);
+}
+
+void ImageCanvas::sequenceModeChanged(bool enabled) {
+	if (enabled)
+		_requestPropagation();
+}
+
+void ImageCanvas::superpixelModeChanged(bool enabled) {
+	if (enabled)
+		_requestSuperpixels();
 	update();
 }
 
+// Paints every superpixel crossed by the segment [from, to] once per drag,
+// so the cost of a stroke is the size of the superpixels it touches.
+void ImageCanvas::_paintSegments(cv::Point from, cv::Point to) {
+	PAT_TRACE_SCOPE("paintSegments");
+	cv::LineIterator it(_superpixels.labels, from, to, 8);
+	for (int i = 0; i < it.count; i++, ++it) {
+		int segment = _superpixels.at(it.pos().x, it.pos().y);
+		if (segment < 0 || segment >= int(_stroke_segments.size()) || _stroke_segments[segment])
+			continue;
+		_stroke_segments[segment] = 1;
+		_mask.fillSegment(_superpixels, segment, _color);
+	}
+}
+
 void ImageCanvas::_fill(QMouseEvent *e){
+    PAT_TRACE_SCOPE("fill");
     cv::Point p = getXYonImage(e);
     int x = p.x;
     int y = p.y;
@@ -466,36 +1057,16 @@ void ImageCanvas::_startMarkingBoundingBox(QMouseEvent *e){
     cv::Point p = getXYonImage(e);
     this->start_x = p.x;
     this->start_y = p.y; 
-    //store display to buffer
-    _buffer_image = _image.copy();    
-}
-
-void ImageCanvas::_drawBoundingBox(QMouseEvent *e){
-    //reset buffer to display on move
-    _image = _buffer_image.copy();
-    cv::Mat _image_mat = qImage2Mat(_image);
-    rectangle(_image_mat,cv::Point(start_x,start_y),getXYonImage(e),cv::Scalar(255,0,0),2);
-    _image = mat2QImage(_image_mat);
-}
-
-//from scratch
-void ImageCanvas::redrawBoundingBox(int except_index){
-    _image = _orig_image.copy();
-    cv::Mat _image_mat = qImage2Mat(_image);
-    for(int i =0; i < this->box_list.size(); i++){
-        if(i == except_index){
-            continue;
-        }
-        box_list[i].draw(_image_mat);//
-    }
-    _image = mat2QImage(_image_mat);
+    _box_preview_end = p;
 }
 
 void ImageCanvas::clearMask() {
+	_polygons.clear();
+	_open_polygon = AnnotationPolygon();
 	_mask = ImageMask(_image.size());
 	_watershed = ImageMask(_image.size());
-	_undo_list.clear();
-	_undo_index = 0;
+	_resetUndo();
+	_journalPatch(cv::Rect(0, 0, _mask.id.cols, _mask.id.rows), _mask.id);
 	repaint();
 	
 }
@@ -508,7 +1079,7 @@ void ImageCanvas::wheelEvent(QWheelEvent * event) {
 		_ui->spinbox_pen_size->setValue(value);
 		emit(_ui->spinbox_pen_size->valueChanged(value));
 		setSizePen(value);
-		repaint();
+		_scheduleFrame();
 	} else if (Qt::ControlModifier == event->modifiers()) {
 		_scroll_parent->verticalScrollBar()->setEnabled(false);
 		double value = _ui->spinbox_scale->value() + delta * _ui->spinbox_scale->singleStep();
@@ -517,7 +1088,6 @@ void ImageCanvas::wheelEvent(QWheelEvent * event) {
 
 		_ui->spinbox_scale->setValue(value);
 		scaleChanged(value);
-		repaint();
 	} else {
         _scroll_parent->verticalScrollBar()->setEnabled(true);
 	}
@@ -526,6 +1096,23 @@ void ImageCanvas::wheelEvent(QWheelEvent * event) {
 void ImageCanvas::keyPressEvent(QKeyEvent * event) {
 	if (event->key() == Qt::Key_Space) {
 		//emit(_ui->button_watershed->released());
+	}else if(_livewireMode() && (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter)){
+		_closeLivewire();
+	}else if(_livewireMode() && event->key() == Qt::Key_Escape){
+		_livewire_contour.clear();
+		_livewire_tail.clear();
+		update();
+	}else if(_polygonMode() && (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter)){
+		_closePolygon();
+	}else if(_polygonMode() && event->key() == Qt::Key_Escape){
+		_open_polygon = AnnotationPolygon();
+		update();
+	}else if(_polygonMode() && event->key() == Qt::Key_Backspace){
+		_open_polygon.removeLastPoint();
+		update();
+	}else if(_polygonMode() && event->key() == Qt::Key_Delete){
+		QPoint p = _mouse_pos / _scale;
+		_deletePolygonAt(cv::Point(p.x(), p.y()));
 	}else if(event->key() == Qt::Key_Delete){
         if(_operation_mode == BOX_SELECTED){
             _operation_mode = DRAW_MODE;
@@ -533,17 +1120,18 @@ void ImageCanvas::keyPressEvent(QKeyEvent * event) {
             if(i== -1){
                 return;
             }
-            std::cout<<"box "<<box_list[i].getId()<<std::endl;
-            box_list.erase (box_list.begin()+i);
-            redrawBoundingBox();
+            box_list.erase(i);
+            _journalBoxes();
             update(); 
         }
     }
 }
 
-void ImageCanvas::setWatershedMask(QImage watershed) {
+void ImageCanvas::setWatershedMask(const cv::Mat &watershed) {
 	_watershed.id = watershed;
-	idToColor(_watershed.id, _ui->id_labels, &_watershed.color);
+	_watershed.color = idToColor(_watershed.id, _ui->id_labels);
+	_watershed.touch(cv::Rect(0, 0, watershed.cols, watershed.rows));
+	_watershed.recount();
 }
 
 void ImageCanvas::setMask(const ImageMask & mask) {
@@ -552,16 +1140,82 @@ void ImageCanvas::setMask(const ImageMask & mask) {
 
 void ImageCanvas::setActionMask(const ImageMask & mask) {
     setMask(mask);
-    _undo_list.push_back(_mask);
-    _undo_index++;
-    _ui->setStarAtNameOfTab(true);
-    _ui->undo_action->setEnabled(true);
+    _pushUndo();
+}
+
+// An undo step only keeps the rect where the label plane differs from the
+// last committed one, before and after. The color plane is derived from
+// the ids, so it is not stored.
+void ImageCanvas::_pushUndo() {
+	PAT_TRACE_SCOPE("undoPush");
+	if (_committed.size() != _mask.id.size()) {
+		_resetUndo();
+		return;
+	}
+	cv::Rect rect = diffRect(_committed, _mask.id);
+	if (rect.area() == 0 && !_polygons_changed)
+		return;
+	MaskPatch patch;
+	patch.rect = rect;
+	if (rect.area() > 0) {
+		patch.before = _committed(rect).clone();
+		patch.after = _mask.id(rect).clone();
+		patch.after.copyTo(_committed(rect));
+		_journalPatch(rect, patch.after);
+	}
+	if (_polygons_changed) {
+		patch.polygons = true;
+		patch.polygons_before = _committed_polygons;
+		patch.polygons_after = _polygons;
+		_committed_polygons = _polygons;
+		_polygons_changed = false;
+		_journalPolygons();
+	}
+	while (_undo_list.size() > _undo_index)
+		_undo_list.removeLast();
+	_undo_list.push_back(patch);
+	_undo_index++;
+	PAT_TRACE_COUNTER("undo_list", _undo_list.size());
+	_ui->setStarAtNameOfTab(true);
+	_ui->undo_action->setEnabled(true);
+	_ui->redo_action->setEnabled(false);
+	_ui->labelCountsChanged();
+}
+
+void ImageCanvas::_resetUndo() {
+	_undo_list.clear();
+	_undo_index = 0;
+	_committed = _mask.id.clone();
+	_committed_polygons = _polygons;
+	_polygons_changed = false;
+	_ui->undo_action->setEnabled(false);
+	_ui->redo_action->setEnabled(false);
+	_ui->labelCountsChanged();
+}
+
+void ImageCanvas::_applyPatch(const MaskPatch &patch, const cv::Mat &plane) {
+	if (patch.rect.area() > 0) {
+		_mask.setRegion(patch.rect, plane);
+		plane.copyTo(_committed(patch.rect));
+		_journalPatch(patch.rect, plane);
+		_mask.updateColor(_ui->id_labels, patch.rect);
+	}
+	_ui->labelCountsChanged();
+}
+
+void ImageCanvas::_applyPolygons(const std::vector<AnnotationPolygon> &polygons) {
+	_polygons = polygons;
+	_committed_polygons = polygons;
+	_open_polygon = AnnotationPolygon();
+	_edit_polygon = _edit_vertex = -1;
+	_journalPolygons();
 }
 
 void ImageCanvas::setId(int id) {
-	_color.id = QColor(id, id, id);
+	_color.id = id;
     _cid = id;
-	_color.color = _ui->id_labels[id]->color;
+	const LabelInfo * label = _ui->id_labels.find(id);
+	_color.color = label != NULL ? label->color : QColor(255, 255, 255);
 }
 
 void ImageCanvas::refresh() {
@@ -573,38 +1227,325 @@ void ImageCanvas::refresh() {
 
 
 void ImageCanvas::undo() {
-	_undo = true;
-	_undo_index--;
-	if (_undo_index == 1) {
-		_mask = _undo_list.at(_undo_index - 1);
-		_ui->undo_action->setEnabled(false);
-		refresh();
-	} else if (_undo_index > 1) {
-		_mask = _undo_list.at(_undo_index - 1);
-		refresh();
-	} else {
-		_undo_index = 0;
-		_ui->undo_action->setEnabled(false);
-	}
+	if (_undo_index <= 0 || _undo_index > _undo_list.size())
+		return;
+	const MaskPatch & patch = _undo_list.at(--_undo_index);
+	_applyPatch(patch, patch.before);
+	if (patch.polygons)
+		_applyPolygons(patch.polygons_before);
+	_ui->undo_action->setEnabled(_undo_index > 0);
 	_ui->redo_action->setEnabled(true);
+	refresh();
 }
 
 void ImageCanvas::redo() {
-	_undo_index++;
-	if (_undo_index < _undo_list.size()) {
-		_mask = _undo_list.at(_undo_index - 1);
-		refresh();
-	}  else if (_undo_index == _undo_list.size()) {
-		_mask = _undo_list.at(_undo_index - 1);
-		_ui->redo_action->setEnabled(false);
-		refresh();
+	if (_undo_index < 0 || _undo_index >= _undo_list.size())
+		return;
+	const MaskPatch & patch = _undo_list.at(_undo_index++);
+	_applyPatch(patch, patch.after);
+	if (patch.polygons)
+		_applyPolygons(patch.polygons_after);
+	_ui->undo_action->setEnabled(true);
+	_ui->redo_action->setEnabled(_undo_index < _undo_list.size());
+	refresh();
+}
+
+void ImageCanvas::refineSelectedBox() {
+	int idx = getSelectedBox();
+	if (idx == -1)
+		return;
+	_refineBoxes(std::vector<int>(1, idx));
+}
+
+void ImageCanvas::refineAllBoxes() {
+	std::vector<int> boxes(box_list.size());
+	for (int i = 0; i < box_list.size(); i++)
+		boxes[i] = i;
+	_refineBoxes(boxes);
+}
+
+// One GrabCut per box, spread over the thread pool ; the results are
+// written into the mask together, as a single undo step.
+void ImageCanvas::_refineBoxes(const std::vector<int> &boxes) {
+	if (_refine_watcher.isRunning() || _mask.isNull() || boxes.empty())
+		return;
+	cv::Mat bgr = qImage2Mat(_image);
+	QList<BoxRefineJob> jobs;
+	for (int i : boxes) {
+		const LabelInfo * label = _ui->id_labels.find(QString::fromStdString(box_list.name(i)));
+		if (label == NULL)
+			continue;
+		jobs.push_back(makeBoxRefineJob(bgr, _mask.id, box_list.rect(i), label->id));
+	}
+	if (jobs.empty())
+		return;
+	_refine_file = _img_file;
+	_refine_window = _window;
+	_refine_pending = true;
+	QApplication::setOverrideCursor(Qt::BusyCursor);
+	_refine_watcher.setFuture(QtConcurrent::mapped(jobs, refineBox));
+}
+
+void ImageCanvas::_boxRefinementReady() {
+	QApplication::restoreOverrideCursor();
+	_refine_pending = false;
+	if (_refine_file != _img_file || _refine_window != _window)
+		return;
+	PAT_TRACE_SCOPE("applyBoxRefinement");
+	QList<BoxRefineResult> results = _refine_watcher.future().results();
+	bool changed = false;
+	for (int i = 0; i < results.size(); i++) {
+		const LabelInfo * label = _ui->id_labels.find(results[i].label_id);
+		const cv::Rect roi = results[i].roi;
+		if (label == NULL || results[i].foreground.empty() || (roi & cv::Rect(0, 0, _mask.id.cols, _mask.id.rows)) != roi)
+			continue;
+		// the pixels edited while GrabCut ran keep their new label
+		cv::Mat unchanged = _mask.id(roi) == results[i].labels;
+		cv::Mat foreground = results[i].foreground & unchanged;
+		if (cv::countNonZero(foreground) == 0)
+			continue;
+		ColorMask cm;
+		cm.id = label->id;
+		cm.color = label->color;
+		_mask.fillMask(foreground, roi, cm);
+		changed = true;
+	}
+	if (changed) {
+		_pushUndo();
+		update();
+	}
+}
+
+// polygons are saved in the xml, which window mode leaves untouched
+bool ImageCanvas::_polygonMode() const {
+	return _ui->polygon_action->isChecked() && !_windowed();
+}
+
+void ImageCanvas::polygonModeChanged(bool enabled) {
+	if (!enabled)
+		_open_polygon = AnnotationPolygon();
+	update();
+}
+
+// 6 screen pixels whatever the zoom
+int ImageCanvas::_polygonVertexRadius() const {
+	return std::max(1, int(6 / _scale));
+}
+
+// Clicking adds a vertex, clicking the first one closes the polygon, and
+// out of a polygon in progress, dragging a vertex edits its polygon.
+void ImageCanvas::_polygonPress(QMouseEvent * e) {
+	cv::Point p = _strokePoint(e);
+	int radius = _polygonVertexRadius();
+	_polygon_press = true;
+	if (_open_polygon.size() == 0) {
+		for (int i = int(_polygons.size()) - 1; i >= 0; i--) {
+			int vertex = _polygons[i].vertexAt(p, radius);
+			if (vertex >= 0) {
+				_edit_polygon = i;
+				_edit_vertex = vertex;
+				return;
+			}
+		}
+		if (_ui->id_labels.find(_cid) == NULL)
+			return;
+		_open_polygon = AnnotationPolygon(getObjectString());
+	} else if (_open_polygon.size() >= 3 && _open_polygon.vertexAt(p, radius) == 0) {
+		_closePolygon();
+		return;
+	}
+	_open_polygon.addPoint(p);
+	update();
+}
+
+void ImageCanvas::_closePolygon() {
+	if (_open_polygon.size() < 3)
+		return;
+	_rasterizePolygon(_open_polygon);
+	_polygons.push_back(_open_polygon);
+	_open_polygon = AnnotationPolygon();
+	_polygons_changed = true;
+	_pushUndo();
+	update();
+}
+
+void ImageCanvas::_deletePolygonAt(cv::Point p) {
+	for (int i = int(_polygons.size()) - 1; i >= 0; i--) {
+		if (_polygons[i].vertexAt(p, _polygonVertexRadius()) < 0)
+			continue;
+		cv::Rect dirty = _unrasterizePolygon(_polygons[i]);
+		if (dirty.area() > 0)
+			_mask.updateColor(_ui->id_labels, dirty);
+		_polygons.erase(_polygons.begin() + i);
+		_polygons_changed = true;
+		_pushUndo();
+		update();
+		return;
+	}
+}
+
+// Puts back the labels the polygon covered, on the pixels it was rasterized
+// on that still hold its label : later edits in its bounding rect are kept.
+// Returns the rect to recolor.
+cv::Rect ImageCanvas::_unrasterizePolygon(const AnnotationPolygon &polygon) {
+	const LabelInfo * label = _ui->id_labels.find(QString::fromStdString(polygon.getName()));
+	if (label == NULL || polygon.under.empty() || polygon.inside.empty())
+		return cv::Rect();
+	cv::Mat labels = _mask.id(polygon.under_rect).clone();
+	polygon.under.copyTo(labels, polygon.inside & (labels == label->id));
+	_mask.setRegion(polygon.under_rect, labels);
+	return polygon.under_rect;
+}
+
+// Puts back the labels the polygon covered, then rasterizes it again : only
+// the old and new bounding rects of the polygon are touched.
+void ImageCanvas::_rasterizePolygon(AnnotationPolygon &polygon) {
+	PAT_TRACE_SCOPE("rasterizePolygon");
+	const LabelInfo * label = _ui->id_labels.find(QString::fromStdString(polygon.getName()));
+	if (label == NULL)
+		return;
+	cv::Rect dirty = _unrasterizePolygon(polygon);
+	polygon.under_rect = polygon.boundingRect() & cv::Rect(0, 0, _mask.id.cols, _mask.id.rows);
+	polygon.under = _mask.id(polygon.under_rect).clone();
+	polygon.inside = polygonMask(polygon.getPoints(), polygon.under_rect);
+
+	ColorMask cm;
+	cm.id = label->id;
+	cm.color = label->color;
+	_mask.fillPolygon(polygon.getPoints(), cm);
+	if (dirty.area() > 0)
+		_mask.updateColor(_ui->id_labels, dirty);
+}
+
+// What was under a polygon read from the xml is unknown : assume it was
+// painted on unlabeled pixels.
+void ImageCanvas::_initPolygonUnders() {
+	for (AnnotationPolygon &polygon : _polygons) {
+		polygon.under_rect = polygon.boundingRect() & cv::Rect(0, 0, _mask.id.cols, _mask.id.rows);
+		polygon.under = _mask.id(polygon.under_rect).clone();
+		polygon.inside = cv::Mat();
+		const LabelInfo * label = _ui->id_labels.find(QString::fromStdString(polygon.getName()));
+		if (label == NULL || polygon.under_rect.area() == 0)
+			continue;
+		polygon.inside = polygonMask(polygon.getPoints(), polygon.under_rect);
+		polygon.under.setTo(cv::Scalar(0), polygon.inside & (polygon.under == label->id));
+	}
+	_committed_polygons = _polygons;
+	_polygons_changed = false;
+}
+
+void ImageCanvas::_drawPolygons(QPainter &painter) {
+	if (_polygons.empty() && _open_polygon.size() == 0)
+		return;
+	painter.setOpacity(1.);
+	painter.setBrush(Qt::NoBrush);
+	int radius = _polygonVertexRadius();
+	for (const AnnotationPolygon &polygon : _polygons) {
+		const LabelInfo * label = _ui->id_labels.find(QString::fromStdString(polygon.getName()));
+		QPen pen(label != NULL ? label->color : QColor(255, 255, 255), 2);
+		pen.setCosmetic(true);
+		painter.setPen(pen);
+		QPolygon points;
+		for (cv::Point p : polygon.getPoints())
+			points << QPoint(p.x, p.y);
+		painter.drawPolygon(points);
+		if (_polygonMode()) {
+			for (const QPoint &p : points)
+				painter.drawRect(p.x() - radius / 2, p.y() - radius / 2, radius, radius);
+		}
+	}
+	if (_open_polygon.size() > 0) {
+		QPen pen(_color.color, 2, Qt::DashLine);
+		pen.setCosmetic(true);
+		painter.setPen(pen);
+		QPolygon points;
+		for (cv::Point p : _open_polygon.getPoints())
+			points << QPoint(p.x, p.y);
+		points << _mouse_pos / _scale;
+		painter.drawPolyline(points);
+	}
+}
+
+// Compares the current mask (A) with another annotation of the image (B)
+// and shows where they disagree.
+bool ImageCanvas::compareWith(const QString &mask_file, MaskComparison *comparison) {
+	PAT_TRACE_SCOPE("compareMasks");
+	cv::Mat other = loadLabelImage(mask_file);
+	if (other.empty() || other.size() != _mask.id.size())
+		return false;
+	*comparison = compareMasks(_mask.id, other);
+	// converted once rather than at each paint
+	_disagreement = comparison->disagreement.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	update();
+	return true;
+}
+
+// Copies the selected box, or the whole mask when no box is selected.
+MaskClip ImageCanvas::copyRegion(bool current_label_only) {
+	cv::Rect rect(0, 0, _mask.id.cols, _mask.id.rows);
+	int idx = getSelectedBox();
+	if (idx != -1)
+		rect = box_list.rect(idx);
+	return MaskClip::fromMask(_mask.id, rect, current_label_only ? _color.id : -1);
+}
+
+void ImageCanvas::pasteClip(const MaskClip &clip, bool at_cursor, MaskClip::PasteMode mode) {
+	if (clip.empty() || _mask.isNull())
+		return;
+	PAT_TRACE_SCOPE("pasteClip");
+	cv::Point offset(0, 0);
+	if (at_cursor) {
+		cv::Rect rect = clip.rect();
+		offset = cv::Point(int(_mouse_pos.x() / _scale) - rect.x - rect.width / 2,
+		                   int(_mouse_pos.y() / _scale) - rect.y - rect.height / 2);
+	}
+	cv::Rect dirty = (clip.rect() + offset) & cv::Rect(0, 0, _mask.id.cols, _mask.id.rows);
+	if (dirty.area() == 0)
+		return;
+	cv::Mat region = _mask.id(dirty).clone();
+	clip.paste(region, offset - dirty.tl(), mode);
+	_mask.setRegion(dirty, region);
+	_mask.updateColor(_ui->id_labels, dirty);
+	_pushUndo();
+	update();
+}
+
+void ImageCanvas::dilateLabel()    { _morphLabel(LABEL_DILATE); }
+void ImageCanvas::erodeLabel()     { _morphLabel(LABEL_ERODE); }
+void ImageCanvas::openLabel()      { _morphLabel(LABEL_OPEN); }
+void ImageCanvas::closeLabel()     { _morphLabel(LABEL_CLOSE); }
+void ImageCanvas::fillLabelHoles() { _morphLabel(LABEL_FILL_HOLES); }
+
+// Cleans up the current label inside the selected box, or else the visible
+// part of the image, by one brush radius.
+void ImageCanvas::_morphLabel(LabelMorphology op) {
+	if (_mask.isNull())
+		return;
+	PAT_TRACE_SCOPE("morphLabel");
+	cv::Rect roi;
+	int idx = getSelectedBox();
+	if (idx != -1) {
+		roi = box_list.rect(idx);
 	} else {
-		_undo_index = _undo_list.size();
-		_ui->redo_action->setEnabled(false);
+		QRect view = visibleRegion().boundingRect();
+		roi = cv::Rect(cv::Point(int(view.left() / _scale), int(view.top() / _scale)),
+		               cv::Point(int(std::ceil((view.right() + 1) / _scale)), int(std::ceil((view.bottom() + 1) / _scale))));
 	}
-	_ui->undo_action->setEnabled(true);
+	MorphologyResult result = morphLabel(_mask.id, roi, ushort(_color.id), op, std::max(1, _pen_size / 2));
+	if (result.rect.area() == 0)
+		return;
+	_mask.setRegion(result.rect, result.labels);
+	_mask.updateColor(_ui->id_labels, result.rect);
+	_pushUndo();
+	update();
+}
+
+void ImageCanvas::clearComparison() {
+	_disagreement = QImage();
+	update();
 }
 
 std::string ImageCanvas::getObjectString(){
-    return _ui->id_labels[_cid]->name.toStdString();
+    const LabelInfo * label = _ui->id_labels.find(_cid);
+    return label != NULL ? label->name.toStdString() : std::string();
 }
@@ -3,11 +3,26 @@
 
 #include "utils.h"
 #include "image_mask.h"
-#include "boundingbox.h"
+#include "box_store.h"
+#include "dataset_index.h"
+#include "box_refine.h"
+#include "polygon.h"
+#include "mask_compare.h"
+#include "mask_clip.h"
+#include "sequence.h"
+#include "image_source.h"
+#include "tiled_mask.h"
+#include "instances.h"
+#include "label_morphology.h"
+#include "livewire.h"
+#include "edit_journal.h"
 
 #include <QLabel>
 #include <QPen>
 #include <QScrollArea>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFutureWatcher>
 
 class MainWindow;
 
@@ -22,23 +37,28 @@ public:
 	void setId(int id);
 	void setMask(const ImageMask & mask);
     void setActionMask(const ImageMask & mask);
-    ImageMask getMask() const { return _mask; }
+    const ImageMask & getMask() const { return _mask; }
     QImage getImage() const { return _image; }
+    QString getImageFile() const { return _img_file; }
+    double getScale() const { return _scale; }
+    int getPenSize() const { return _pen_size; }
+    int getLabelId() const { return _cid; }
 
 
-	void setWatershedMask(QImage watershed);
+	void setWatershedMask(const cv::Mat &watershed);
 	void refresh();
 	void updateMaskColor(const Id2Labels & labels) { _mask.updateColor(labels); }
 	void loadImage(const QString &file);
 	QScrollArea * getScrollParent() const { return _scroll_parent; }
-    bool isNotSaved() const { return _undo_list.size() > 1; }
-    void redrawBoundingBox(int except_index =-1);
+    bool isNotSaved() const { return !_undo_list.isEmpty(); }
+    void discardJournal() { _journal.discard(); }
     int getSelectedBox();
     void reset(int operation=DRAW_MODE);
-    void drawMarkedBoundingBox(BoundingBox b);
-    void drawBoundingBox(BoundingBox b);
     std::string getObjectString();
     void saveAnnotation();
+    bool compareWith(const QString &mask_file, MaskComparison *comparison);
+    MaskClip copyRegion(bool current_label_only);
+    void pasteClip(const MaskClip &clip, bool at_cursor, MaskClip::PasteMode mode);
 
 protected:
 	void mouseMoveEvent(QMouseEvent * event) override;
@@ -46,6 +66,7 @@ protected:
 	void keyPressEvent(QKeyEvent * event) override;
 	void wheelEvent(QWheelEvent * event) override;
 	void mouseReleaseEvent(QMouseEvent * event) override;
+	void mouseDoubleClickEvent(QMouseEvent * event) override;
 	void paintEvent(QPaintEvent *event) override;
 
 public slots :
@@ -56,30 +77,98 @@ public slots :
 	void saveMask();
 	void undo();
 	void redo();
+	void superpixelModeChanged(bool enabled);
+	void refineSelectedBox();
+	void refineAllBoxes();
+	void polygonModeChanged(bool enabled);
+	void clearComparison();
+	void sequenceModeChanged(bool enabled);
+	void instanceModeChanged(bool enabled);
+	void livewireModeChanged(bool enabled);
+	void nextWindow();
+	void previousWindow();
+	void dilateLabel();
+	void erodeLabel();
+	void openLabel();
+	void closeLabel();
+	void fillLabelHoles();
+
+private slots:
+	void _superpixelsReady();
+	void _boxRefinementReady();
+	void _propagationReady();
+	void _livewireCostReady();
+	void _flushJournal();
+	void _serveFrame();
 	
 private:
 	MainWindow *_ui;
 	
 	void _initPixmap();
-	void _drawFillCircle(QMouseEvent * e);
+#ifdef PIXEL_ANNOTATION_TRACING
+	void _drawPerfOverlay();
+	QElapsedTimer    _frame_clock      ;
+	qint64           _last_paint_us = 0;
+#endif
+	cv::Point _strokePoint(QMouseEvent * e);
+	void _beginStroke(QMouseEvent * e);
+	void _continueStroke(QMouseEvent * e);
+	void _flushStroke();
+	void _endStroke();
+	bool _superpixelMode() const;
+	void _requestSuperpixels();
+	void _paintSegments(cv::Point from, cv::Point to);
+	void _refineBoxes(const std::vector<int> &boxes);
+	void _requestPropagation();
+	bool _windowed() const { return _source != nullptr; }
+	void _loadWindow();
+	void _moveWindow(int step);
+	void _markSaved();
+	void _scheduleFrame();
+	void _drawBoxes(QPainter &painter);
+	bool _instanceMode() const;
+	void _morphLabel(LabelMorphology op);
+	bool _livewireMode() const;
+	void _requestLivewireCost();
+	void _livewirePress(QMouseEvent * e);
+	void _closeLivewire();
+	void _flushLivewire();
+	void _openJournal();
+	void _journalPatch(cv::Rect rect, const cv::Mat &labels);
+	void _journalBoxes();
+	void _journalPolygons();
+	void _drawLivewire(QPainter &painter);
+	void _updateInstances();
+	bool _polygonMode() const;
+	int  _polygonVertexRadius() const;
+	void _polygonPress(QMouseEvent * e);
+	void _closePolygon();
+	void _deletePolygonAt(cv::Point p);
+	void _rasterizePolygon(AnnotationPolygon &polygon);
+	cv::Rect _unrasterizePolygon(const AnnotationPolygon &polygon);
+	void _initPolygonUnders();
+	void _drawPolygons(QPainter &painter);
     void _fill(QMouseEvent * e);
     void _startMarkingBoundingBox(QMouseEvent *e);
-    void _drawBoundingBox(QMouseEvent *e);
     cv::Point getXYonImage(QMouseEvent *e);
     cv::Point getXYonImage(int x_gui, int y_gui);
     void parseXML(QString file_name);
+    void _pushUndo();
+    void _resetUndo();
+    void _applyPatch(const MaskPatch &patch, const cv::Mat &plane);
+    void _applyPolygons(const std::vector<AnnotationPolygon> &polygons);
 
 	QScrollArea     *_scroll_parent    ;
 	double           _scale            ;
 	double           _alpha            ;
 	QImage           _image            ;
-	QImage           _orig_image       ;
-	QImage           _buffer_image     ;
 	ImageMask        _mask             ;
 	ImageMask        _watershed        ;
-	QList<ImageMask> _undo_list        ;
-	bool             _undo             ;
+	QImage           _mask_render      ; // RGB32 copies of the mask colors, drawn without conversion
+	QImage           _watershed_render ;
+	QList<MaskPatch> _undo_list        ;
 	int              _undo_index       ;
+	cv::Mat          _committed        ; // label plane as of the last undo step
 	QPoint           _mouse_pos        ;
 	QString          _img_file         ;
 	QString          _mask_file        ;
@@ -88,9 +177,54 @@ private:
 	ColorMask        _color            ;
 	int              _pen_size         ;
 	bool             _button_is_pressed;
+	std::vector<cv::Point> _stroke_samples;
+	cv::Point        _stroke_anchor    ;
+	bool             _stroke_has_anchor = false;
+	bool             _stroke_active    = false;
+	QFutureWatcher<Superpixels> _superpixel_watcher;
+	QString          _superpixel_file  ; // image of _superpixels or of the pending computation
+	Superpixels      _superpixels      ;
+	QImage           _superpixel_edges ;
+	std::vector<uchar> _stroke_segments; // segments already painted by the current drag
+	QFutureWatcher<BoxRefineResult> _refine_watcher;
+	QString          _refine_file      ;
+	cv::Rect         _refine_window    ;
+	bool             _refine_pending = false; // the busy cursor is set until the results are in
+	QFutureWatcher<PropagatedMask> _propagation_watcher;
+	QString          _propagation_file ;
+	std::shared_ptr<ImageSource> _source; // only kept for images annotated by windows
+	cv::Rect         _window           ; // region of _source shown, in image coordinates
+	int              _window_index = 0 ;
+	TiledMask        _tiled_mask       ;
+	std::vector<AnnotationPolygon> _polygons;
+	std::vector<AnnotationPolygon> _committed_polygons; // as of the last undo step
+	bool             _polygons_changed = false;
+	AnnotationPolygon _open_polygon    ; // polygon being drawn
+	int              _edit_polygon = -1;
+	int              _edit_vertex  = -1;
+	bool             _polygon_press = false;
+	QImage           _disagreement     ; // overlay of the last mask comparison
+	cv::Mat          _instances        ; // CV_32S instance ids, as last saved
+	QImage           _instance_edges   ;
+	QFutureWatcher<cv::Mat> _livewire_watcher;
+	QString          _livewire_file    ; // image of _livewire_cost or of the pending computation
+	cv::Mat          _livewire_cost    ;
+	LivewireSearch   _livewire_search  ;
+	std::vector<cv::Point> _livewire_contour; // anchored part of the boundary being traced
+	std::vector<cv::Point> _livewire_tail; // from the last anchor to _livewire_cursor
+	cv::Point        _livewire_cursor  ;
+	bool             _livewire_moved = false; // the tail is searched once per frame
+	EditJournal      _journal          ; // edits since the last save, replayed after a crash
+	QTimer           _journal_timer    ;
+	QTimer           _frame_timer      ; // paces the repaints caused by input at the display rate
+	QElapsedTimer    _last_frame       ;
+	int              _frame_requests = 0; // repaints asked since the last frame
+	qint64           _frames_served = 0;
+	qint64           _frames_coalesced = 0;
+	cv::Point        _box_preview_end  ; // corner of the box being created
     int start_x;
     int start_y;
-    std::vector<BoundingBox> box_list;
+    BoxStore box_list;
     int _cid =-1;
     
     const int FILL_IN_MODIFIER = Qt::ShiftModifier;
@@ -1,48 +1,240 @@
 #include "image_mask.h"
 #include "utils.h"
+#include "label_cache.h"
+#include "recolor.h"
 
 #include <QPainter>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QFileInfo>
 
-ImageMask::ImageMask() {}
-ImageMask::ImageMask(const QString &file, Id2Labels id_labels) {
-	id = mat2QImage(cv::imread(file.toStdString()));
-	color = idToColor(id, id_labels);
-    createBuffer();
+#include <cmath>
+#include <iostream>
+#include <random>
+
+namespace {
+
+// Counts the pixels of each id by horizontal stripes, each stripe in its own
+// LabelHistogram, merged once at the end.
+class CountStripes : public cv::ParallelLoopBody {
+public:
+	CountStripes(const cv::Mat &id, int stripes, std::vector<QMap<int, qint64> > &counts) :
+		_id(id), _stripes(stripes), _counts(counts) {}
+
+	void operator()(const cv::Range &range) const override {
+		LabelHistogram histogram;
+		for (int s = range.start; s < range.end; s++) {
+			int y0 = s * _id.rows / _stripes, y1 = (s + 1) * _id.rows / _stripes;
+			for (int y = y0; y < y1; y++)
+				histogram.addRow(_id.ptr<ushort>(y), _id.cols);
+			_counts[s] = histogram.counts();
+			histogram.reset();
+		}
+	}
+
+private:
+	const cv::Mat                   & _id     ;
+	int                               _stripes;
+	std::vector<QMap<int, qint64> > & _counts ;
+};
+
+} // namespace
+
+ImageMask::ImageMask() : color_generation(0) {}
+ImageMask::ImageMask(const QString &file, const Id2Labels &id_labels) {
+	const QByteArray palette_hash = paletteHash(id_labels.palette());
+	id = LabelPlaneCache::map(file, mapping, palette_hash, &color);
+	if (id.empty()) {
+		id = loadLabelImage(file);
+		color = idToColor(id, id_labels);
+		LabelPlaneCache::store(file, id, color, palette_hash);
+	} else if (color.isNull()) {
+		// cached with another palette
+		color = idToColor(id, id_labels);
+	}
+	color_dirty = cv::Rect(0, 0, id.cols, id.rows);
+	color_generation = id_labels.generation();
+	recount();
 }
 ImageMask::ImageMask(QSize s) {
-	id = QImage(s, QImage::Format_RGB888);
+	id = cv::Mat::zeros(s.height(), s.width(), CV_16UC1);
 	color = QImage(s, QImage::Format_RGB888);
-	id.fill(QColor(0, 0, 0));
 	color.fill(QColor(0, 0, 0));
-    createBuffer();
+	label_pixels.assign(65536, 0);
+	label_pixels[0] = qint64(id.total());
+	color_dirty = cv::Rect(0, 0, id.cols, id.rows);
+	color_generation = 0;
+}
+
+ImageMask::ImageMask(const ImageMask &other) :
+	id(other.id.clone()),
+	// a mapped color must not outlive the mapping of other
+	color(other.mapping ? other.color.copy() : other.color),
+	label_pixels(other.label_pixels),
+	color_dirty(0, 0, other.id.cols, other.id.rows),
+	color_generation(other.color_generation) {
+}
+
+ImageMask & ImageMask::operator=(const ImageMask &other) {
+	if (this != &other) {
+		id = other.id.clone();
+		color = other.mapping ? other.color.copy() : other.color;
+		label_pixels = other.label_pixels;
+		color_dirty = cv::Rect(0, 0, id.cols, id.rows);
+		color_generation = other.color_generation;
+		mapping.reset();
+	}
+	return *this;
+}
+
+void ImageMask::detachMapping() {
+	if (!mapping)
+		return;
+	id = id.clone();
+	color = color.copy();
+	mapping.reset();
+}
+
+int ImageMask::labelAt(int x, int y) const {
+	if (x < 0 || y < 0 || x >= id.cols || y >= id.rows)
+		return -1;
+	return id.at<ushort>(y, x);
+}
+
+qint64 ImageMask::pixelCount(int label) const {
+	if (label < 0 || label >= int(label_pixels.size()))
+		return 0;
+	return label_pixels[label];
+}
+
+void ImageMask::recount() {
+	label_pixels.assign(65536, 0);
+	if (id.empty())
+		return;
+	const int stripes = std::max(1, std::min(id.rows / 64, cv::getNumThreads() * 4));
+	std::vector<QMap<int, qint64> > counts(stripes);
+	cv::parallel_for_(cv::Range(0, stripes), CountStripes(id, stripes, counts));
+	for (size_t s = 0; s < counts.size(); s++) {
+		for (QMap<int, qint64>::const_iterator it = counts[s].begin(); it != counts[s].end(); ++it)
+			label_pixels[it.key()] += it.value();
+	}
+}
+
+// sign -1 before a region is written, +1 after : only roi is scanned.
+void ImageMask::_countRegion(cv::Rect roi, int sign) {
+	roi &= cv::Rect(0, 0, id.cols, id.rows);
+	for (int y = roi.y; y < roi.y + roi.height; y++) {
+		const ushort * line = id.ptr<ushort>(y) + roi.x;
+		ushort current = line[0];
+		int run_start = 0;
+		for (int x = 1; x < roi.width; x++) {
+			if (line[x] == current)
+				continue;
+			label_pixels[current] += sign * (x - run_start);
+			current = line[x];
+			run_start = x;
+		}
+		label_pixels[current] += sign * (roi.width - run_start);
+	}
+}
+
+void ImageMask::touch(cv::Rect roi) {
+	roi &= cv::Rect(0, 0, id.cols, id.rows);
+	if (roi.area() == 0)
+		return;
+	color_dirty = color_dirty.area() == 0 ? roi : (color_dirty | roi);
+}
+
+void ImageMask::setRegion(cv::Rect roi, const cv::Mat &labels) {
+	if (labels.size() != roi.size() || (roi & cv::Rect(0, 0, id.cols, id.rows)) != roi || roi.area() == 0)
+		return;
+	_countRegion(roi, -1);
+	labels.copyTo(id(roi));
+	_countRegion(roi, 1);
 }
 
 void ImageMask::drawFillCircle(int x, int y, int pen_size, ColorMask cm) {
-	QPen pen(QBrush(cm.id), 1.0);
-	QPainter painter_id(&id);
-	painter_id.setRenderHint(QPainter::Antialiasing, false);
-	painter_id.setPen(pen);
-	painter_id.setBrush(QBrush(cm.id));
-	painter_id.drawEllipse(x, y, pen_size, pen_size);
-	painter_id.end();
-
-	QPainter painter_color(&color);
-	QPen pen_color(QBrush(cm.color), 1.0);
-	painter_color.setRenderHint(QPainter::Antialiasing, false);
-	painter_color.setPen(pen_color);
-	painter_color.setBrush(QBrush(cm.color));
-	painter_color.drawEllipse(x, y, pen_size, pen_size);
-	painter_color.end();
-    circle(this->_buffer, cv::Point(x,y), pen_size/2.0, getColor(cm.color),CV_FILLED);
+	// circle inscribed in (x, y, pen_size, pen_size)
+	drawStroke(std::vector<cv::Point>(1, cv::Point(x + pen_size / 2, y + pen_size / 2)), pen_size, cm);
+}
+
+// Rasterizes the capsules joining consecutive points (a dot for a single
+// point) with the pen diameter. The color plane gets the exact same pixels,
+// so only the stroke span is touched on both planes.
+void ImageMask::drawStroke(const std::vector<cv::Point> &points, int pen_size, ColorMask cm) {
+	if (points.empty())
+		return;
+	int thickness = std::max(1, pen_size);
+	cv::Scalar rgb(cm.color.red(), cm.color.green(), cm.color.blue());
+	cv::Mat color_mat(color.height(), color.width(), CV_8UC3, color.bits(), color.bytesPerLine());
+	cv::Rect span = cv::boundingRect(points);
+	span = cv::Rect(span.x - thickness, span.y - thickness, span.width + 2 * thickness, span.height + 2 * thickness);
+	span &= cv::Rect(0, 0, id.cols, id.rows);
+	if (span.area() == 0)
+		return;
+	_countRegion(span, -1);
+	if (points.size() == 1) {
+		cv::line(id, points[0], points[0], cv::Scalar(cm.id), thickness);
+		cv::line(color_mat, points[0], points[0], rgb, thickness);
+	} else {
+		std::vector<std::vector<cv::Point> > polyline(1, points);
+		cv::polylines(id, polyline, false, cv::Scalar(cm.id), thickness);
+		cv::polylines(color_mat, polyline, false, rgb, thickness);
+	}
+	_countRegion(span, 1);
+	touch(span);
 }
 
 void ImageMask::fill(int x, int y, ColorMask cm, const Id2Labels & id_labels){
-    //color
-    cv::Mat id_mat = qImage2Mat(id);
-	cv::floodFill(id_mat, cv::Point(x, y), cv::Scalar(cm.id.red(), cm.id.green(), cm.id.blue()), 0, cv::Scalar(0, 0, 0), cv::Scalar(0, 0, 0));
-    //cv::imshow("showing buffer",id_mat);
-	id = mat2QImage(id_mat);
-	color = idToColor(id, id_labels);
+	const int old_id = labelAt(x, y);
+	qint64 filled = 0;
+	cv::Rect rect = floodFillLabel(id, cv::Point(x, y), cm.id, &filled);
+	if (rect.area() > 0) {
+		label_pixels[old_id] -= filled;
+		label_pixels[cm.id] += filled;
+		updateColor(id_labels, rect);
+	}
+}
+
+void ImageMask::fillSegment(const Superpixels &segments, int segment, ColorMask cm) {
+	if (segment < 0 || segment >= segments.count() || segments.labels.size() != id.size())
+		return;
+	const cv::Rect rect = segments.rects[segment];
+	const QRgb rgb = cm.color.rgb();
+	for (int y = rect.y; y < rect.y + rect.height; y++) {
+		const int * seg = segments.labels.ptr<int>(y);
+		ushort * label = id.ptr<ushort>(y);
+		uchar * pix = color.scanLine(y);
+		for (int x = rect.x; x < rect.x + rect.width; x++) {
+			if (seg[x] != segment) continue;
+			label_pixels[label[x]]--;
+			label_pixels[cm.id]++;
+			label[x] = ushort(cm.id);
+			pix[3 * x] = qRed(rgb); pix[3 * x + 1] = qGreen(rgb); pix[3 * x + 2] = qBlue(rgb);
+		}
+	}
+	touch(rect);
+}
+
+// Paints cm where the 8-bit mask, covering roi, is non zero.
+void ImageMask::fillMask(const cv::Mat &mask, cv::Rect roi, ColorMask cm) {
+	if (mask.empty() || mask.size() != roi.size() || (roi & cv::Rect(0, 0, id.cols, id.rows)) != roi)
+		return;
+	cv::Mat color_mat(color.height(), color.width(), CV_8UC3, color.bits(), color.bytesPerLine());
+	_countRegion(roi, -1);
+	id(roi).setTo(cv::Scalar(cm.id), mask);
+	_countRegion(roi, 1);
+	color_mat(roi).setTo(cv::Scalar(cm.color.red(), cm.color.green(), cm.color.blue()), mask);
+	touch(roi);
+}
+
+// Returns the rect of the label plane that was touched.
+cv::Rect ImageMask::fillPolygon(const std::vector<cv::Point> &points, ColorMask cm) {
+	cv::Rect roi = cv::boundingRect(points) & cv::Rect(0, 0, id.cols, id.rows);
+	if (points.size() < 3 || roi.area() == 0)
+		return cv::Rect();
+	fillMask(polygonMask(points, roi), roi, cm);
+	return roi;
 }
 
 void ImageMask::createBoundingBox(int x, int y){
@@ -54,26 +246,38 @@ void ImageMask::drawBoundingBox(int orig_x, int orig_y, int x, int y){
 }
 
 void ImageMask::drawPixel(int x, int y, ColorMask cm) {
-	id.setPixelColor(x, y, cm.id);
+	if (labelAt(x, y) < 0)
+		return;
+	label_pixels[id.at<ushort>(y, x)]--;
+	label_pixels[cm.id]++;
+	id.at<ushort>(y, x) = cm.id;
 	color.setPixelColor(x, y, cm.color);
+	touch(cv::Rect(x, y, 1, 1));
 }
 
 void ImageMask::updateColor(const Id2Labels & labels) {
 	idToColor(id, labels, &color);
+	color_generation = labels.generation();
+	touch(cv::Rect(0, 0, id.cols, id.rows));
 }
 
-void ImageMask::exchangeLabel(int x, int y, const Id2Labels& id_labels, ColorMask cm) {
+void ImageMask::updateColor(const Id2Labels & labels, cv::Rect roi) {
+	idToColor(id, labels, &color, roi);
+	touch(roi);
+}
 
-	QColor current_id = id.pixelColor(QPoint(x, y));
-	if (current_id.red() == 0 || current_id.green() == 0 || current_id.blue() == 0)
+void ImageMask::exchangeLabel(int x, int y, const Id2Labels& id_labels, ColorMask cm) {
+	const int old_id = labelAt(x, y);
+	if (old_id <= 0)
 		return;
 
-	cv::Mat id_mat = qImage2Mat(id);
-	cv::floodFill(id_mat, cv::Point(x, y), cv::Scalar(cm.id.red(), cm.id.green(), cm.id.blue()), 0, cv::Scalar(0, 0, 0), cv::Scalar(0, 0, 0));
-
-	id = mat2QImage(id_mat);
-	color = idToColor(id, id_labels);
-
+	qint64 filled = 0;
+	cv::Rect rect = floodFillLabel(id, cv::Point(x, y), cm.id, &filled);
+	if (rect.area() > 0) {
+		label_pixels[old_id] -= filled;
+		label_pixels[cm.id] += filled;
+		updateColor(id_labels, rect);
+	}
 }
 
 cv::Scalar ImageMask::getColor(QColor& color){
@@ -82,12 +286,142 @@ cv::Scalar ImageMask::getColor(QColor& color){
     return cv::Scalar(b,g,r);
 }
 
-void ImageMask::createBuffer(){
-    int width = id.width();
-    int height = id.height();
-    this->_buffer = cv::Mat::zeros(cv::Size(width, height), CV_8UC3);
+namespace {
+
+// 8-bit counterparts of idToColor and LabelHistogram, as the masks were
+// handled before the label plane became 16-bit.
+void idToColor8(const cv::Mat &image_id, const QVector<QRgb> &palette, QImage *result) {
+	QRgb lut[256];
+	for (int id = 0; id < 256; id++)
+		lut[id] = id < palette.size() ? palette[id] : qRgb(255, 255, 255);
+	for (int y = 0; y < image_id.rows; y++) {
+		const uchar * line_in = image_id.ptr<uchar>(y);
+		uchar * line_out = result->scanLine(y);
+		for (int x = 0; x < image_id.cols; x++) {
+			QRgb rgb = lut[line_in[x]];
+			uchar * pix = &line_out[x * 3];
+			pix[0] = qRed(rgb);
+			pix[1] = qGreen(rgb);
+			pix[2] = qBlue(rgb);
+		}
+	}
 }
 
-void ImageMask::destroyBuffer(){
-    this->_buffer.release(); // will free memory
-}
\ No newline at end of file
+qint64 countLabels8(const cv::Mat &image_id) {
+	qint64 bins[256] = { 0 };
+	for (int y = 0; y < image_id.rows; y++) {
+		const uchar * line = image_id.ptr<uchar>(y);
+		for (int x = 0; x < image_id.cols; x++)
+			bins[line[x]]++;
+	}
+	return image_id.total() - bins[0];
+}
+
+void printRow(const char *name, qint64 ms8, qint64 ms16) {
+	std::cout << name << " : " << ms8 << " ms (8-bit)  " << ms16 << " ms (16-bit)" << std::endl;
+}
+
+} // namespace
+
+int runLabelBenchmark(const QStringList &arguments) {
+	double megapixels = 20.;
+	int index = arguments.indexOf("--bench-labels");
+	if (index >= 0 && index + 1 < arguments.size() && arguments[index + 1].toDouble() > 0)
+		megapixels = arguments[index + 1].toDouble();
+	// 3:2 frame, 5472x3648 for 20 MP
+	const int cols = int(std::sqrt(megapixels * 1e6 * 1.5));
+	const int rows = int(megapixels * 1e6) / cols;
+
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int> x_coordinate(0, cols - 1), y_coordinate(0, rows - 1), label(1, 40);
+	const int strokes = 2000;
+	std::vector<std::vector<cv::Point> > polylines(strokes);
+	std::vector<int> stroke_labels(strokes);
+	for (int i = 0; i < strokes; i++) {
+		cv::Point p(x_coordinate(random), y_coordinate(random));
+		for (int j = 0; j < 8; j++) {
+			p += cv::Point(x_coordinate(random) % 200 - 100, y_coordinate(random) % 200 - 100);
+			polylines[i].push_back(p);
+		}
+		stroke_labels[i] = label(random);
+	}
+	QVector<QRgb> palette(41);
+	for (int id = 0; id < palette.size(); id++)
+		palette[id] = qRgb(id * 37 % 256, id * 91 % 256, id * 13 % 256);
+
+	cv::Mat id8 = cv::Mat::zeros(rows, cols, CV_8UC1), id16 = cv::Mat::zeros(rows, cols, CV_16UC1);
+	QElapsedTimer timer;
+
+	timer.start();
+	for (int i = 0; i < strokes; i++)
+		cv::polylines(id8, std::vector<std::vector<cv::Point> >(1, polylines[i]), false, cv::Scalar(stroke_labels[i]), 24);
+	qint64 brush8 = timer.restart();
+	for (int i = 0; i < strokes; i++)
+		cv::polylines(id16, std::vector<std::vector<cv::Point> >(1, polylines[i]), false, cv::Scalar(stroke_labels[i]), 24);
+	qint64 brush16 = timer.restart();
+
+	// the unlabeled background, the largest region, and back
+	cv::Point seed(-1, -1);
+	for (int y = 0; y < rows && seed.y < 0; y++) {
+		const uchar * line = id8.ptr<uchar>(y);
+		for (int x = 0; x < cols; x++) {
+			if (line[x] == 0) { seed = cv::Point(x, y); break; }
+		}
+	}
+	timer.restart();
+	if (seed.y >= 0) {
+		cv::floodFill(id8, seed, cv::Scalar(41), NULL, cv::Scalar(), cv::Scalar(), 4);
+		cv::floodFill(id8, seed, cv::Scalar(0), NULL, cv::Scalar(), cv::Scalar(), 4);
+	}
+	qint64 fill8 = timer.restart();
+	if (seed.y >= 0) {
+		floodFillLabel(id16, seed, 41);
+		floodFillLabel(id16, seed, 0);
+	}
+	qint64 fill16 = timer.restart();
+
+	QImage color(cols, rows, QImage::Format_RGB888);
+	idToColor8(id8, palette, &color);
+	qint64 recolor8 = timer.restart();
+	idToColor(id16, palette, &color);
+	qint64 recolor16 = timer.restart();
+
+	qint64 labeled8 = countLabels8(id8);
+	qint64 count8 = timer.restart();
+	LabelHistogram histogram;
+	histogram.add(id16);
+	qint64 labeled16 = id16.total() - histogram.counts().value(0, 0);
+	qint64 count16 = timer.restart();
+
+	QTemporaryDir dir;
+	const QString file8 = dir.path() + "/bench8_mask.png", file16 = dir.path() + "/bench16_mask.png";
+	timer.restart();
+	saveLabelImage(file8, id16);
+	qint64 save8 = timer.restart();
+	saveLabelImage(file16, id16, true);
+	qint64 save16 = timer.restart();
+	cv::Mat loaded8 = loadLabelImage(file8);
+	qint64 load8 = timer.restart();
+	cv::Mat loaded16 = loadLabelImage(file16);
+	qint64 load16 = timer.restart();
+
+	const qint64 pixels = qint64(cols) * rows;
+	std::cout << cols << "x" << rows << " label plane, " << strokes << " strokes" << std::endl;
+	std::cout << "plane memory : " << pixels / 1024 << " KB (8-bit)  " << 2 * pixels / 1024 << " KB (16-bit)  "
+		<< 3 * pixels / 1024 << " KB (RGB888 id image, before the 16-bit plane)" << std::endl;
+	printRow("brush strokes", brush8, brush16);
+	printRow("flood fill x2", fill8, fill16);
+	printRow("recolor      ", recolor8, recolor16);
+	printRow("label counts ", count8, count16);
+	printRow("save png     ", save8, save16);
+	printRow("load png     ", load8, load16);
+	std::cout << "png size : " << QFileInfo(file8).size() / 1024 << " KB (8-bit, 3 channels)  "
+		<< QFileInfo(file16).size() / 1024 << " KB (16-bit)" << std::endl;
+
+	// both paths must agree
+	bool same = labeled8 == labeled16 && cv::countNonZero(loaded8 != loaded16) == 0;
+	cv::Mat id8_as16;
+	id8.convertTo(id8_as16, CV_16U);
+	same = same && cv::countNonZero(id8_as16 != id16) == 0;
+	return same ? 0 : 1;
+}
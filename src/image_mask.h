@@ -2,34 +2,86 @@
 #define IMAGE_MASK_H
 
 #include <QImage>
+#include <QStringList>
 #include "boundingbox.h"
 #include "utils.h"
+#include "superpixels.h"
+#include "polygon.h"
+#include <memory>
+#include <vector>
+
+class QFile;
 
 struct  ColorMask {
-	QColor id;
+	int    id;
 	QColor color;
+	ColorMask() : id(0) {}
 };
 
 struct ImageMask {
-	QImage id;
+	cv::Mat id;    // CV_16UC1 label plane
 	QImage color;
-    cv::Mat _buffer;
+	std::shared_ptr<QFile> mapping; // owner of id when it is mapped from the label cache
+	std::vector<qint64> label_pixels; // pixels of each id, kept up to date by the methods below
+	cv::Rect color_dirty; // part of color changed since the display copy was last synced
+	quint64  color_generation; // Id2Labels::generation() the whole color was last rendered with
     
 	ImageMask();
-	ImageMask(const QString &file, Id2Labels id_labels);
+	ImageMask(const QString &file, const Id2Labels &id_labels);
 	ImageMask(QSize s);
+	// copies are deep, as the QImage based masks were (copy on write)
+	ImageMask(const ImageMask &other);
+	ImageMask(ImageMask &&other) = default;
+	ImageMask & operator=(const ImageMask &other);
+	ImageMask & operator=(ImageMask &&other) = default;
+
+	bool isNull() const { return id.empty(); }
+	QSize size() const { return QSize(id.cols, id.rows); }
+	int  labelAt(int x, int y) const;
+	qint64 pixelCount(int label) const;
+	qint64 labeledPixels() const { return isNull() ? 0 : qint64(id.total()) - label_pixels[0]; }
+	bool hasLabels() const { return labeledPixels() > 0; }
+	// Copies the planes out of the label cache file they are mapped from,
+	// which can then be replaced (a mapped file can't be on Windows).
+	void detachMapping();
+	// Full recount, after id was replaced as a whole.
+	void recount();
+	// Writes labels (a CV_16UC1 plane of roi's size) into roi, keeping the counts.
+	void setRegion(cv::Rect roi, const cv::Mat &labels);
+	void touch(cv::Rect roi);
 
 	void drawFillCircle(int x, int y, int pen_size, ColorMask cm);
+	void drawStroke(const std::vector<cv::Point> &points, int pen_size, ColorMask cm);
 	void drawPixel(int x, int y, ColorMask cm);
 	void updateColor(const Id2Labels & labels);
+	void updateColor(const Id2Labels & labels, cv::Rect roi);
 	void exchangeLabel(int x, int y, const Id2Labels & id_labels, ColorMask cm);
     void fill(int x, int y, ColorMask cm, const Id2Labels & id_labels);
-    void fillPolygon(cv::Mat& buffer, cv::Point point);
-    void createBuffer();
-    void destroyBuffer();
+	cv::Rect fillPolygon(const std::vector<cv::Point> &points, ColorMask cm);
+	void fillSegment(const Superpixels &segments, int segment, ColorMask cm);
+	void fillMask(const cv::Mat &mask, cv::Rect roi, ColorMask cm);
     cv::Scalar getColor(QColor& color);
     void createBoundingBox(int x, int y);
     void drawBoundingBox(int orig_x, int orig_y, int x, int y);
+
+private:
+	void _countRegion(cv::Rect roi, int sign);
+};
+
+// Headless entry point : PixelAnnotationTool --bench-labels [megapixels]
+// Times the brush, fill, recolor, count and png paths on an 8-bit and on a
+// 16-bit label plane of the same content, and prints their memory.
+int runLabelBenchmark(const QStringList &arguments);
+
+// Undo step : the rect of the label plane an action changed, before and after,
+// and the polygon annotations when the action added, edited or removed one.
+struct MaskPatch {
+	cv::Rect rect  ;
+	cv::Mat  before;
+	cv::Mat  after ;
+	bool                           polygons = false;
+	std::vector<AnnotationPolygon> polygons_before;
+	std::vector<AnnotationPolygon> polygons_after ;
 };
 
 class State{
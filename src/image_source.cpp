@@ -0,0 +1,129 @@
+#include "image_source.h"
+#include "trace.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <QCache>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef PIXEL_ANNOTATION_HAVE_TIFF
+#include <tiffio.h>
+#endif
+
+namespace {
+
+class DecodedImageSource : public ImageSource {
+public:
+	explicit DecodedImageSource(const QString &file) : _image(cv::imread(file.toStdString())) {}
+
+	cv::Size size() const override { return _image.size(); }
+	bool isTiled() const override { return false; }
+	cv::Mat read(cv::Rect roi) override {
+		return _image(roi & cv::Rect(0, 0, _image.cols, _image.rows));
+	}
+
+private:
+	cv::Mat _image;
+};
+
+#ifdef PIXEL_ANNOTATION_HAVE_TIFF
+
+static const int TILE_CACHE_BYTES = 256 << 20;
+
+// 8-bit gray, RGB or RGBA tiled TIFF with contiguous samples. The decoded
+// tiles are kept in an LRU cache, so panning over a region decodes it once.
+class TiffImageSource : public ImageSource {
+public:
+	static std::shared_ptr<ImageSource> open(const QString &file) {
+		TIFF * tif = TIFFOpen(QFile::encodeName(file).constData(), "r");
+		if (tif == NULL)
+			return std::shared_ptr<ImageSource>();
+		uint32 width = 0, height = 0, tile_w = 0, tile_h = 0;
+		uint16 bits = 8, samples = 1, planar = PLANARCONFIG_CONTIG;
+		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+		if (!TIFFIsTiled(tif) || bits != 8 || planar != PLANARCONFIG_CONTIG ||
+		    (samples != 1 && samples != 3 && samples != 4) ||
+		    !TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tile_w) || !TIFFGetField(tif, TIFFTAG_TILELENGTH, &tile_h) ||
+		    width == 0 || height == 0) {
+			TIFFClose(tif);
+			return std::shared_ptr<ImageSource>();
+		}
+		return std::shared_ptr<ImageSource>(new TiffImageSource(tif, cv::Size(width, height), cv::Size(tile_w, tile_h), samples));
+	}
+
+	~TiffImageSource() { TIFFClose(_tif); }
+
+	cv::Size size() const override { return _size; }
+	bool isTiled() const override { return true; }
+
+	cv::Mat read(cv::Rect roi) override {
+		PAT_TRACE_SCOPE("readTiles");
+		roi &= cv::Rect(0, 0, _size.width, _size.height);
+		cv::Mat result(roi.size(), CV_8UC3, cv::Scalar::all(0));
+		for (int ty = roi.y / _tile.height; ty * _tile.height < roi.br().y; ty++) {
+			for (int tx = roi.x / _tile.width; tx * _tile.width < roi.br().x; tx++) {
+				cv::Rect tile_rect(tx * _tile.width, ty * _tile.height, _tile.width, _tile.height);
+				cv::Rect common = tile_rect & roi;
+				// the tile is copied before the next one may evict it
+				const cv::Mat * tile = _decodeTile(tx, ty);
+				if (tile != NULL)
+					(*tile)(common - tile_rect.tl()).copyTo(result(common - roi.tl()));
+			}
+		}
+		return result;
+	}
+
+private:
+	TiffImageSource(TIFF *tif, cv::Size size, cv::Size tile, int samples) :
+		_tif(tif), _size(size), _tile(tile), _samples(samples) {
+		_tiles.setMaxCost(TILE_CACHE_BYTES);
+	}
+
+	const cv::Mat * _decodeTile(int tx, int ty) {
+		qint64 key = qint64(ty) * ((_size.width + _tile.width - 1) / _tile.width) + tx;
+		cv::Mat * tile = _tiles.object(key);
+		if (tile != NULL)
+			return tile;
+		cv::Mat raw(_tile, CV_8UC(_samples));
+		if (TIFFReadTile(_tif, raw.data, tx * _tile.width, ty * _tile.height, 0, 0) < 0)
+			return NULL;
+		tile = new cv::Mat();
+		if (_samples == 1)
+			cv::cvtColor(raw, *tile, cv::COLOR_GRAY2BGR);
+		else if (_samples == 3)
+			cv::cvtColor(raw, *tile, cv::COLOR_RGB2BGR);
+		else
+			cv::cvtColor(raw, *tile, cv::COLOR_RGBA2BGR);
+		int cost = int(tile->total() * tile->elemSize());
+		_tiles.insert(key, tile, cost);
+		return _tiles.object(key);
+	}
+
+	TIFF                   * _tif    ;
+	cv::Size                 _size   ;
+	cv::Size                 _tile   ;
+	int                      _samples;
+	QCache<qint64, cv::Mat>  _tiles  ;
+};
+
+#endif // PIXEL_ANNOTATION_HAVE_TIFF
+
+} // namespace
+
+std::shared_ptr<ImageSource> openImageSource(const QString &file) {
+#ifdef PIXEL_ANNOTATION_HAVE_TIFF
+	QString suffix = QFileInfo(file).suffix().toLower();
+	if (suffix == "tif" || suffix == "tiff") {
+		std::shared_ptr<ImageSource> tiled = TiffImageSource::open(file);
+		if (tiled)
+			return tiled;
+	}
+#endif
+	return std::shared_ptr<ImageSource>(new DecodedImageSource(file));
+}
@@ -0,0 +1,23 @@
+#ifndef IMAGE_SOURCE_H
+#define IMAGE_SOURCE_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+#include <memory>
+
+// Pixels of an image file, read by region. Tiled sources only decode the
+// tiles a region overlaps, so images larger than the memory can be opened.
+class ImageSource {
+public:
+	virtual ~ImageSource() {}
+	virtual cv::Size size() const = 0;
+	virtual bool isTiled() const = 0;
+	// BGR 8-bit pixels of roi (clipped to the image)
+	virtual cv::Mat read(cv::Rect roi) = 0;
+};
+
+// Tiled TIFF / BigTIFF files (when built with libtiff) are read by tile,
+// anything else is decoded at once with cv::imread.
+std::shared_ptr<ImageSource> openImageSource(const QString &file);
+
+#endif // IMAGE_SOURCE_H
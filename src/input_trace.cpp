@@ -0,0 +1,455 @@
+#include "input_trace.h"
+#include "main_window.h"
+#include "image_canvas.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <QApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#if defined(Q_OS_WIN)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// the canvas is repainted when the recorded clock moves by a frame
+static const qint64 REPLAY_FRAME_MS = 16;
+
+static const char * const EVENT_NAMES[InputEvent::TYPE_COUNT] = { "press", "release", "dblclick", "move", "wheel", "key" };
+static const char * const MODES[] = { "superpixel", "polygon", "livewire", "instance" };
+
+static QAction * modeAction(MainWindow *ui, const QString &mode) {
+	if (mode == "superpixel") return ui->superpixel_action;
+	if (mode == "polygon")    return ui->polygon_action;
+	if (mode == "livewire")   return ui->livewire_action;
+	if (mode == "instance")   return ui->instance_action;
+	return NULL;
+}
+
+bool InputTrace::read(const QString &file_name, QString *error) {
+	QFile file(file_name);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		*error = "can't read " + file_name;
+		return false;
+	}
+	int line_number = 0;
+	while (!file.atEnd()) {
+		const QByteArray line = file.readLine().trimmed();
+		line_number++;
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		const QList<QByteArray> fields = line.split(' ');
+		bool ok = true;
+		if (fields[0] == "image" && fields.size() == 4 && fields[1] == "synthetic") {
+			image.clear();
+			synthetic_width = fields[2].toInt(&ok);
+			if (ok) synthetic_height = fields[3].toInt(&ok);
+		} else if (fields[0] == "image" && fields.size() >= 2) {
+			image = QFileInfo(file_name).dir().absoluteFilePath(QString::fromUtf8(line.mid(6)));
+		} else if (fields[0] == "scale" && fields.size() == 2) {
+			scale = fields[1].toDouble(&ok);
+		} else if (fields[0] == "pen" && fields.size() == 2) {
+			pen = fields[1].toInt(&ok);
+		} else if (fields[0] == "label" && fields.size() == 2) {
+			label = fields[1].toInt(&ok);
+		} else if (fields[0] == "mode" && fields.size() == 2) {
+			modes << QString::fromUtf8(fields[1]);
+		} else if (fields.size() == 8) {
+			InputEvent event;
+			event.ms = fields[0].toLongLong(&ok);
+			const char * const * name = std::find(EVENT_NAMES, EVENT_NAMES + InputEvent::TYPE_COUNT, fields[1]);
+			event.type = InputEvent::Type(name - EVENT_NAMES);
+			ok = ok && event.type != InputEvent::TYPE_COUNT;
+			int * values[6] = { &event.x, &event.y, &event.button, &event.buttons, &event.modifiers, &event.value };
+			for (int i = 0; i < 6 && ok; i++)
+				*values[i] = fields[i + 2].toInt(&ok);
+			if (ok)
+				events.push_back(event);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			*error = QString("%1:%2 : can't parse \"%3\"").arg(file_name).arg(line_number).arg(QString::fromUtf8(line));
+			return false;
+		}
+	}
+	if (image.isEmpty() && synthetic_width <= 0) {
+		*error = file_name + " : no image";
+		return false;
+	}
+	return true;
+}
+
+bool InputTraceRecorder::start(const QString &file, MainWindow *ui, ImageCanvas *canvas) {
+	stop();
+	_file.setFileName(file);
+	if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		return false;
+	QString header = "# PixelAnnotationTool input trace\n";
+	header += "image " + QFileInfo(file).dir().relativeFilePath(canvas->getImageFile()) + "\n";
+	header += QString("scale %1\npen %2\nlabel %3\n").arg(canvas->getScale()).arg(canvas->getPenSize()).arg(canvas->getLabelId());
+	for (const char * mode : MODES) {
+		if (modeAction(ui, mode)->isChecked())
+			header += QString("mode %1\n").arg(mode);
+	}
+	_file.write(header.toUtf8());
+	_canvas = canvas;
+	_canvas->installEventFilter(this);
+	_count = 0;
+	_clock.start();
+	return true;
+}
+
+void InputTraceRecorder::stop() {
+	if (_canvas)
+		_canvas->removeEventFilter(this);
+	_canvas = NULL;
+	_file.close();
+}
+
+void InputTraceRecorder::_write(InputEvent::Type type, int x, int y, int button, int buttons, int modifiers, int value) {
+	char line[128];
+	int n = snprintf(line, sizeof(line), "%lld %s %d %d %d %d %d %d\n", (long long)_clock.elapsed(), EVENT_NAMES[type],
+	                 x, y, button, buttons, modifiers, value);
+	_file.write(line, n);
+	_count++;
+}
+
+bool InputTraceRecorder::eventFilter(QObject *watched, QEvent *event) {
+	if (watched != _canvas || !_file.isOpen())
+		return false;
+	switch (event->type()) {
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseButtonRelease:
+	case QEvent::MouseButtonDblClick:
+	case QEvent::MouseMove: {
+		QMouseEvent * e = static_cast<QMouseEvent*>(event);
+		InputEvent::Type type = event->type() == QEvent::MouseButtonPress ? InputEvent::PRESS :
+		                        event->type() == QEvent::MouseButtonRelease ? InputEvent::RELEASE :
+		                        event->type() == QEvent::MouseButtonDblClick ? InputEvent::DOUBLE_CLICK : InputEvent::MOVE;
+		_write(type, e->x(), e->y(), int(e->button()), int(e->buttons()), int(e->modifiers()), 0);
+		break;
+	}
+	case QEvent::Wheel: {
+		QWheelEvent * e = static_cast<QWheelEvent*>(event);
+		_write(InputEvent::WHEEL, e->pos().x(), e->pos().y(), 0, int(e->buttons()), int(e->modifiers()), e->delta());
+		break;
+	}
+	case QEvent::KeyPress: {
+		QKeyEvent * e = static_cast<QKeyEvent*>(event);
+		_write(InputEvent::KEY, 0, 0, 0, 0, int(e->modifiers()), e->key());
+		break;
+	}
+	default:
+		break;
+	}
+	return false;
+}
+
+// -- Replay ---------------------------------------------------------------
+
+namespace {
+
+// Gradient, shapes and noise : gives the fill, superpixel and livewire tools
+// regions and edges to work on, the same on every run.
+QString synthesizeImage(const QString &dir, int width, int height) {
+	cv::Mat image(height, width, CV_8UC3);
+	for (int y = 0; y < height; y++) {
+		cv::Vec3b * line = image.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < width; x++)
+			line[x] = cv::Vec3b(uchar(255 * x / width), uchar(255 * y / height), 128);
+	}
+	cv::RNG rng(0x5eed);
+	const int shapes = std::max(1, width * height / 40000);
+	for (int i = 0; i < shapes; i++) {
+		cv::Point center(rng.uniform(0, width), rng.uniform(0, height));
+		cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+		int size = rng.uniform(10, std::max(11, std::min(width, height) / 8));
+		if (i % 2 == 0)
+			cv::circle(image, center, size, color, -1);
+		else
+			cv::rectangle(image, center, center + cv::Point(size, size * 2 / 3), color, -1);
+	}
+	cv::Mat noisy, noise(image.size(), CV_16SC3);
+	rng.fill(noise, cv::RNG::NORMAL, 0, 6);
+	image.convertTo(noisy, CV_16SC3);
+	noisy += noise;
+	noisy.convertTo(image, CV_8UC3);
+	QString file = dir + "/synthetic.png";
+	cv::imwrite(file.toStdString(), image);
+	return file;
+}
+
+// Copies the image and its annotations, so the replay leaves them untouched.
+QString copyImage(const QString &image_file, const QString &dir) {
+	QFileInfo image(image_file);
+	QDir source = image.dir();
+	const QString base = image.baseName();
+	QFile::copy(image_file, dir + "/" + image.fileName());
+	QFile::copy(source.absoluteFilePath(base + "_mask.png"), dir + "/" + base + "_mask.png");
+	QDir().mkpath(dir + "/xml");
+	QFile::copy(source.absoluteFilePath("xml/" + base + ".xml"), dir + "/xml/" + base + ".xml");
+	return dir + "/" + image.fileName();
+}
+
+qint64 peakMemoryKb() {
+#if defined(Q_OS_WIN)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return qint64(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+#if defined(Q_OS_MAC)
+	return qint64(usage.ru_maxrss / 1024); // bytes
+#else
+	return qint64(usage.ru_maxrss);
+#endif
+#endif
+}
+
+qint64 currentMemoryKb() {
+#if defined(Q_OS_WIN)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return qint64(counters.WorkingSetSize / 1024);
+#elif defined(Q_OS_LINUX)
+	long long pages = 0, resident = 0;
+	FILE * statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return -1;
+	int read = fscanf(statm, "%lld %lld", &pages, &resident);
+	fclose(statm);
+	return read == 2 ? qint64(resident * sysconf(_SC_PAGESIZE) / 1024) : -1;
+#else
+	return -1;
+#endif
+}
+
+void dispatch(ImageCanvas *canvas, const InputEvent &e) {
+	const QPointF pos(e.x, e.y);
+	const Qt::MouseButtons buttons(e.buttons);
+	const Qt::KeyboardModifiers modifiers(e.modifiers);
+	switch (e.type) {
+	case InputEvent::PRESS:
+	case InputEvent::RELEASE:
+	case InputEvent::DOUBLE_CLICK:
+	case InputEvent::MOVE: {
+		QEvent::Type type = e.type == InputEvent::PRESS ? QEvent::MouseButtonPress :
+		                    e.type == InputEvent::RELEASE ? QEvent::MouseButtonRelease :
+		                    e.type == InputEvent::DOUBLE_CLICK ? QEvent::MouseButtonDblClick : QEvent::MouseMove;
+		QMouseEvent event(type, pos, Qt::MouseButton(e.button), buttons, modifiers);
+		QCoreApplication::sendEvent(canvas, &event);
+		break;
+	}
+	case InputEvent::WHEEL: {
+		QWheelEvent event(pos, e.value, buttons, modifiers);
+		QCoreApplication::sendEvent(canvas, &event);
+		break;
+	}
+	case InputEvent::KEY: {
+		QKeyEvent event(QEvent::KeyPress, e.value, modifiers);
+		QCoreApplication::sendEvent(canvas, &event);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+struct Timings {
+	std::vector<qint64> ns;
+
+	// nearest rank, in ms
+	double percentile(double q) const {
+		if (ns.empty())
+			return 0.;
+		size_t rank = std::min(ns.size() - 1, size_t(q * ns.size()));
+		return ns[rank] / 1e6;
+	}
+	void sort() { std::sort(ns.begin(), ns.end()); }
+	QJsonObject toJson() const {
+		QJsonObject object;
+		object["count"] = int(ns.size());
+		object["p50_ms"] = percentile(0.50);
+		object["p90_ms"] = percentile(0.90);
+		object["p99_ms"] = percentile(0.99);
+		object["max_ms"] = ns.empty() ? 0. : ns.back() / 1e6;
+		return object;
+	}
+	void print(const char *name) const {
+		if (ns.empty())
+			return;
+		printf("  %-10s %7d %9.3f %9.3f %9.3f %9.3f\n", name, int(ns.size()),
+		       percentile(0.50), percentile(0.90), percentile(0.99), ns.back() / 1e6);
+	}
+};
+
+struct ReplayResult {
+	Timings events[InputEvent::TYPE_COUNT];
+	Timings all_events;
+	Timings paint;
+	qint64  duration_ms    = 0;
+	qint64  memory_before  = -1; // kB
+	qint64  memory_after   = -1;
+	qint64  peak_memory    = -1;
+};
+
+bool replay(const QString &trace_file, ReplayResult *result, QString *error) {
+	InputTrace trace;
+	if (!trace.read(trace_file, error))
+		return false;
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		*error = "can't create a temporary directory";
+		return false;
+	}
+	QString image_file;
+	if (trace.image.isEmpty())
+		image_file = synthesizeImage(dir.path(), trace.synthetic_width, trace.synthetic_height);
+	else if (QFileInfo(trace.image).exists())
+		image_file = copyImage(trace.image, dir.path());
+	else {
+		*error = "can't find " + trace.image;
+		return false;
+	}
+
+	MainWindow win;
+	win.show();
+	ImageCanvas * canvas = win.openImage(image_file);
+	if (trace.pen > 0)
+		win.spinbox_pen_size->setValue(trace.pen);
+	win.spinbox_scale->setValue(trace.scale);
+	if (trace.label >= 0)
+		canvas->setId(trace.label);
+	for (const QString &mode : trace.modes) {
+		QAction * action = modeAction(&win, mode);
+		if (action == NULL) {
+			*error = trace_file + " : unknown mode " + mode;
+			return false;
+		}
+		action->setChecked(true);
+	}
+	// the background work of the loading (superpixels, edge map, ...) is not timed
+	QThreadPool::globalInstance()->waitForDone();
+	QCoreApplication::processEvents();
+	canvas->repaint();
+
+	result->memory_before = currentMemoryKb();
+	QElapsedTimer clock, timer;
+	clock.start();
+	qint64 last_frame = trace.events.isEmpty() ? 0 : trace.events.front().ms;
+	for (const InputEvent &event : trace.events) {
+		if (event.ms - last_frame >= REPLAY_FRAME_MS) {
+			timer.start();
+			canvas->repaint();
+			result->paint.ns.push_back(timer.nsecsElapsed());
+			last_frame = event.ms;
+		}
+		timer.start();
+		dispatch(canvas, event);
+		qint64 ns = timer.nsecsElapsed();
+		result->events[event.type].ns.push_back(ns);
+		result->all_events.ns.push_back(ns);
+	}
+	timer.start();
+	canvas->repaint();
+	result->paint.ns.push_back(timer.nsecsElapsed());
+	result->duration_ms = clock.elapsed();
+	result->memory_after = currentMemoryKb();
+	result->peak_memory = peakMemoryKb();
+
+	for (Timings &timings : result->events)
+		timings.sort();
+	result->all_events.sort();
+	result->paint.sort();
+	canvas->discardJournal();
+	return true;
+}
+
+} // namespace
+
+int runReplayCommand(const QStringList &arguments) {
+	QStringList traces;
+	QString json_file;
+	for (int i = arguments.indexOf("--replay-trace") + 1; i < arguments.size(); i++) {
+		if (arguments[i] == "--json" && i + 1 < arguments.size())
+			json_file = arguments[++i];
+		else
+			traces << arguments[i];
+	}
+	if (traces.isEmpty()) {
+		std::cerr << "usage: PixelAnnotationTool --replay-trace <trace>... [--json <results.json>]" << std::endl;
+		return 2;
+	}
+
+	QJsonArray results;
+	for (const QString &trace : traces) {
+		ReplayResult result;
+		QString error;
+		if (!replay(trace, &result, &error)) {
+			std::cerr << error.toStdString() << std::endl;
+			return 1;
+		}
+		printf("%s : %d events replayed in %lld ms, %d frames\n", QFileInfo(trace).fileName().toUtf8().constData(),
+		       int(result.all_events.ns.size()), (long long)result.duration_ms, int(result.paint.ns.size()));
+		printf("  %-10s %7s %9s %9s %9s %9s\n", "ms", "count", "p50", "p90", "p99", "max");
+		for (int type = 0; type < InputEvent::TYPE_COUNT; type++)
+			result.events[type].print(EVENT_NAMES[type]);
+		result.all_events.print("events");
+		result.paint.print("paint");
+		if (result.peak_memory >= 0)
+			printf("  memory : %lld MB peak", (long long)result.peak_memory / 1024);
+		if (result.memory_before >= 0 && result.memory_after >= 0)
+			printf(", %+lld MB over the replay", (long long)(result.memory_after - result.memory_before) / 1024);
+		printf("\n");
+		fflush(stdout);
+
+		QJsonObject object;
+		object["trace"] = QFileInfo(trace).fileName();
+		object["duration_ms"] = double(result.duration_ms);
+		QJsonObject events;
+		for (int type = 0; type < InputEvent::TYPE_COUNT; type++) {
+			if (!result.events[type].ns.empty())
+				events[EVENT_NAMES[type]] = result.events[type].toJson();
+		}
+		events["all"] = result.all_events.toJson();
+		object["events"] = events;
+		object["paint"] = result.paint.toJson();
+		object["peak_memory_kb"] = double(result.peak_memory);
+		object["memory_growth_kb"] = result.memory_before >= 0 && result.memory_after >= 0 ? double(result.memory_after - result.memory_before) : -1.;
+		results.append(object);
+	}
+
+	if (!json_file.isEmpty()) {
+		QFile file(json_file);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			std::cerr << "can't write " << json_file.toStdString() << std::endl;
+			return 1;
+		}
+		file.write(QJsonDocument(results).toJson());
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class ImageCanvas;
+class MainWindow;
+
+// Mouse, wheel and key input received by a canvas, stored as text so that
+// it can be replayed without a display.
+//   header : "image <file>" (relative to the trace) or "image synthetic <w> <h>",
+//            "scale <s>", "pen <size>", "label <id>", "mode <name>" per checked mode
+//   events : "<ms> <type> <x> <y> <button> <buttons> <modifiers> <value>"
+// type is press, release, dblclick, move, wheel (value : angle delta) or key
+// (value : Qt key code) ; x and y are widget coordinates.
+struct InputEvent {
+	enum Type { PRESS, RELEASE, DOUBLE_CLICK, MOVE, WHEEL, KEY, TYPE_COUNT };
+	qint64 ms       ;
+	Type   type     ;
+	int    x        ;
+	int    y        ;
+	int    button   ;
+	int    buttons  ;
+	int    modifiers;
+	int    value    ;
+};
+
+struct InputTrace {
+	QString             image            ; // empty for a synthetic image
+	int                 synthetic_width  = 0;
+	int                 synthetic_height = 0;
+	double              scale            = 1.;
+	int                 pen              = 0;  // 0 : left as is
+	int                 label            = -1; // -1 : left as is
+	QStringList         modes            ;
+	QVector<InputEvent> events           ;
+
+	bool read(const QString &file, QString *error);
+};
+
+// Writes the input of a canvas to a trace as it comes, through an event filter.
+class InputTraceRecorder : public QObject {
+	Q_OBJECT
+
+public:
+	bool start(const QString &file, MainWindow *ui, ImageCanvas *canvas);
+	void stop();
+	bool isRecording() const { return _file.isOpen(); }
+	int  eventCount() const { return _count; }
+
+protected:
+	bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+	void _write(InputEvent::Type type, int x, int y, int button, int buttons, int modifiers, int value);
+
+	QPointer<ImageCanvas> _canvas;
+	QFile                 _file  ;
+	QElapsedTimer         _clock ;
+	int                   _count = 0;
+};
+
+// Headless benchmark : PixelAnnotationTool --replay-trace <trace>... [--json <results.json>]
+// Each trace is replayed on a copy of its image ; the canvas is painted each
+// time the recorded clock crosses a frame (16 ms). Reports the percentiles of
+// the handling time of each kind of event, of the paint time, and the memory.
+int runReplayCommand(const QStringList &arguments);
+
+#endif // INPUT_TRACE_H
@@ -0,0 +1,264 @@
+#include "instances.h"
+#include "trace.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <QFileInfo>
+#include <QDir>
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+
+namespace {
+
+int findRoot(std::vector<int> &parent, int i) {
+	int root = i;
+	while (parent[root] != root)
+		root = parent[root];
+	while (parent[i] != root) {
+		int next = parent[i];
+		parent[i] = root;
+		i = next;
+	}
+	return root;
+}
+
+// The smallest label becomes the root, so that roots come first in raster order.
+int unite(std::vector<int> &parent, int a, int b) {
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if (a < b) { parent[b] = a; return a; }
+	parent[a] = b;
+	return b;
+}
+
+struct Stripes {
+	int count, rows;
+	int begin(int s) const { return s * rows / count; }
+	int end(int s) const { return (s + 1) * rows / count; }
+};
+
+// First pass : provisional labels local to each stripe.
+class LabelStripes : public cv::ParallelLoopBody {
+public:
+	LabelStripes(const cv::Mat &class_id, const Stripes &stripes, cv::Mat &labels, std::vector<std::vector<int> > &parents) :
+		_class_id(class_id), _stripes(stripes), _labels(labels), _parents(parents) {}
+
+	void operator()(const cv::Range &range) const override {
+		const int cols = _class_id.cols;
+		for (int s = range.start; s < range.end; s++) {
+			std::vector<int> & parent = _parents[s];
+			parent.assign(1, 0);
+			for (int y = _stripes.begin(s); y < _stripes.end(s); y++) {
+				const ushort * c = _class_id.ptr<ushort>(y);
+				const ushort * cu = y > _stripes.begin(s) ? _class_id.ptr<ushort>(y - 1) : NULL;
+				int * l = _labels.ptr<int>(y);
+				const int * lu = cu != NULL ? _labels.ptr<int>(y - 1) : NULL;
+				for (int x = 0; x < cols; x++) {
+					const ushort v = c[x];
+					if (v == 0) { l[x] = 0; continue; }
+					int label = (x > 0 && c[x - 1] == v) ? l[x - 1] : 0;
+					if (cu != NULL) {
+						for (int nx = std::max(0, x - 1); nx <= std::min(cols - 1, x + 1); nx++) {
+							if (cu[nx] != v) continue;
+							label = label ? unite(parent, label, lu[nx]) : lu[nx];
+						}
+					}
+					if (label == 0) {
+						label = int(parent.size());
+						parent.push_back(label);
+					}
+					l[x] = label;
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat                  & _class_id;
+	Stripes                          _stripes ;
+	cv::Mat                        & _labels  ;
+	std::vector<std::vector<int> > & _parents ;
+};
+
+// Second pass : provisional labels to final ones.
+class RelabelStripes : public cv::ParallelLoopBody {
+public:
+	RelabelStripes(const Stripes &stripes, const std::vector<int> &offsets, const std::vector<int> &final_labels, cv::Mat &labels) :
+		_stripes(stripes), _offsets(offsets), _final(final_labels), _labels(labels) {}
+
+	void operator()(const cv::Range &range) const override {
+		for (int s = range.start; s < range.end; s++) {
+			const int offset = _offsets[s];
+			for (int y = _stripes.begin(s); y < _stripes.end(s); y++) {
+				int * l = _labels.ptr<int>(y);
+				for (int x = 0; x < _labels.cols; x++) {
+					if (l[x] != 0)
+						l[x] = _final[offset + l[x]];
+				}
+			}
+		}
+	}
+
+private:
+	Stripes                  _stripes;
+	const std::vector<int> & _offsets;
+	const std::vector<int> & _final  ;
+	cv::Mat                & _labels ;
+};
+
+} // namespace
+
+cv::Mat connectedLabels(const cv::Mat &class_id, int *count) {
+	PAT_TRACE_SCOPE("connectedLabels");
+	CV_Assert(class_id.type() == CV_16UC1);
+	cv::Mat labels(class_id.size(), CV_32S);
+	Stripes stripes = { std::max(1, std::min(class_id.rows / 32, cv::getNumThreads() * 2)), class_id.rows };
+	std::vector<std::vector<int> > parents(stripes.count);
+	cv::parallel_for_(cv::Range(0, stripes.count), LabelStripes(class_id, stripes, labels, parents));
+
+	// labels of stripe s are offsets[s] + local label in the global union-find
+	std::vector<int> offsets(stripes.count, 0);
+	int total = 1;
+	for (int s = 0; s < stripes.count; s++) {
+		offsets[s] = total - 1;
+		total += int(parents[s].size()) - 1;
+	}
+	std::vector<int> parent(total);
+	parent[0] = 0;
+	for (int s = 0; s < stripes.count; s++) {
+		for (int i = 1; i < int(parents[s].size()); i++)
+			parent[offsets[s] + i] = offsets[s] + findRoot(parents[s], i);
+	}
+	for (int s = 1; s < stripes.count; s++) {
+		const int y = stripes.begin(s);
+		const ushort * c = class_id.ptr<ushort>(y);
+		const ushort * cu = class_id.ptr<ushort>(y - 1);
+		const int * l = labels.ptr<int>(y);
+		const int * lu = labels.ptr<int>(y - 1);
+		const int above = s - 1; // stripes have at least 32 rows, none is empty
+		for (int x = 0; x < class_id.cols; x++) {
+			if (c[x] == 0) continue;
+			for (int nx = std::max(0, x - 1); nx <= std::min(class_id.cols - 1, x + 1); nx++) {
+				if (cu[nx] == c[x])
+					unite(parent, offsets[s] + l[x], offsets[above] + lu[nx]);
+			}
+		}
+	}
+
+	// roots are the smallest label of their set, so they are numbered first
+	std::vector<int> final_labels(total, 0);
+	int next = 0;
+	for (int i = 1; i < total; i++) {
+		int root = findRoot(parent, i);
+		final_labels[i] = root == i ? ++next : final_labels[root];
+	}
+	cv::parallel_for_(cv::Range(0, stripes.count), RelabelStripes(stripes, offsets, final_labels, labels));
+	if (count != NULL)
+		*count = next;
+	return labels;
+}
+
+cv::Mat instanceIds(const cv::Mat &class_id, const cv::Mat &previous) {
+	PAT_TRACE_SCOPE("instanceIds");
+	int count = 0;
+	cv::Mat components = connectedLabels(class_id, &count);
+	const bool has_previous = previous.size() == class_id.size() && previous.type() == CV_32S;
+
+	// class of each component, and pixels shared with each previous instance
+	std::vector<int> component_class(count + 1, 0);
+	QHash<QPair<int, int>, qint64> overlap;
+	for (int y = 0; y < components.rows; y++) {
+		const int * comp = components.ptr<int>(y);
+		const ushort * cls = class_id.ptr<ushort>(y);
+		const int * prev = has_previous ? previous.ptr<int>(y) : NULL;
+		int x = 0;
+		while (x < components.cols) {
+			const int c = comp[x], p = prev != NULL ? prev[x] : 0;
+			const int start = x;
+			while (x < components.cols && comp[x] == c && (prev == NULL || prev[x] == p))
+				x++;
+			if (c == 0) continue;
+			component_class[c] = cls[start];
+			if (p != 0 && p / INSTANCE_CLASS_FACTOR == cls[start])
+				overlap[qMakePair(c, p)] += x - start;
+		}
+	}
+
+	std::vector<std::pair<qint64, QPair<int, int> > > matches;
+	for (QHash<QPair<int, int>, qint64>::const_iterator it = overlap.begin(); it != overlap.end(); ++it)
+		matches.push_back(std::make_pair(it.value(), it.key()));
+	std::sort(matches.begin(), matches.end(), [](const std::pair<qint64, QPair<int, int> > &a, const std::pair<qint64, QPair<int, int> > &b) {
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	});
+	std::vector<int> assigned(count + 1, 0);
+	QSet<int> taken;
+	for (size_t i = 0; i < matches.size(); i++) {
+		const int c = matches[i].second.first, p = matches[i].second.second;
+		if (assigned[c] != 0 || taken.contains(p))
+			continue;
+		assigned[c] = p;
+		taken.insert(p);
+	}
+	QHash<int, int> next_index;
+	for (int c = 1; c <= count; c++) {
+		if (assigned[c] != 0)
+			continue;
+		const int base = component_class[c] * INSTANCE_CLASS_FACTOR;
+		int index = next_index.value(component_class[c], 0);
+		while (taken.contains(base + index))
+			index++;
+		assigned[c] = base + index;
+		taken.insert(base + index);
+		next_index[component_class[c]] = index + 1;
+	}
+
+	for (int y = 0; y < components.rows; y++) {
+		int * comp = components.ptr<int>(y);
+		for (int x = 0; x < components.cols; x++)
+			comp[x] = assigned[comp[x]];
+	}
+	return components;
+}
+
+QString instanceFile(const QString &image_file) {
+	QFileInfo file(image_file);
+	return file.dir().absolutePath() + "/" + file.baseName() + "_instanceIds.png";
+}
+
+bool saveInstanceIds(const QString &file, const cv::Mat &ids) {
+	double max_id = 0;
+	cv::minMaxLoc(ids, NULL, &max_id);
+	if (max_id > 65535)
+		return false;
+	cv::Mat ids16;
+	ids.convertTo(ids16, CV_16U);
+	return cv::imwrite(file.toStdString(), ids16);
+}
+
+cv::Mat loadInstanceIds(const QString &file) {
+	if (!QFileInfo(file).exists())
+		return cv::Mat();
+	cv::Mat ids = cv::imread(file.toStdString(), cv::IMREAD_UNCHANGED);
+	if (ids.empty() || ids.channels() != 1)
+		return cv::Mat();
+	cv::Mat ids32;
+	ids.convertTo(ids32, CV_32S);
+	return ids32;
+}
+
+QImage instanceBoundaries(const cv::Mat &ids, QRgb color) {
+	QImage image(ids.cols, ids.rows, QImage::Format_ARGB32_Premultiplied);
+	image.fill(Qt::transparent);
+	for (int y = 0; y < ids.rows; y++) {
+		const int * line = ids.ptr<int>(y);
+		const int * next = ids.ptr<int>(std::min(y + 1, ids.rows - 1));
+		QRgb * out = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < ids.cols; x++) {
+			if ((x + 1 < ids.cols && line[x] != line[x + 1]) || line[x] != next[x])
+				out[x] = color;
+		}
+	}
+	return image;
+}
@@ -0,0 +1,29 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+#include <QImage>
+
+// Instance layer of a mask, with the Cityscapes instanceIds encoding :
+// class id * 1000 + index of the instance in its class, 0 where unlabeled.
+static const int INSTANCE_CLASS_FACTOR = 1000;
+
+// 8-connected components of the pixels of the same non zero id of a
+// CV_16UC1 class plane. Two-pass union-find, the rows being labeled by
+// stripes in parallel and the stripes merged along their borders.
+// Returns a CV_32S plane numbered from 1 in raster order.
+cv::Mat connectedLabels(const cv::Mat &class_id, int *count = NULL);
+
+// Splits the classes into instances. A component keeps the id of the
+// previous instance it overlaps the most (same class, each id used once),
+// the others get the lowest free index of their class.
+cv::Mat instanceIds(const cv::Mat &class_id, const cv::Mat &previous = cv::Mat());
+
+QString instanceFile(const QString &image_file);
+// 16-bit png; fails if an id does not fit (class id > 65).
+bool saveInstanceIds(const QString &file, const cv::Mat &ids);
+cv::Mat loadInstanceIds(const QString &file);
+QImage instanceBoundaries(const cv::Mat &ids, QRgb color);
+
+#endif // INSTANCES_H
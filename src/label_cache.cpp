@@ -0,0 +1,130 @@
+#include "label_cache.h"
+#include "dataset_index.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+
+#include <cstring>
+
+static const char   CACHE_MAGIC[4] = { 'P', 'A', 'T', 'L' };
+static const quint32 CACHE_VERSION = 2;
+static const qint64  HEADER_SIZE   = 4096; // keeps the plane page aligned
+
+const qint64 LabelPlaneCache::MAX_BYTES = qint64(2) << 30;
+
+struct CacheHeader {
+	char    magic[4] ;
+	quint32 version  ;
+	qint32  width    ;
+	qint32  height   ;
+	qint64  png_mtime;
+	qint64  png_size ;
+	char    palette[32]; // hex md5 of the palette of the color plane
+	qint32  color_stride; // 0 without color plane
+	qint32  reserved ;
+};
+
+static bool cache_enabled = true;
+
+void LabelPlaneCache::setEnabled(bool enabled) {
+	cache_enabled = enabled;
+}
+
+bool LabelPlaneCache::enabled() {
+	return cache_enabled;
+}
+
+QString LabelPlaneCache::cacheFile(const QString &png_file) {
+	return annotationCacheFile(png_file, ".raw");
+}
+
+static CacheHeader makeHeader(const QFileInfo &png, int width, int height) {
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.png_mtime = png.lastModified().toMSecsSinceEpoch();
+	header.png_size = png.size();
+	return header;
+}
+
+// the color plane starts on the page following the label plane
+static qint64 colorOffset(const CacheHeader &header) {
+	qint64 end = HEADER_SIZE + qint64(header.width) * header.height * sizeof(ushort);
+	return (end + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+}
+
+cv::Mat LabelPlaneCache::map(const QString &png_file, std::shared_ptr<QFile> &mapping, const QByteArray &palette_hash, QImage *color) {
+	if (!cache_enabled)
+		return cv::Mat();
+	std::shared_ptr<QFile> file(new QFile(cacheFile(png_file)));
+	if (!file->open(QIODevice::ReadOnly))
+		return cv::Mat();
+
+	CacheHeader header;
+	if (file->read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header)))
+		return cv::Mat();
+	CacheHeader expected = makeHeader(QFileInfo(png_file), header.width, header.height);
+	memcpy(expected.palette, header.palette, sizeof(header.palette));
+	expected.color_stride = header.color_stride;
+	if (memcmp(&header, &expected, sizeof(header)) != 0 || header.width <= 0 || header.height <= 0)
+		return cv::Mat();
+	qint64 plane_size = qint64(header.width) * header.height * sizeof(ushort);
+	qint64 color_size = qint64(header.color_stride) * header.height;
+	qint64 file_size = header.color_stride > 0 ? colorOffset(header) + color_size : HEADER_SIZE + plane_size;
+	if (header.color_stride < 0 || file->size() != file_size)
+		return cv::Mat();
+
+	uchar * data = file->map(HEADER_SIZE, plane_size, QFileDevice::MapPrivateOption);
+	if (data == NULL)
+		return cv::Mat();
+	if (color != NULL && header.color_stride >= 3 * header.width && palette_hash.size() == int(sizeof(header.palette))
+			&& memcmp(header.palette, palette_hash.constData(), sizeof(header.palette)) == 0) {
+		uchar * color_data = file->map(colorOffset(header), color_size, QFileDevice::MapPrivateOption);
+		if (color_data != NULL)
+			*color = QImage(color_data, header.width, header.height, header.color_stride, QImage::Format_RGB888);
+	}
+	touchCacheFile(*file);
+	mapping = file;
+	return cv::Mat(header.height, header.width, CV_16UC1, data);
+}
+
+bool LabelPlaneCache::store(const QString &png_file, const cv::Mat &id, const QImage &color, const QByteArray &palette_hash) {
+	if (!cache_enabled || id.empty() || id.type() != CV_16UC1)
+		return false;
+	QString file_name = cacheFile(png_file);
+	QDir().mkpath(QFileInfo(file_name).absolutePath());
+	QSaveFile file(file_name);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	bool with_color = !color.isNull() && color.format() == QImage::Format_RGB888 && color.size() == QSize(id.cols, id.rows)
+		&& palette_hash.size() == int(sizeof(CacheHeader::palette));
+	QByteArray header(int(HEADER_SIZE), '\0');
+	CacheHeader h = makeHeader(QFileInfo(png_file), id.cols, id.rows);
+	if (with_color) {
+		memcpy(h.palette, palette_hash.constData(), sizeof(h.palette));
+		h.color_stride = color.bytesPerLine();
+	}
+	memcpy(header.data(), &h, sizeof(h));
+	file.write(header);
+	for (int y = 0; y < id.rows; y++)
+		file.write(reinterpret_cast<const char*>(id.ptr<ushort>(y)), id.cols * sizeof(ushort));
+	if (with_color) {
+		file.write(QByteArray(int(colorOffset(h) - HEADER_SIZE - qint64(id.total()) * sizeof(ushort)), '\0'));
+		for (int y = 0; y < color.height(); y++)
+			file.write(reinterpret_cast<const char*>(color.constScanLine(y)), color.bytesPerLine());
+	}
+	if (!file.commit())
+		return false;
+	prune(QFileInfo(png_file).absolutePath());
+	return true;
+}
+
+void LabelPlaneCache::prune(const QString &dir) {
+	pruneAnnotationCache(dir, "*.raw", MAX_BYTES);
+}
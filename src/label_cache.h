@@ -0,0 +1,36 @@
+#ifndef LABEL_CACHE_H
+#define LABEL_CACHE_H
+
+#include <QString>
+#include <QFile>
+#include <QImage>
+#include <QByteArray>
+#include <opencv2/core/core.hpp>
+#include <memory>
+
+// On-disk cache of decoded label planes : <dir>/.pixel_annotation/<mask>.raw
+// holds a page sized header (png mtime and size, plane size) followed by
+// the raw CV_16UC1 plane, which is memory mapped instead of decoding the png.
+// The color plane rendered from it follows, tagged with the hash of its
+// palette, so reopening a mask with the same palette doesn't recolor it.
+// The mapping is private (copy on write), so a mapped plane can be edited.
+// The cache of a directory is capped at MAX_BYTES, the least recently used
+// files being removed first.
+class LabelPlaneCache {
+public:
+	static const qint64 MAX_BYTES;
+
+	static void setEnabled(bool enabled);
+	static bool enabled();
+	static QString cacheFile(const QString &png_file);
+	// Empty when the cache is disabled, missing or stale. The returned plane
+	// is only valid as long as mapping is kept alive. color is set to the
+	// mapped color plane when it was rendered with palette_hash.
+	static cv::Mat map(const QString &png_file, std::shared_ptr<QFile> &mapping, const QByteArray &palette_hash = QByteArray(), QImage *color = NULL);
+	// color may be null, or rendered with the palette of palette_hash
+	static bool store(const QString &png_file, const cv::Mat &id, const QImage &color = QImage(), const QByteArray &palette_hash = QByteArray());
+	// Removes the least recently used files of the cache of dir past MAX_BYTES.
+	static void prune(const QString &dir);
+};
+
+#endif // LABEL_CACHE_H
@@ -0,0 +1,36 @@
+#include "label_coverage.h"
+
+#include <QPixmap>
+#include <QIcon>
+
+LabelCoverageWidget::LabelCoverageWidget(QWidget *parent) : QTreeWidget(parent) {
+	setColumnCount(3);
+	setHeaderLabels(QStringList() << tr("Label") << tr("Pixels") << tr("%"));
+	setRootIsDecorated(false);
+	setSelectionMode(QAbstractItemView::NoSelection);
+}
+
+void LabelCoverageWidget::setMask(const ImageMask &mask, const Id2Labels &id_labels) {
+	clear();
+	if (mask.isNull())
+		return;
+	const double total = double(mask.id.total());
+	QList<QTreeWidgetItem*> items;
+	for (int id = 1; id < int(mask.label_pixels.size()); id++) {
+		qint64 pixels = mask.label_pixels[id];
+		if (pixels == 0)
+			continue;
+		const LabelInfo * label = id_labels.find(id);
+		QTreeWidgetItem * item = new QTreeWidgetItem();
+		QPixmap swatch(12, 12);
+		swatch.fill(label != NULL ? label->color : QColor(Qt::white));
+		item->setIcon(0, QIcon(swatch));
+		item->setText(0, label != NULL ? label->name : QString("#%1").arg(id));
+		item->setText(1, QString::number(pixels));
+		item->setText(2, QString::number(100. * pixels / total, 'f', 2));
+		item->setTextAlignment(1, Qt::AlignRight);
+		item->setTextAlignment(2, Qt::AlignRight);
+		items << item;
+	}
+	addTopLevelItems(items);
+}
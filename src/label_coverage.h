@@ -0,0 +1,19 @@
+#ifndef LABEL_COVERAGE_H
+#define LABEL_COVERAGE_H
+
+#include <QTreeWidget>
+#include "image_mask.h"
+#include "labels.h"
+
+// Pixels and share of the image of each label of a mask. It only reads the
+// counts the mask keeps up to date, so refreshing it never scans the mask.
+class LabelCoverageWidget : public QTreeWidget {
+	Q_OBJECT
+
+public:
+	LabelCoverageWidget(QWidget *parent = Q_NULLPTR);
+
+	void setMask(const ImageMask &mask, const Id2Labels &id_labels);
+};
+
+#endif // LABEL_COVERAGE_H
@@ -0,0 +1,61 @@
+#include "label_morphology.h"
+#include "utils.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+
+namespace {
+
+// Background pixels not reachable from the border (4-connected) are holes.
+cv::Mat fillHoles(const cv::Mat &binary) {
+	cv::Mat outside;
+	cv::copyMakeBorder(binary, outside, 1, 1, 1, 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+	cv::floodFill(outside, cv::Point(0, 0), cv::Scalar(255));
+	cv::Mat holes = outside(cv::Rect(1, 1, binary.cols, binary.rows)) == 0;
+	return binary | holes;
+}
+
+} // namespace
+
+MorphologyResult morphLabel(const cv::Mat &labels, cv::Rect roi, ushort label_id, LabelMorphology op, int radius) {
+	MorphologyResult result;
+	const cv::Rect image(0, 0, labels.cols, labels.rows);
+	roi &= image;
+	if (roi.area() == 0 || label_id == 0)
+		return result;
+	radius = std::max(1, radius);
+
+	// opening and closing chain two passes, each reading radius pixels away
+	int margin = radius;
+	if (op == LABEL_OPEN || op == LABEL_CLOSE)
+		margin = 2 * radius;
+	else if (op == LABEL_FILL_HOLES)
+		margin = 0;
+	cv::Rect context(roi.x - margin, roi.y - margin, roi.width + 2 * margin, roi.height + 2 * margin);
+	context &= image;
+
+	cv::Mat binary = labels(context) == double(label_id);
+	cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * radius + 1, 2 * radius + 1));
+	cv::Mat shaped;
+	switch (op) {
+	case LABEL_DILATE:     cv::dilate(binary, shaped, kernel); break;
+	case LABEL_ERODE:      cv::erode(binary, shaped, kernel); break;
+	case LABEL_OPEN:       cv::morphologyEx(binary, shaped, cv::MORPH_OPEN, kernel); break;
+	case LABEL_CLOSE:      cv::morphologyEx(binary, shaped, cv::MORPH_CLOSE, kernel); break;
+	case LABEL_FILL_HOLES: shaped = fillHoles(binary); break;
+	}
+
+	cv::Mat before = labels(roi);
+	cv::Mat inside = shaped(cv::Rect(roi.tl() - context.tl(), roi.size()));
+	cv::Mat after = before.clone();
+	after.setTo(cv::Scalar(label_id), inside & (before == 0.));
+	after.setTo(cv::Scalar(0), ~inside & (before == double(label_id)));
+
+	cv::Rect changed = diffRect(before, after);
+	if (changed.area() == 0)
+		return result;
+	result.rect = changed + roi.tl();
+	result.labels = after(changed).clone();
+	return result;
+}
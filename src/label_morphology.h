@@ -0,0 +1,30 @@
+#ifndef LABEL_MORPHOLOGY_H
+#define LABEL_MORPHOLOGY_H
+
+#include <opencv2/core/core.hpp>
+
+enum LabelMorphology {
+	LABEL_DILATE,
+	LABEL_ERODE,
+	LABEL_OPEN,
+	LABEL_CLOSE,
+	LABEL_FILL_HOLES
+};
+
+// New labels (CV_16UC1) of rect, the bounding rect of the pixels an
+// operation changed. rect is empty when nothing changed.
+struct MorphologyResult {
+	cv::Rect rect  ;
+	cv::Mat  labels;
+};
+
+// Applies op to the pixels of label_id of a CV_16UC1 plane, inside roi.
+// The kernel is a square of the given radius, which OpenCV runs as a row
+// and a column pass. Growing (dilate, close, fill holes) only claims
+// unlabeled pixels, so that neighbouring labels are kept ; shrinking
+// (erode, open) leaves the removed pixels unlabeled. The pixels around roi
+// are read so that its border is processed as in the whole image, except
+// for fill holes where the border of roi bounds the holes.
+MorphologyResult morphLabel(const cv::Mat &labels, cv::Rect roi, ushort label_id, LabelMorphology op, int radius);
+
+#endif // LABEL_MORPHOLOGY_H
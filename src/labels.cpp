@@ -7,6 +7,11 @@
 #include <QStandardItemModel>
 #include <QColormap>
 #include <QDebug>
+#include <QSet>
+#include <QFile>
+#include <QJsonDocument>
+
+#include <atomic>
 
 LabelInfo::LabelInfo() {
 	this->name = "unlabeled";
@@ -53,15 +58,33 @@ void LabelInfo::write(QJsonObject &json) const {
 }
 
 
+// Labels already present are updated in place so that pointers to them
+// (Id2Labels, list items, shortcuts) stay valid ; missing ones are removed.
 void Name2Labels::read(const QJsonObject &json) {
 	QJsonObject array = json["labels"].toObject();
+	QSet<QString> names;
 	for (QJsonObject::iterator it = array.begin(); it != array.end(); it++) {
 		QJsonObject object = it->toObject();
-		LabelInfo label;
-		label.read(object);
-		(*this)[label.name] = label;
+		QString name = object["name"].toString();
+		(*this)[name].read(object);
+		names.insert(name);
+	}
+	QMutableMapIterator<QString, LabelInfo> it(*this);
+	while (it.hasNext()) {
+		it.next();
+		if (!names.contains(it.key()))
+			it.remove();
 	}
 }
+
+bool Name2Labels::readFile(const QString &file) {
+	QFile open_file(file);
+	if (!open_file.open(QIODevice::ReadOnly))
+		return false;
+	read(QJsonDocument::fromJson(open_file.readAll()).object());
+	return true;
+}
+
 void Name2Labels::write(QJsonObject &json) const {
 	QMapIterator<QString, LabelInfo> it(*this);
 	QJsonObject object;
@@ -76,12 +99,70 @@ void Name2Labels::write(QJsonObject &json) const {
 }
 
 
+static quint64 nextGeneration() {
+	static std::atomic<quint64> generation(0);
+	return ++generation;
+}
+
+Id2Labels::Id2Labels() {
+	_size = 0;
+	_generation = nextGeneration();
+}
+
+QList<const LabelInfo*> Id2Labels::labels() const {
+	QList<const LabelInfo*> result;
+	for (int id = 0; id < _by_id.size(); id++) {
+		if (_by_id[id] != NULL)
+			result.push_back(_by_id[id]);
+	}
+	return result;
+}
+
+bool Id2Labels::insert(const LabelInfo * label) {
+	if (label->id < 0 || label->id > MAX_LABEL_ID) {
+		qWarning() << "label" << label->name << "has an id out of range [0," << MAX_LABEL_ID << "] :" << label->id;
+		return false;
+	}
+	if (label->id >= _by_id.size()) {
+		int old_size = _by_id.size();
+		_by_id.resize(label->id + 1);
+		_palette.resize(label->id + 1);
+		for (int id = old_size; id < _palette.size(); id++)
+			_palette[id] = qRgb(255, 255, 255);
+	}
+	if (_by_id[label->id] == NULL)
+		_size++;
+	else
+		_by_name.remove(_by_id[label->id]->name);
+	_by_id[label->id] = label;
+	_by_name[label->name] = label;
+	_palette[label->id] = label->color.rgb();
+	_generation = nextGeneration();
+	return true;
+}
+
+void Id2Labels::clear() {
+	_by_id.clear();
+	_by_name.clear();
+	_size = 0;
+	touch();
+}
+
+void Id2Labels::touch() {
+	_palette.fill(qRgb(255, 255, 255), _by_id.size());
+	for (int id = 0; id < _by_id.size(); id++) {
+		if (_by_id[id] != NULL)
+			_palette[id] = _by_id[id]->color.rgb();
+	}
+	_generation = nextGeneration();
+}
+
 Id2Labels getId2Label(const Name2Labels& labels) {
 	Id2Labels id_labels;
 	QMapIterator<QString, LabelInfo> i(labels);
 	while (i.hasNext()) {
 		i.next();
-		id_labels[i.value().id] = &i.value();
+		id_labels.insert(&i.value());
 	}
 	return id_labels;
 }
@@ -4,6 +4,9 @@
 #include <QListWidgetItem>
 #include <QJsonObject>
 #include <QtWidgets/QShortcut>
+#include <QVector>
+#include <QHash>
+#include <QRgb>
 
 class LabelInfo  {
 public:
@@ -23,10 +26,44 @@ public:
 class Name2Labels : public QMap<QString, LabelInfo> {
 public:
 	void read(const QJsonObject &json);
+	bool readFile(const QString &file);
 	void write(QJsonObject &json) const;
 };
 
-class Id2Labels : public QMap<int,const LabelInfo*> { };
+// Label registry used on the hot paths : a dense array indexed by id (up to
+// MAX_LABEL_ID, so 16-bit ids are supported) and a hash index by name.
+// Lookups never insert. The generation changes each time the registry is
+// rebuilt or touched, so that derived caches (color palette...) can be rebuilt.
+class Id2Labels {
+public:
+	static const int MAX_LABEL_ID = 65534; // 65535 is the watershed border
+
+	Id2Labels();
+
+	const LabelInfo * operator[](int id) const { return find(id); }
+	const LabelInfo * find(int id) const {
+		return (id >= 0 && id < _by_id.size()) ? _by_id[id] : NULL;
+	}
+	const LabelInfo * find(const QString &name) const { return _by_name.value(name, NULL); }
+	bool contains(int id) const { return find(id) != NULL; }
+	int  size() const { return _size; }
+	int  maxId() const { return _by_id.size() - 1; }
+	quint64 generation() const { return _generation; }
+	// RGB color of every id in [0, maxId()], white for unknown ids.
+	const QVector<QRgb> & palette() const { return _palette; }
+	QList<const LabelInfo*> labels() const;
+
+	bool insert(const LabelInfo * label);
+	void clear();
+	void touch();
+
+private:
+	QVector<const LabelInfo*>        _by_id     ;
+	QHash<QString, const LabelInfo*> _by_name   ;
+	QVector<QRgb>                    _palette   ;
+	int                              _size      ;
+	quint64                          _generation;
+};
 
 Id2Labels getId2Label(const Name2Labels& labels);
 Name2Labels defaulfLabels();
@@ -0,0 +1,162 @@
+#include "livewire.h"
+#include "dataset_index.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include <algorithm>
+#include <climits>
+
+// the search window spans this far around the anchor and the cursor
+static const int LIVEWIRE_MARGIN = 96;
+static const int LIVEWIRE_MAX_WINDOW = 1536;
+// cached cost maps of a directory, the least recently used are removed past it
+static const qint64 LIVEWIRE_CACHE_MAX_BYTES = qint64(512) << 20;
+
+// 8 neighbours ; straight and diagonal steps weigh 5 and 7 (about 1 : sqrt 2)
+static const int DX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int DY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+static const int STEP[8] = { 5, 7, 5, 7, 5, 7, 5, 7 };
+
+cv::Mat livewireCost(const cv::Mat &bgr) {
+	cv::Mat gray;
+	if (bgr.channels() == 3)
+		cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+	else
+		gray = bgr;
+	cv::GaussianBlur(gray, gray, cv::Size(3, 3), 0);
+
+	cv::Mat dx, dy, magnitude, laplacian;
+	cv::Sobel(gray, dx, CV_32F, 1, 0);
+	cv::Sobel(gray, dy, CV_32F, 0, 1);
+	cv::magnitude(dx, dy, magnitude);
+	double max_magnitude = 0;
+	cv::minMaxLoc(magnitude, NULL, &max_magnitude);
+	cv::Laplacian(gray, laplacian, CV_16S, 3);
+
+	const float scale = max_magnitude > 0 ? float(1. / max_magnitude) : 0.f;
+	cv::Mat cost(gray.size(), CV_8UC1);
+	for (int y = 0; y < gray.rows; y++) {
+		const float * m = magnitude.ptr<float>(y);
+		const short * l = laplacian.ptr<short>(y);
+		const short * next = laplacian.ptr<short>(std::min(y + 1, gray.rows - 1));
+		uchar * out = cost.ptr<uchar>(y);
+		for (int x = 0; x < gray.cols; x++) {
+			// sign change with the right or bottom neighbour
+			bool crossing = (l[x] < 0) != (next[x] < 0) || (x + 1 < gray.cols && (l[x] < 0) != (l[x + 1] < 0));
+			float c = 0.5f * (1.f - m[x] * scale) + (crossing ? 0.f : 0.5f);
+			out[x] = cv::saturate_cast<uchar>(255.f * c);
+		}
+	}
+	return cost;
+}
+
+cv::Mat loadOrComputeLivewireCost(const QString &image_file, const cv::Mat &bgr) {
+	QString cache_file = annotationCacheFile(image_file, ".livewire.png");
+	QFileInfo cache(cache_file);
+	if (cache.exists() && cache.lastModified() >= QFileInfo(image_file).lastModified()) {
+		cv::Mat cached = cv::imread(cache_file.toStdString(), cv::IMREAD_UNCHANGED);
+		if (cached.size() == bgr.size() && cached.type() == CV_8UC1) {
+			QFile file(cache_file);
+			if (file.open(QIODevice::ReadOnly))
+				touchCacheFile(file);
+			return cached;
+		}
+	}
+	cv::Mat cost = livewireCost(bgr);
+	QDir().mkpath(QFileInfo(cache_file).absolutePath());
+	if (cv::imwrite(cache_file.toStdString(), cost))
+		pruneAnnotationCache(QFileInfo(image_file).absolutePath(), "*.livewire.png", LIVEWIRE_CACHE_MAX_BYTES);
+	return cost;
+}
+
+void LivewireSearch::reset(const cv::Mat &cost, cv::Point anchor) {
+	_cost = cost;
+	if (_cost.empty())
+		return;
+	const cv::Rect image(0, 0, _cost.cols, _cost.rows);
+	_anchor.x = std::max(0, std::min(anchor.x, image.width - 1));
+	_anchor.y = std::max(0, std::min(anchor.y, image.height - 1));
+	_restart(cv::Rect(_anchor.x - LIVEWIRE_MARGIN, _anchor.y - LIVEWIRE_MARGIN,
+	                  2 * LIVEWIRE_MARGIN + 1, 2 * LIVEWIRE_MARGIN + 1) & image);
+}
+
+void LivewireSearch::clear() {
+	_cost = cv::Mat();
+	_dist = _parent = _done = cv::Mat();
+	_queue = std::priority_queue<Node, std::vector<Node>, std::greater<Node> >();
+}
+
+void LivewireSearch::_restart(cv::Rect window) {
+	_window = window;
+	_dist.create(window.size(), CV_32S);
+	_dist.setTo(cv::Scalar(INT_MAX));
+	_parent.create(window.size(), CV_8S);
+	_parent.setTo(cv::Scalar(-1));
+	_done = cv::Mat::zeros(window.size(), CV_8U);
+	_queue = std::priority_queue<Node, std::vector<Node>, std::greater<Node> >();
+	cv::Point a = _anchor - window.tl();
+	_dist.at<int>(a) = 0;
+	Node start = { 0, a.y * window.width + a.x };
+	_queue.push(start);
+}
+
+void LivewireSearch::_expandUntil(int target) {
+	const int w = _window.width, h = _window.height;
+	int * dist = _dist.ptr<int>();
+	schar * parent = _parent.ptr<schar>();
+	uchar * done = _done.ptr<uchar>();
+	while (!done[target] && !_queue.empty()) {
+		Node node = _queue.top();
+		_queue.pop();
+		if (done[node.index])
+			continue;
+		done[node.index] = 1;
+		const int x = node.index % w, y = node.index / w;
+		for (int k = 0; k < 8; k++) {
+			const int nx = x + DX[k], ny = y + DY[k];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+				continue;
+			const int ni = ny * w + nx;
+			if (done[ni])
+				continue;
+			const int d = node.dist + STEP[k] * (_cost.at<uchar>(_window.y + ny, _window.x + nx) + 1);
+			if (d < dist[ni]) {
+				dist[ni] = d;
+				parent[ni] = schar(k);
+				Node next = { d, ni };
+				_queue.push(next);
+			}
+		}
+	}
+}
+
+std::vector<cv::Point> LivewireSearch::pathTo(cv::Point target) {
+	std::vector<cv::Point> path;
+	if (_cost.empty())
+		return path;
+	const cv::Rect image(0, 0, _cost.cols, _cost.rows);
+	const cv::Rect limit = cv::Rect(_anchor.x - LIVEWIRE_MAX_WINDOW / 2, _anchor.y - LIVEWIRE_MAX_WINDOW / 2,
+	                                LIVEWIRE_MAX_WINDOW, LIVEWIRE_MAX_WINDOW) & image;
+	target.x = std::max(limit.x, std::min(target.x, limit.x + limit.width - 1));
+	target.y = std::max(limit.y, std::min(target.y, limit.y + limit.height - 1));
+	if (!_window.contains(target)) {
+		cv::Rect around(target.x - LIVEWIRE_MARGIN, target.y - LIVEWIRE_MARGIN, 2 * LIVEWIRE_MARGIN + 1, 2 * LIVEWIRE_MARGIN + 1);
+		_restart((_window | around) & limit);
+	}
+	cv::Point p = target - _window.tl();
+	_expandUntil(p.y * _window.width + p.x);
+	while (true) {
+		path.push_back(p + _window.tl());
+		const int k = _parent.at<schar>(p);
+		if (k < 0)
+			break;
+		p -= cv::Point(DX[k], DY[k]);
+	}
+	std::reverse(path.begin(), path.end());
+	return path;
+}
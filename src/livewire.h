@@ -0,0 +1,53 @@
+#ifndef LIVEWIRE_H
+#define LIVEWIRE_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// Local cost of each pixel of a BGR image for the livewire (intelligent
+// scissors, Mortensen & Barrett 1995) : low on strong gradients and on
+// Laplacian zero crossings. CV_8UC1.
+cv::Mat livewireCost(const cv::Mat &bgr);
+
+// Loads the cost map cached beside the image, or computes and caches it.
+// Meant to run in a worker thread.
+cv::Mat loadOrComputeLivewireCost(const QString &image_file, const cv::Mat &bgr);
+
+// Shortest 8-connected paths from an anchor over a cost map. Dijkstra is
+// expanded lazily : a query stops as soon as its target is settled, and the
+// next one resumes from there. The search is bounded to a window around the
+// anchor and the targets asked so far, grown (and restarted) when a target
+// leaves it, up to a bounded size so that a query stays interactive.
+class LivewireSearch {
+public:
+	void reset(const cv::Mat &cost, cv::Point anchor);
+	void clear();
+	bool empty() const { return _cost.empty(); }
+	cv::Point anchor() const { return _anchor; }
+	// From the anchor to target, both included. A target too far from the
+	// anchor is moved to the border of the largest window.
+	std::vector<cv::Point> pathTo(cv::Point target);
+
+private:
+	struct Node {
+		int dist ;
+		int index;
+		bool operator>(const Node &other) const { return dist > other.dist; }
+	};
+
+	void _restart(cv::Rect window);
+	void _expandUntil(int target);
+
+	cv::Mat   _cost  ; // whole image
+	cv::Point _anchor;
+	cv::Rect  _window;
+	cv::Mat   _dist  ; // CV_32S, of the window size
+	cv::Mat   _parent; // CV_8S, direction each settled pixel was reached from
+	cv::Mat   _done  ; // CV_8U
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node> > _queue;
+};
+
+#endif // LIVEWIRE_H
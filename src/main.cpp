@@ -6,10 +6,45 @@
 #include <QApplication>
 #include <QFile>
 #include "main_window.h"
+#include "dataset_stats.h"
+#include "mask_compare.h"
+#include "box_store.h"
+#include "box_formats.h"
+#include "input_trace.h"
 #include <QtDebug>
 
 int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; i++) {
+        if (QString(argv[i]) == "--stats") {
+            QCoreApplication app(argc, argv);
+            return runStatsCommand(app.arguments());
+        }
+        if (QString(argv[i]) == "--compare") {
+            QCoreApplication app(argc, argv);
+            return runCompareCommand(app.arguments());
+        }
+        if (QString(argv[i]) == "--bench-boxes") {
+            QCoreApplication app(argc, argv);
+            return runBoxBenchmark(app.arguments());
+        }
+        if (QString(argv[i]) == "--bench-labels") {
+            QCoreApplication app(argc, argv);
+            return runLabelBenchmark(app.arguments());
+        }
+        if (QString(argv[i]) == "--convert-boxes") {
+            QCoreApplication app(argc, argv);
+            return runConvertBoxesCommand(app.arguments());
+        }
+        if (QString(argv[i]) == "--replay-trace") {
+            // the canvas is driven and painted without a display
+            if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            QApplication app(argc, argv);
+            return runReplayCommand(app.arguments());
+        }
+    }
+
     QApplication app(argc, argv);
 
 	MainWindow win;
@@ -6,6 +6,7 @@
 #include <QMessageBox>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QStringList>
 #include <QMessageBox>
 #include <QJsonDocument>
@@ -14,9 +15,28 @@
 #include <QJsonArray>
 #include <QColorDialog>
 #include <QTextStream>
+#include <QApplication>
 #include "pixel_annotation_tool_version.h"
 
 #include "about_dialog.h"
+#include "trace.h"
+#include "recolor.h"
+#include "label_cache.h"
+#include "dataset_stats.h"
+#include "mask_compare.h"
+#include <QtConcurrent>
+
+// Tree item sorting its statistics columns numerically (value in Qt::UserRole).
+class ImageTreeItem : public QTreeWidgetItem {
+public:
+	ImageTreeItem(QTreeWidgetItem *parent) : QTreeWidgetItem(parent) {}
+	bool operator<(const QTreeWidgetItem &other) const override {
+		int column = treeWidget() ? treeWidget()->sortColumn() : 0;
+		if (column == 0)
+			return QTreeWidgetItem::operator<(other);
+		return data(column, Qt::UserRole).toDouble() < other.data(column, Qt::UserRole).toDouble();
+	}
+};
 
 MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
 	: QMainWindow(parent, flags)
@@ -25,9 +45,16 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
 	setWindowTitle(QApplication::translate("MainWindow", "PixelAnnotationTool " PIXEL_ANNOTATION_TOOL_GIT_TAG, Q_NULLPTR));
 	list_label->setSpacing(1);
     image_canvas = NULL;
+    _recolor_watcher = NULL;
+    _recolor_progress = NULL;
+    _palette_hash_generation = 0;
 	save_action = new QAction(tr("&Save current image"), this);
     copy_mask_action = new QAction(tr("&Copy Mask"), this);
     paste_mask_action = new QAction(tr("&Paste Mask"), this);
+    copy_label_action = new QAction(tr("Copy current &label"), this);
+    paste_at_cursor_action = new QAction(tr("Paste at c&ursor"), this);
+    paste_unlabeled_action = new QAction(tr("Paste only into &unlabeled pixels"), this);
+    paste_unlabeled_action->setCheckable(true);
     clear_mask_action = new QAction(tr("&Clear Mask mask"), this);
     close_tab_action = new QAction(tr("&Close current tab"), this);
     open_dir_action = new QAction(tr("&Open directory"),this);
@@ -40,11 +67,61 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
     swap_action->setShortcut(Qt::CTRL + Qt::Key_Space);
     copy_mask_action->setShortcut(Qt::CTRL + Qt::Key_C);
     paste_mask_action->setShortcut(Qt::CTRL + Qt::Key_V);
+    copy_label_action->setShortcut(Qt::CTRL + Qt::SHIFT + Qt::Key_C);
+    paste_at_cursor_action->setShortcut(Qt::CTRL + Qt::SHIFT + Qt::Key_V);
     clear_mask_action->setShortcut(Qt::CTRL + Qt::Key_R);
     close_tab_action->setShortcut(Qt::CTRL + Qt::Key_W);
     open_dir_action->setShortcut(Qt::CTRL + Qt::Key_O);
 	undo_action->setEnabled(false);
 	redo_action->setEnabled(false);
+    superpixel_action = new QAction(tr("Super&pixel brush"), this);
+    superpixel_action->setCheckable(true);
+    superpixel_action->setShortcut(Qt::Key_S);
+    polygon_action = new QAction(tr("P&olygon tool"), this);
+    polygon_action->setCheckable(true);
+    polygon_action->setShortcut(Qt::Key_P);
+    livewire_action = new QAction(tr("&Livewire (intelligent scissors)"), this);
+    livewire_action->setCheckable(true);
+    livewire_action->setShortcut(Qt::Key_L);
+    sequence_action = new QAction(tr("Propagate masks along frame se&quences"), this);
+    sequence_action->setCheckable(true);
+    instance_action = new QAction(tr("&Instance layer"), this);
+    instance_action->setCheckable(true);
+    next_window_action = new QAction(tr("&Next region of large image"), this);
+    next_window_action->setShortcut(Qt::ALT + Qt::Key_Right);
+    previous_window_action = new QAction(tr("Pre&vious region of large image"), this);
+    previous_window_action->setShortcut(Qt::ALT + Qt::Key_Left);
+    dilate_action = new QAction(tr("&Dilate"), this);
+    dilate_action->setShortcut(Qt::CTRL + Qt::ALT + Qt::Key_D);
+    erode_action = new QAction(tr("&Erode"), this);
+    erode_action->setShortcut(Qt::CTRL + Qt::ALT + Qt::Key_E);
+    opening_action = new QAction(tr("&Open (remove specks)"), this);
+    opening_action->setShortcut(Qt::CTRL + Qt::ALT + Qt::Key_O);
+    closing_action = new QAction(tr("&Close (join gaps)"), this);
+    closing_action->setShortcut(Qt::CTRL + Qt::ALT + Qt::Key_C);
+    fill_holes_action = new QAction(tr("&Fill holes"), this);
+    fill_holes_action->setShortcut(Qt::CTRL + Qt::ALT + Qt::Key_F);
+    refine_box_action = new QAction(tr("&GrabCut selected box"), this);
+    refine_box_action->setShortcut(Qt::Key_G);
+    refine_all_boxes_action = new QAction(tr("GrabCut &all boxes"), this);
+    refine_all_boxes_action->setShortcut(Qt::SHIFT + Qt::Key_G);
+    recolor_action = new QAction(tr("&Recolor all masks of the directory"), this);
+    stats_action = new QAction(tr("Dataset &statistics..."), this);
+    coco_action = new QAction(tr("Use C&OCO boxes..."), this);
+    compare_action = new QAction(tr("Compare &with mask..."), this);
+    clear_comparison_action = new QAction(tr("Hide mask comparison"), this);
+    compare_dirs_action = new QAction(tr("Compare &directories..."), this);
+    mask_cache_action = new QAction(tr("&Cache decoded masks"), this);
+    mask_cache_action->setCheckable(true);
+    mask_cache_action->setChecked(LabelPlaneCache::enabled());
+#ifdef PIXEL_ANNOTATION_TRACING
+    perf_overlay_action = new QAction(tr("Show &performance overlay"), this);
+    perf_overlay_action->setCheckable(true);
+    perf_overlay_action->setShortcut(Qt::Key_F12);
+    export_trace_action = new QAction(tr("&Export performance trace..."), this);
+#endif
+    record_input_action = new QAction(tr("Record &input trace..."), this);
+    record_input_action->setCheckable(true);
 
 	menuFile->addAction(save_action);
     menuFile->addAction(open_dir_action);
@@ -53,8 +130,53 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
 	menuEdit->addAction(redo_action);
     menuEdit->addAction(copy_mask_action);
     menuEdit->addAction(paste_mask_action);
+    menuEdit->addAction(copy_label_action);
+    menuEdit->addAction(paste_at_cursor_action);
+    menuEdit->addAction(paste_unlabeled_action);
     menuEdit->addAction(clear_mask_action);
     menuEdit->addAction(swap_action);
+    menuEdit->addAction(next_window_action);
+    menuEdit->addAction(previous_window_action);
+    menuTool->addAction(superpixel_action);
+    menuTool->addAction(polygon_action);
+    menuTool->addAction(livewire_action);
+    menuTool->addAction(sequence_action);
+    menuTool->addAction(instance_action);
+    QMenu * morphology_menu = menuTool->addMenu(tr("&Morphology of current label"));
+    morphology_menu->addAction(dilate_action);
+    morphology_menu->addAction(erode_action);
+    morphology_menu->addAction(opening_action);
+    morphology_menu->addAction(closing_action);
+    morphology_menu->addAction(fill_holes_action);
+    menuTool->addAction(refine_box_action);
+    menuTool->addAction(refine_all_boxes_action);
+    menuTool->addAction(recolor_action);
+    menuTool->addAction(stats_action);
+    menuTool->addAction(coco_action);
+    menuTool->addSeparator();
+    menuTool->addAction(compare_action);
+    menuTool->addAction(clear_comparison_action);
+    menuTool->addAction(compare_dirs_action);
+    menuTool->addAction(mask_cache_action);
+    menuTool->addAction(record_input_action);
+#ifdef PIXEL_ANNOTATION_TRACING
+    menuTool->addSeparator();
+    menuTool->addAction(perf_overlay_action);
+    menuTool->addAction(export_trace_action);
+#endif
+
+	_coverage = new LabelCoverageWidget(this);
+	_coverage_dock = new QDockWidget(tr("Label coverage"), this);
+	_coverage_dock->setObjectName("dock_coverage");
+	_coverage_dock->setWidget(_coverage);
+	addDockWidget(Qt::RightDockWidgetArea, _coverage_dock);
+	menuTool->addAction(_coverage_dock->toggleViewAction());
+	// at most one refresh per 100 ms, whatever the rate of the edits
+	_coverage_timer.setSingleShot(true);
+	_coverage_timer.setInterval(100);
+	// the tree is filtered once the typing pauses, not at every key
+	_filter_timer.setSingleShot(true);
+	_filter_timer.setInterval(250);
 
 	tabWidget->clear();
     
@@ -65,11 +187,29 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
     connect(close_tab_action      , SIGNAL(triggered())                       , this, SLOT(closeCurrentTab()));
     connect(copy_mask_action      , SIGNAL(triggered())                       , this, SLOT(copyMask()));
     connect(paste_mask_action     , SIGNAL(triggered())                       , this, SLOT(pasteMask()));
+    connect(copy_label_action     , SIGNAL(triggered())                       , this, SLOT(copyLabel()));
+    connect(paste_at_cursor_action, SIGNAL(triggered())                       , this, SLOT(pasteMaskAtCursor()));
     connect(clear_mask_action     , SIGNAL(triggered())                       , this, SLOT(clearMask()));
 	connect(tabWidget             , SIGNAL(tabCloseRequested(int))            , this, SLOT(closeTab(int)   ));
 	connect(tabWidget             , SIGNAL(currentChanged(int))               , this, SLOT(updateConnect(int)));
     connect(tree_widget_img       , SIGNAL(itemClicked(QTreeWidgetItem *,int)), this, SLOT(treeWidgetClicked()));
     connect(open_dir_action       , SIGNAL(triggered())                       , this, SLOT(on_actionOpenDir_triggered()));
+#ifdef PIXEL_ANNOTATION_TRACING
+    connect(perf_overlay_action   , SIGNAL(toggled(bool))                     , this, SLOT(update()));
+    connect(export_trace_action   , SIGNAL(triggered())                       , this, SLOT(exportTrace()));
+#endif
+    connect(record_input_action   , SIGNAL(toggled(bool))                     , this, SLOT(recordInputTrace(bool)));
+    connect(recolor_action        , SIGNAL(triggered())                       , this, SLOT(recolorAllMasks()));
+    connect(&_coverage_timer      , SIGNAL(timeout())                         , this, SLOT(updateLabelCoverage()));
+    connect(_coverage_dock        , SIGNAL(visibilityChanged(bool))           , this, SLOT(updateLabelCoverage()));
+    connect(mask_cache_action     , SIGNAL(toggled(bool))                     , this, SLOT(setMaskCacheEnabled(bool)));
+    connect(stats_action          , SIGNAL(triggered())                       , this, SLOT(exportDatasetStats()));
+    connect(coco_action           , SIGNAL(triggered())                       , this, SLOT(openCocoBoxes()));
+    connect(compare_action        , SIGNAL(triggered())                       , this, SLOT(compareMask()));
+    connect(compare_dirs_action   , SIGNAL(triggered())                       , this, SLOT(compareDirectories()));
+    connect(line_edit_filter      , SIGNAL(textChanged(const QString &))      , &_filter_timer, SLOT(start()));
+    connect(&_filter_timer        , SIGNAL(timeout())                         , this, SLOT(filterImages()));
+    tree_widget_img->sortByColumn(0, Qt::AscendingOrder);
     
 	labels = defaulfLabels();
 
@@ -97,6 +237,8 @@ void MainWindow::closeTab(int index) {
             "You will close the current image, Would you like saved image before ?", QMessageBox::Yes | QMessageBox::No);
         if (reply == QMessageBox::Yes) {
             ic->saveMask();
+        } else {
+            ic->discardJournal();
         }
     }
     tabWidget->removeTab(index);
@@ -123,8 +265,10 @@ void MainWindow::loadConfigLabels() {
 		list_label->addItem(item);
 		list_label->setItemWidget(item, label_widget);
 
-		auto& ref = labels[it.key()];
+		LabelInfo & ref = labels[it.key()];
 		ref.item = item;
+		delete ref.shortcut;
+		ref.shortcut = nullptr;
 
 		int id = list_label->row(item);
 		const QString shortcut_key = (id < 9)  ? QString("Ctrl+%1").arg(id + 1) :
@@ -149,12 +293,18 @@ void MainWindow::loadConfigLabels() {
 
 void MainWindow::changeColor(QListWidgetItem* item) {
 	LabelWidget * widget = static_cast<LabelWidget*>(list_label->itemWidget(item));
-	LabelInfo & label = labels[widget->text()];
+	Name2Labels::iterator it = labels.find(widget->getName());
+	if (it == labels.end())
+		return;
+	LabelInfo & label = it.value();
 	QColor color = QColorDialog::getColor(label.color, this);
 	if (color.isValid()) {
 		label.color = color;
 		widget->setNewLabel(label);
+		id_labels.touch();
 	}
+	if (image_canvas == NULL)
+		return;
 	image_canvas->setId(label.id);
 	image_canvas->updateMaskColor(id_labels);
 	image_canvas->refresh();
@@ -181,15 +331,19 @@ void MainWindow::changeLabel(QListWidgetItem* current, QListWidgetItem* previous
 	label->setSelected(true);
 
 	QString str;
-	QString key = label->getName();
+	const LabelInfo * info = id_labels.find(label->getName());
+	if (info == NULL)
+		return;
 	QTextStream sstr(&str);
-	sstr <<"label=["<< key <<"] id=[" << labels[key].id << "] categorie=[" << labels[key].categorie << "] color=[" << labels[key].color.name() << "]" ;
+	sstr <<"label=["<< info->name <<"] id=[" << info->id << "] categorie=[" << info->categorie << "] color=[" << info->color.name() << "]" ;
 	statusBar()->showMessage(str);
-	image_canvas->setId(labels[key].id);
+	if (image_canvas != NULL)
+		image_canvas->setId(info->id);
 }
 
 void MainWindow::runWatershed(ImageCanvas * ic) {
-    QImage iwatershed = watershed(ic->getImage(), ic->getMask().id);
+    PAT_TRACE_SCOPE("runWatershed");
+    cv::Mat iwatershed = watershed(ic->getImage(), ic->getMask().id);
     if (!checkbox_border_ws->isChecked()) {
         iwatershed = removeBorder(iwatershed, id_labels);
     }
@@ -231,7 +385,21 @@ void MainWindow::updateConnect(const ImageCanvas * ic) {
 	connect(redo_action, SIGNAL(triggered()), ic, SLOT(redo()));
 	connect(save_action, SIGNAL(triggered()), ic, SLOT(saveMask()));
     connect(checkbox_border_ws, SIGNAL(clicked()), this, SLOT(runWatershed()));
-    
+    connect(superpixel_action, SIGNAL(toggled(bool)), ic, SLOT(superpixelModeChanged(bool)));
+    connect(sequence_action, SIGNAL(toggled(bool)), ic, SLOT(sequenceModeChanged(bool)));
+    connect(instance_action, SIGNAL(toggled(bool)), ic, SLOT(instanceModeChanged(bool)));
+    connect(next_window_action, SIGNAL(triggered()), ic, SLOT(nextWindow()));
+    connect(previous_window_action, SIGNAL(triggered()), ic, SLOT(previousWindow()));
+    connect(polygon_action, SIGNAL(toggled(bool)), ic, SLOT(polygonModeChanged(bool)));
+    connect(livewire_action, SIGNAL(toggled(bool)), ic, SLOT(livewireModeChanged(bool)));
+    connect(dilate_action, SIGNAL(triggered()), ic, SLOT(dilateLabel()));
+    connect(erode_action, SIGNAL(triggered()), ic, SLOT(erodeLabel()));
+    connect(opening_action, SIGNAL(triggered()), ic, SLOT(openLabel()));
+    connect(closing_action, SIGNAL(triggered()), ic, SLOT(closeLabel()));
+    connect(fill_holes_action, SIGNAL(triggered()), ic, SLOT(fillLabelHoles()));
+    connect(refine_box_action, SIGNAL(triggered()), ic, SLOT(refineSelectedBox()));
+    connect(refine_all_boxes_action, SIGNAL(triggered()), ic, SLOT(refineAllBoxes()));
+    connect(clear_comparison_action, SIGNAL(triggered()), ic, SLOT(clearComparison()));
 }
 
 void MainWindow::allDisconnnect(const ImageCanvas * ic) {
@@ -246,6 +414,21 @@ void MainWindow::allDisconnnect(const ImageCanvas * ic) {
     disconnect(redo_action, SIGNAL(triggered()), ic, SLOT(redo()));
     disconnect(save_action, SIGNAL(triggered()), ic, SLOT(saveMask()));
     disconnect(checkbox_border_ws, SIGNAL(clicked()), this, SLOT(runWatershed()));
+    disconnect(superpixel_action, SIGNAL(toggled(bool)), ic, SLOT(superpixelModeChanged(bool)));
+    disconnect(sequence_action, SIGNAL(toggled(bool)), ic, SLOT(sequenceModeChanged(bool)));
+    disconnect(instance_action, SIGNAL(toggled(bool)), ic, SLOT(instanceModeChanged(bool)));
+    disconnect(next_window_action, SIGNAL(triggered()), ic, SLOT(nextWindow()));
+    disconnect(previous_window_action, SIGNAL(triggered()), ic, SLOT(previousWindow()));
+    disconnect(polygon_action, SIGNAL(toggled(bool)), ic, SLOT(polygonModeChanged(bool)));
+    disconnect(livewire_action, SIGNAL(toggled(bool)), ic, SLOT(livewireModeChanged(bool)));
+    disconnect(dilate_action, SIGNAL(triggered()), ic, SLOT(dilateLabel()));
+    disconnect(erode_action, SIGNAL(triggered()), ic, SLOT(erodeLabel()));
+    disconnect(opening_action, SIGNAL(triggered()), ic, SLOT(openLabel()));
+    disconnect(closing_action, SIGNAL(triggered()), ic, SLOT(closeLabel()));
+    disconnect(fill_holes_action, SIGNAL(triggered()), ic, SLOT(fillLabelHoles()));
+    disconnect(refine_box_action, SIGNAL(triggered()), ic, SLOT(refineSelectedBox()));
+    disconnect(refine_all_boxes_action, SIGNAL(triggered()), ic, SLOT(refineAllBoxes()));
+    disconnect(clear_comparison_action, SIGNAL(triggered()), ic, SLOT(clearComparison()));
 }
 
 ImageCanvas * MainWindow::newImageCanvas() {
@@ -261,11 +444,39 @@ void MainWindow::updateConnect(int index) {
         return;
     allDisconnnect(image_canvas);
     image_canvas = getImageCanvas(index);
+    // the colors changed while the image was in the background
+    if (image_canvas != NULL && image_canvas->getMask().color_generation != id_labels.generation())
+        image_canvas->updateMaskColor(id_labels);
     if(image_canvas!= NULL)
         list_label->setEnabled(true);
     else 
         list_label->setEnabled(false);
 	updateConnect(image_canvas);
+	labelCountsChanged();
+}
+
+// Hash of the palette written in the color masks, computed once per change of the labels.
+const QByteArray & MainWindow::paletteHash() {
+	if (_palette_hash_generation != id_labels.generation()) {
+		_palette_hash = ::paletteHash(id_labels.palette());
+		_palette_hash_generation = id_labels.generation();
+	}
+	return _palette_hash;
+}
+
+void MainWindow::labelCountsChanged() {
+	if (!_coverage_timer.isActive())
+		_coverage_timer.start();
+}
+
+void MainWindow::updateLabelCoverage() {
+	if (!_coverage_dock->isVisible())
+		return;
+	ImageCanvas * ic = getCurrentImageCanvas();
+	if (ic == NULL)
+		_coverage->clear();
+	else
+		_coverage->setMask(ic->getMask(), id_labels);
 }
 
 ImageCanvas * MainWindow::getImageCanvas(int index) {
@@ -336,29 +547,18 @@ void MainWindow::on_actionOpenDir_triggered() {
 	tree_widget_img->setItemExpanded(currentTreeDir, true);
 	currentTreeDir->setText(0, curr_open_dir);
 
-	QDir current_dir(curr_open_dir);
-	QStringList files = current_dir.entryList();
-	static QStringList ext_img = { "png","jpg","bmp","pgm","jpeg" ,"jpe" ,"jp2" ,"pbm" ,"ppm" ,"tiff" ,"tif" };
-	for (int i = 0; i < files.size(); i++) {
-		if (files[i].size() < 4)
-			continue;
-		QString ext = files[i].section(".", -1, -1);
-		bool is_image = false;
-		for (int e = 0; e < ext_img.size(); e++) {
-			if (ext.toLower() == ext_img[e]) {
-				is_image = true;
-				break;
-			}
-		}
-		if (!is_image)
-			continue;
+	DatasetIndex * index = datasetIndex(curr_open_dir);
+	tree_widget_img->setSortingEnabled(false);
 
-		if( files[i].toLower().indexOf("_mask.png") > -1)
-			continue;
-
-		QTreeWidgetItem *currentFile = new QTreeWidgetItem(currentTreeDir);
+	QStringList files = imageFiles(curr_open_dir);
+	for (int i = 0; i < files.size(); i++) {
+		QTreeWidgetItem *currentFile = new ImageTreeItem(currentTreeDir);
 		currentFile->setText(0, files[i]);
+		_setIndexColumns(currentFile, index->find(files[i]));
 	}
+	tree_widget_img->setSortingEnabled(true);
+	filterImages();
+	_scanDatasetIndex(curr_open_dir);
 //	setWindowTitle("PixelAnnotation - " + openedDir);
 }
 
@@ -388,7 +588,12 @@ void MainWindow::loadConfigFile() {
 	QByteArray saveData = open_file.readAll();
 	QJsonDocument loadDoc(QJsonDocument::fromJson(saveData));
 
-	labels.clear();
+	// labels are updated in place : pointers to the labels kept are still valid
+	id_labels.clear();
+	for (Name2Labels::iterator it = labels.begin(); it != labels.end(); ++it) {
+		delete it.value().shortcut;
+		it.value().shortcut = nullptr;
+	}
 	labels.read(loadDoc.object());
 	open_file.close();
 
@@ -408,8 +613,17 @@ void MainWindow::copyMask() {
     if (ic == NULL)
         return;
 
-    _tmp = ic->getMask();
+    _clip = ic->copyRegion(false);
+    statusBar()->showMessage(tr("Copied %1 runs (%2 KB)").arg(_clip.runCount()).arg(_clip.byteSize() / 1024), 3000);
+}
 
+void MainWindow::copyLabel() {
+    ImageCanvas * ic = getCurrentImageCanvas();
+    if (ic == NULL)
+        return;
+
+    _clip = ic->copyRegion(true);
+    statusBar()->showMessage(tr("Copied %1 runs (%2 KB)").arg(_clip.runCount()).arg(_clip.byteSize() / 1024), 3000);
 }
 
 void MainWindow::pasteMask() {
@@ -417,7 +631,15 @@ void MainWindow::pasteMask() {
     if (ic == NULL)
         return;
 
-    ic->setActionMask(_tmp);
+    ic->pasteClip(_clip, false, paste_unlabeled_action->isChecked() ? MaskClip::INTO_UNLABELED : MaskClip::OVERWRITE);
+}
+
+void MainWindow::pasteMaskAtCursor() {
+    ImageCanvas * ic = getCurrentImageCanvas();
+    if (ic == NULL)
+        return;
+
+    ic->pasteClip(_clip, true, paste_unlabeled_action->isChecked() ? MaskClip::INTO_UNLABELED : MaskClip::OVERWRITE);
 }
 
 void MainWindow::clearMask() {
@@ -425,7 +647,7 @@ void MainWindow::clearMask() {
     if (ic == NULL)
         return;
 
-    ImageMask clear(QSize(ic->width(),ic->height()));
+    ImageMask clear(ic->getImage().size());
     ic->setActionMask(clear);
 }
 
@@ -456,3 +678,315 @@ void MainWindow::onLabelShortcut(int row) {
         update();
     }
 }
+
+MainWindow::~MainWindow() {
+    qDeleteAll(_dataset_indexes);
+}
+
+DatasetIndex * MainWindow::datasetIndex(const QString &dir) {
+    QString key = QDir(dir).absolutePath();
+    QMap<QString, DatasetIndex*>::iterator it = _dataset_indexes.find(key);
+    if (it != _dataset_indexes.end())
+        return it.value();
+    DatasetIndex * index = new DatasetIndex(key);
+    index->load();
+    _dataset_indexes[key] = index;
+    return index;
+}
+
+void MainWindow::updateDatasetIndex(const QString &image_file, const ImageIndexEntry &entry) {
+    QFileInfo file(image_file);
+    QString dir = file.dir().absolutePath();
+    datasetIndex(dir)->update(entry);
+
+    for (int i = 0; i < tree_widget_img->topLevelItemCount(); i++) {
+        QTreeWidgetItem * tree_dir = tree_widget_img->topLevelItem(i);
+        if (QDir(tree_dir->text(0)) != QDir(dir))
+            continue;
+        for (int j = 0; j < tree_dir->childCount(); j++) {
+            if (tree_dir->child(j)->text(0) == entry.image)
+                _setIndexColumns(tree_dir->child(j), &entry);
+        }
+    }
+}
+
+// Indexes the masks annotated before the index existed, or out of the tool,
+// in the background ; the tree is updated when the scan is done.
+void MainWindow::_scanDatasetIndex(const QString &dir) {
+    DatasetIndex * index = datasetIndex(dir);
+    QStringList stale = index->staleImages();
+    if (stale.isEmpty())
+        return;
+    QFutureWatcher<ImageIndexEntry> * watcher = new QFutureWatcher<ImageIndexEntry>(this);
+    connect(watcher, &QFutureWatcher<ImageIndexEntry>::finished, this, [=] {
+        watcher->deleteLater();
+        int indexed = index->addScanned(watcher->future().results());
+        if (indexed == 0)
+            return;
+        tree_widget_img->setSortingEnabled(false);
+        for (int i = 0; i < tree_widget_img->topLevelItemCount(); i++) {
+            QTreeWidgetItem * tree_dir = tree_widget_img->topLevelItem(i);
+            if (QDir(tree_dir->text(0)) != QDir(index->dir()))
+                continue;
+            for (int j = 0; j < tree_dir->childCount(); j++)
+                _setIndexColumns(tree_dir->child(j), index->find(tree_dir->child(j)->text(0)));
+        }
+        tree_widget_img->setSortingEnabled(true);
+        filterImages();
+        statusBar()->showMessage(tr("%1 annotated images added to the index").arg(indexed));
+    });
+    statusBar()->showMessage(tr("Indexing %1 annotated images...").arg(stale.size()));
+    watcher->setFuture(index->scan(stale));
+}
+
+void MainWindow::_setIndexColumns(QTreeWidgetItem *item, const ImageIndexEntry *entry) {
+    if (entry == NULL) {
+        item->setText(1, QString());
+        item->setText(2, QString());
+        item->setData(1, Qt::UserRole, -1.);
+        item->setData(2, Qt::UserRole, -1);
+        return;
+    }
+    double coverage = entry->coverage();
+    item->setText(1, QString::number(100. * coverage, 'f', 1) + "%");
+    item->setData(1, Qt::UserRole, coverage);
+    item->setText(2, QString::number(entry->boxCount()));
+    item->setData(2, Qt::UserRole, entry->boxCount());
+}
+
+bool MainWindow::_matchFilter(const ImageIndexEntry *entry, const QStringList &terms) const {
+    for (int i = 0; i < terms.size(); i++) {
+        QString term = terms[i];
+        bool exclude = term.startsWith("!");
+        if (exclude)
+            term = term.mid(1).trimmed();
+        bool found = entry != NULL && entry->contains(term, id_labels);
+        if (found == exclude)
+            return false;
+    }
+    return true;
+}
+
+void MainWindow::filterImages() {
+    QStringList terms;
+    QStringList split = line_edit_filter->text().split(",", QString::SkipEmptyParts);
+    for (int i = 0; i < split.size(); i++) {
+        QString term = split[i].trimmed();
+        if (!term.isEmpty() && term != "!")
+            terms << term;
+    }
+
+    for (int i = 0; i < tree_widget_img->topLevelItemCount(); i++) {
+        QTreeWidgetItem * tree_dir = tree_widget_img->topLevelItem(i);
+        DatasetIndex * index = datasetIndex(tree_dir->text(0));
+        for (int j = 0; j < tree_dir->childCount(); j++) {
+            QTreeWidgetItem * item = tree_dir->child(j);
+            item->setHidden(!_matchFilter(index->find(item->text(0)), terms));
+        }
+    }
+}
+
+void MainWindow::exportTrace() {
+    QString file = QFileDialog::getSaveFileName(this, tr("Export performance trace"), QString(), tr("Chrome trace (*.json)"));
+    if (file.isEmpty())
+        return;
+    if (!Trace::instance().exportChromeTrace(file))
+        QMessageBox::warning(this, tr("Export performance trace"), tr("Couldn't write %1").arg(file));
+}
+
+// Records the input of the current image, for --replay-trace.
+void MainWindow::recordInputTrace(bool enabled) {
+    if (!enabled) {
+        if (_input_recorder.isRecording()) {
+            _input_recorder.stop();
+            statusBar()->showMessage(tr("%1 input events recorded").arg(_input_recorder.eventCount()));
+        }
+        return;
+    }
+    ImageCanvas * ic = getCurrentImageCanvas();
+    QString file;
+    if (ic != NULL)
+        file = QFileDialog::getSaveFileName(this, tr("Record input trace"), QFileInfo(ic->getImageFile()).dir().absolutePath(), tr("Input trace (*.trace)"));
+    if (file.isEmpty() || !_input_recorder.start(file, this, ic)) {
+        if (!file.isEmpty())
+            QMessageBox::warning(this, tr("Record input trace"), tr("Couldn't write %1").arg(file));
+        record_input_action->setChecked(false);
+        return;
+    }
+    statusBar()->showMessage(tr("Recording the input of %1 to %2").arg(QFileInfo(ic->getImageFile()).fileName()).arg(file));
+}
+
+// Rewrites the _color_mask.png of the directory with the current palette,
+// on all cores ; the masks already rendered with this palette are skipped.
+void MainWindow::recolorAllMasks() {
+    if (_recolor_watcher != NULL && _recolor_watcher->isRunning())
+        return;
+    QString dir = curr_open_dir.isEmpty() ? currentDir() : curr_open_dir;
+    if (dir.isEmpty())
+        return;
+    QStringList files = maskFiles(dir);
+    if (files.isEmpty()) {
+        statusBar()->showMessage(tr("No mask in %1").arg(dir));
+        return;
+    }
+
+    if (_recolor_watcher == NULL) {
+        _recolor_watcher = new QFutureWatcher<int>(this);
+        _recolor_progress = new QProgressDialog(tr("Recoloring masks..."), tr("Cancel"), 0, 0, this);
+        _recolor_progress->setAutoClose(false);
+        _recolor_progress->setAutoReset(false);
+        connect(_recolor_watcher , SIGNAL(progressRangeChanged(int,int)), _recolor_progress, SLOT(setRange(int,int)));
+        connect(_recolor_watcher , SIGNAL(progressValueChanged(int))    , _recolor_progress, SLOT(setValue(int)));
+        connect(_recolor_progress, SIGNAL(canceled())                   , _recolor_watcher , SLOT(cancel()));
+        connect(_recolor_watcher , SIGNAL(finished())                   , this             , SLOT(recolorFinished()));
+    }
+    _recolor_progress->reset();
+    _recolor_progress->setRange(0, files.size());
+    _recolor_progress->show();
+    recolor_action->setEnabled(false);
+    _recolor_watcher->setFuture(QtConcurrent::mapped(files, MaskRecolorer(id_labels.palette())));
+}
+
+void MainWindow::recolorFinished() {
+    _recolor_progress->hide();
+    recolor_action->setEnabled(true);
+    int recolored = 0, up_to_date = 0, failed = 0;
+    // results of a canceled job are partial but still valid
+    QList<int> results = _recolor_watcher->future().results();
+    for (int i = 0; i < results.size(); i++) {
+        if (results[i] == MaskRecolorer::RECOLORED) recolored++;
+        else if (results[i] == MaskRecolorer::UP_TO_DATE) up_to_date++;
+        else failed++;
+    }
+    QString message = tr("%1 color masks rewritten, %2 up to date").arg(recolored).arg(up_to_date);
+    if (failed > 0)
+        message += tr(", %1 failed").arg(failed);
+    if (_recolor_watcher->isCanceled())
+        message += tr(" (canceled)");
+    statusBar()->showMessage(message);
+}
+
+void MainWindow::setMaskCacheEnabled(bool enabled) {
+    LabelPlaneCache::setEnabled(enabled);
+}
+
+void MainWindow::exportDatasetStats() {
+    QString dir = curr_open_dir.isEmpty() ? currentDir() : curr_open_dir;
+    if (dir.isEmpty())
+        return;
+    QString file = QFileDialog::getSaveFileName(this, tr("Dataset statistics"), dir + "/stats.json", tr("JSON (*.json);;CSV (*.csv)"));
+    if (file.isEmpty())
+        return;
+    QStringList files = imageFiles(dir);
+    for (int i = 0; i < files.size(); i++)
+        files[i] = QDir(dir).absoluteFilePath(files[i]);
+
+    QFutureWatcher<ImageStats> * watcher = new QFutureWatcher<ImageStats>(this);
+    QProgressDialog * progress = new QProgressDialog(tr("Computing statistics..."), tr("Cancel"), 0, files.size(), this);
+    connect(watcher , SIGNAL(progressValueChanged(int)), progress, SLOT(setValue(int)));
+    connect(progress, SIGNAL(canceled())               , watcher , SLOT(cancel()));
+    connect(watcher, &QFutureWatcher<ImageStats>::finished, this, [=] {
+        progress->deleteLater();
+        watcher->deleteLater();
+        if (watcher->isCanceled())
+            return;
+        if (writeDatasetStats(file, watcher->future().results(), id_labels))
+            statusBar()->showMessage(tr("Statistics of %1 images written to %2").arg(files.size()).arg(file));
+        else
+            QMessageBox::warning(this, tr("Dataset statistics"), tr("Couldn't write %1").arg(file));
+    });
+    progress->show();
+    watcher->setFuture(QtConcurrent::mapped(files, computeImageStats));
+}
+
+void MainWindow::compareMask() {
+    if (image_canvas == NULL)
+        return;
+    QString file = QFileDialog::getOpenFileName(this, tr("Mask of the other annotator"), currentDir(), tr("Mask (*_mask.png)"));
+    if (file.isEmpty())
+        return;
+    MaskComparison comparison;
+    if (!image_canvas->compareWith(file, &comparison)) {
+        QMessageBox::warning(this, tr("Compare with mask"), tr("%1 can't be read or doesn't have the size of the image").arg(file));
+        return;
+    }
+    QMessageBox box(QMessageBox::Information, tr("Compare with mask"),
+        tr("Pixel agreement : %1 %\nMean IoU : %2").arg(100. * comparison.pixelAgreement(), 0, 'f', 2).arg(comparison.meanIoU(), 0, 'f', 4),
+        QMessageBox::Ok, this);
+    box.setDetailedText(comparison.report(id_labels));
+    box.exec();
+}
+
+void MainWindow::compareDirectories() {
+    QString dir_a = QFileDialog::getExistingDirectory(this, tr("Masks of annotator A"), curr_open_dir);
+    if (dir_a.isEmpty())
+        return;
+    QString dir_b = QFileDialog::getExistingDirectory(this, tr("Masks of annotator B"), dir_a);
+    if (dir_b.isEmpty())
+        return;
+    QString file = QFileDialog::getSaveFileName(this, tr("Comparison report"), dir_a + "/agreement.csv", tr("CSV (*.csv)"));
+    if (file.isEmpty())
+        return;
+    QStringList masks = commonMasks(dir_a, dir_b);
+
+    QFutureWatcher<ImageComparison> * watcher = new QFutureWatcher<ImageComparison>(this);
+    QProgressDialog * progress = new QProgressDialog(tr("Comparing masks..."), tr("Cancel"), 0, masks.size(), this);
+    connect(watcher , SIGNAL(progressValueChanged(int)), progress, SLOT(setValue(int)));
+    connect(progress, SIGNAL(canceled())               , watcher , SLOT(cancel()));
+    connect(watcher, &QFutureWatcher<ImageComparison>::finished, this, [=] {
+        progress->deleteLater();
+        watcher->deleteLater();
+        if (watcher->isCanceled())
+            return;
+        QList<ImageComparison> images = watcher->future().results();
+        if (writeComparison(file, images, id_labels))
+            statusBar()->showMessage(tr("%1 masks compared, report written to %2").arg(images.size()).arg(file));
+        else
+            QMessageBox::warning(this, tr("Compare directories"), tr("Couldn't write %1").arg(file));
+    });
+    progress->show();
+    watcher->setFuture(compareMaskFiles(dir_a, dir_b, masks));
+}
+
+void MainWindow::openCocoBoxes() {
+    QString file = QFileDialog::getOpenFileName(this, tr("COCO boxes"), curr_open_dir, tr("COCO json (*.json)"));
+    if (file.isEmpty())
+        return;
+    // the scan of a large json takes a while : the index replaces the
+    // current one once complete
+    std::shared_ptr<CocoIndex> coco = std::make_shared<CocoIndex>();
+    QFutureWatcher<bool> * watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [=] {
+        watcher->deleteLater();
+        coco_action->setEnabled(true);
+        if (!watcher->result()) {
+            statusBar()->clearMessage();
+            QMessageBox::warning(this, tr("COCO boxes"), tr("Couldn't read %1").arg(file));
+            return;
+        }
+        _coco = coco;
+        statusBar()->showMessage(tr("%1 images, %2 boxes indexed in %3. Images opened from now on without xml take their boxes from it.")
+            .arg(coco->imageCount()).arg(coco->annotationCount()).arg(file));
+    });
+    coco_action->setEnabled(false);
+    statusBar()->showMessage(tr("Indexing %1...").arg(file));
+    watcher->setFuture(QtConcurrent::run([coco, file] { return coco->open(file); }));
+}
+
+bool MainWindow::cocoBoxes(const QString &image_file, BoxStore &boxes) const {
+    if (!_coco)
+        return false;
+    return _coco->boxes(QFileInfo(image_file).fileName(), boxes);
+}
+
+// Opens an image outside of the directory tree (replay of input traces).
+ImageCanvas * MainWindow::openImage(const QString &file) {
+    ImageCanvas * ic = new ImageCanvas(this);
+    ic->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
+    ic->setScaledContents(true);
+    ic->loadImage(file);
+    int index = tabWidget->addTab(ic->getScrollParent(), QFileInfo(file).fileName());
+    // connects the canvas through updateConnect(int)
+    tabWidget->setCurrentIndex(index);
+    return ic;
+}
@@ -15,6 +15,10 @@
 #include <QColor>
 #include <QScrollArea>
 #include <QAbstractListModel>
+#include <QFutureWatcher>
+#include <QProgressDialog>
+#include <QDockWidget>
+#include <QTimer>
 
 #include <qstringlistmodel.h>
 
@@ -22,12 +26,20 @@
 #include "image_canvas.h"
 #include "label_widget.h"
 #include "labels.h"
+#include "dataset_index.h"
+#include "mask_clip.h"
+#include "label_coverage.h"
+#include "box_formats.h"
+#include "input_trace.h"
+
+#include <memory>
 
 class MainWindow : public QMainWindow, public Ui::MainWindow {
     Q_OBJECT
 
 public:
     MainWindow(QWidget *parent = 0, Qt::WindowFlags flags = 0);
+    ~MainWindow();
 
 private:
 	
@@ -36,7 +48,21 @@ private:
 	int getImageCanvas(QString name, ImageCanvas *ic) ;
     ImageCanvas * getImageCanvas(int index);
     ImageCanvas * getCurrentImageCanvas();
-    ImageMask _tmp;
+    MaskClip _clip;
+    QMap<QString, DatasetIndex*> _dataset_indexes;
+    QFutureWatcher<int> * _recolor_watcher;
+    QProgressDialog     * _recolor_progress;
+    QDockWidget         * _coverage_dock;
+    LabelCoverageWidget * _coverage;
+    QTimer                _coverage_timer;
+    QTimer                _filter_timer;
+    std::shared_ptr<CocoIndex> _coco;
+    InputTraceRecorder    _input_recorder;
+    QByteArray            _palette_hash;
+    quint64               _palette_hash_generation;
+    void _setIndexColumns(QTreeWidgetItem *item, const ImageIndexEntry *entry);
+    void _scanDatasetIndex(const QString &dir);
+    bool _matchFilter(const ImageIndexEntry *entry, const QStringList &terms) const;
 
 public:
 	ImageCanvas   *  image_canvas ;
@@ -48,12 +74,41 @@ public:
 	QAction        * save_action  ;
     QAction        * copy_mask_action;
     QAction        * paste_mask_action;
+    QAction        * copy_label_action;
+    QAction        * paste_at_cursor_action;
+    QAction        * paste_unlabeled_action;
     QAction        * clear_mask_action;
     QAction        * close_tab_action;
 	QAction        * undo_action  ;
     QAction        * swap_action;
 	QAction        * redo_action  ;
 	QAction        * open_dir_action  ;
+	QAction        * superpixel_action;
+	QAction        * polygon_action;
+	QAction        * livewire_action;
+	QAction        * sequence_action;
+	QAction        * instance_action;
+	QAction        * next_window_action;
+	QAction        * previous_window_action;
+	QAction        * dilate_action;
+	QAction        * erode_action;
+	QAction        * opening_action;
+	QAction        * closing_action;
+	QAction        * fill_holes_action;
+	QAction        * refine_box_action;
+	QAction        * refine_all_boxes_action;
+	QAction        * recolor_action;
+	QAction        * mask_cache_action;
+	QAction        * stats_action;
+	QAction        * coco_action;
+	QAction        * compare_action;
+	QAction        * clear_comparison_action;
+	QAction        * compare_dirs_action;
+#ifdef PIXEL_ANNOTATION_TRACING
+	QAction        * perf_overlay_action;
+	QAction        * export_trace_action;
+#endif
+	QAction        * record_input_action;
 	QString          curr_open_dir;
 public:
 	QString currentDir() const;
@@ -62,6 +117,12 @@ public:
     void allDisconnnect(const ImageCanvas * ic);
     void runWatershed(ImageCanvas * ic);
     void setStarAtNameOfTab(bool star);
+    DatasetIndex * datasetIndex(const QString &dir);
+    void updateDatasetIndex(const QString &image_file, const ImageIndexEntry &entry);
+    void labelCountsChanged();
+    bool cocoBoxes(const QString &image_file, BoxStore &boxes) const;
+    const QByteArray & paletteHash();
+    ImageCanvas * openImage(const QString &file);
 
 public slots:
 
@@ -79,10 +140,23 @@ public slots:
     void closeCurrentTab();
     void copyMask();
     void pasteMask();
+    void copyLabel();
+    void pasteMaskAtCursor();
     void clearMask();
 	void updateConnect(int index);
     void treeWidgetClicked();
     void onLabelShortcut(int row);
+    void filterImages();
+    void exportTrace();
+    void recordInputTrace(bool enabled);
+    void recolorAllMasks();
+    void recolorFinished();
+    void setMaskCacheEnabled(bool enabled);
+    void exportDatasetStats();
+    void openCocoBoxes();
+    void compareMask();
+    void compareDirectories();
+    void updateLabelCoverage();
     void update();
 };
 
@@ -0,0 +1,47 @@
+#include "mask_clip.h"
+
+#include <algorithm>
+
+MaskClip MaskClip::fromMask(const cv::Mat &id, cv::Rect rect, int only_label) {
+	MaskClip clip;
+	clip._rect = rect & cv::Rect(0, 0, id.cols, id.rows);
+	for (int y = 0; y < clip._rect.height; y++) {
+		const ushort * line = id.ptr<ushort>(clip._rect.y + y) + clip._rect.x;
+		int x = 0;
+		while (x < clip._rect.width) {
+			const ushort value = line[x];
+			const int start = x;
+			while (x < clip._rect.width && line[x] == value)
+				x++;
+			if (value == 0 || (only_label >= 0 && value != only_label))
+				continue;
+			Run run = { y, start, x - start, value };
+			clip._runs.push_back(run);
+		}
+	}
+	return clip;
+}
+
+cv::Rect MaskClip::paste(cv::Mat &id, cv::Point offset, PasteMode mode) const {
+	const cv::Point origin = _rect.tl() + offset;
+	for (size_t i = 0; i < _runs.size(); i++) {
+		const Run & run = _runs[i];
+		const int y = origin.y + run.y;
+		if (y < 0 || y >= id.rows)
+			continue;
+		const int x0 = std::max(0, origin.x + run.x);
+		const int x1 = std::min(id.cols, origin.x + run.x + run.length);
+		if (x1 <= x0)
+			continue;
+		ushort * line = id.ptr<ushort>(y);
+		if (mode == OVERWRITE) {
+			std::fill(line + x0, line + x1, run.id);
+		} else {
+			for (int x = x0; x < x1; x++) {
+				if (line[x] == 0)
+					line[x] = run.id;
+			}
+		}
+	}
+	return cv::Rect(origin, _rect.size()) & cv::Rect(0, 0, id.cols, id.rows);
+}
@@ -0,0 +1,34 @@
+#ifndef MASK_CLIP_H
+#define MASK_CLIP_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// Region of a label plane kept as runs of labeled pixels : unlabeled pixels
+// are transparent and cost nothing, so a clip of a few objects stays small
+// whatever the size of the image.
+class MaskClip {
+public:
+	enum PasteMode { OVERWRITE, INTO_UNLABELED };
+
+	// only_label >= 0 keeps the pixels of this label only
+	static MaskClip fromMask(const cv::Mat &id, cv::Rect rect, int only_label = -1);
+
+	bool     empty() const { return _runs.empty(); }
+	cv::Rect rect() const { return _rect; }
+	size_t   runCount() const { return _runs.size(); }
+	size_t   byteSize() const { return _runs.size() * sizeof(Run); }
+	// Writes the clip moved by offset, returns the rect of the plane that was touched.
+	cv::Rect paste(cv::Mat &id, cv::Point offset, PasteMode mode) const;
+
+private:
+	struct Run {
+		int    y, x  ; // relative to _rect
+		int    length;
+		ushort id    ;
+	};
+	cv::Rect         _rect;
+	std::vector<Run> _runs;
+};
+
+#endif // MASK_CLIP_H
@@ -0,0 +1,284 @@
+#include "mask_compare.h"
+#include "utils.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// Rows are split in stripes, each one filling its own confusion matrix.
+// Pixels are counted by runs of equal (A, B) pairs, and the disagreement
+// plane is written a run at a time.
+class ConfusionKernel : public cv::ParallelLoopBody {
+public:
+	ConfusionKernel(const cv::Mat &a, const cv::Mat &b, const std::vector<int> &lut, int k,
+	                std::vector<std::vector<qint64> > &partials, uchar *disagreement, int disagreement_step) :
+		_a(a), _b(b), _lut(lut), _k(k), _partials(partials), _disagreement(disagreement), _step(disagreement_step) {}
+
+	void operator()(const cv::Range &stripes) const override {
+		const int n = int(_partials.size());
+		for (int s = stripes.start; s < stripes.end; s++) {
+			std::vector<qint64> & confusion = _partials[s];
+			confusion.assign(size_t(_k) * _k, 0);
+			const int y_end = int(qint64(_a.rows) * (s + 1) / n);
+			for (int y = int(qint64(_a.rows) * s / n); y < y_end; y++) {
+				const ushort * pa = _a.ptr<ushort>(y);
+				const ushort * pb = _b.ptr<ushort>(y);
+				uchar * diff = _disagreement != NULL ? _disagreement + qint64(y) * _step : NULL;
+				int x = 0;
+				while (x < _a.cols) {
+					const ushort va = pa[x], vb = pb[x];
+					const int start = x;
+					while (x < _a.cols && pa[x] == va && pb[x] == vb)
+						x++;
+					confusion[_lut[va] * _k + _lut[vb]] += x - start;
+					if (diff != NULL)
+						memset(diff + start, va != vb ? 1 : 0, x - start);
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat                     & _a           ;
+	const cv::Mat                     & _b           ;
+	const std::vector<int>            & _lut         ;
+	int                                 _k           ;
+	std::vector<std::vector<qint64> > & _partials    ;
+	uchar                             * _disagreement;
+	int                                 _step        ;
+};
+
+} // namespace
+
+qint64 MaskComparison::pixelCount() const {
+	qint64 total = 0;
+	for (size_t i = 0; i < confusion.size(); i++)
+		total += confusion[i];
+	return total;
+}
+
+qint64 MaskComparison::agreeingPixels() const {
+	qint64 total = 0;
+	for (int i = 0; i < ids.size(); i++)
+		total += confusion[i * ids.size() + i];
+	return total;
+}
+
+double MaskComparison::pixelAgreement() const {
+	qint64 total = pixelCount();
+	return total > 0 ? double(agreeingPixels()) / total : 1.;
+}
+
+double MaskComparison::iou(int index) const {
+	const int k = ids.size();
+	qint64 in_a = 0, in_b = 0;
+	for (int j = 0; j < k; j++) {
+		in_a += confusion[index * k + j];
+		in_b += confusion[j * k + index];
+	}
+	qint64 intersection = confusion[index * k + index];
+	qint64 union_ = in_a + in_b - intersection;
+	return union_ > 0 ? double(intersection) / union_ : 1.;
+}
+
+double MaskComparison::meanIoU() const {
+	if (ids.isEmpty())
+		return 1.;
+	double sum = 0;
+	for (int i = 0; i < ids.size(); i++)
+		sum += iou(i);
+	return sum / ids.size();
+}
+
+void MaskComparison::merge(const MaskComparison &other) {
+	QVector<int> merged = ids;
+	QHash<int, int> index; // id -> position in merged, once sorted
+	for (int i = 0; i < ids.size(); i++)
+		index.insert(ids[i], i);
+	for (int i = 0; i < other.ids.size(); i++) {
+		if (!index.contains(other.ids[i])) {
+			index.insert(other.ids[i], merged.size());
+			merged << other.ids[i];
+		}
+	}
+	std::sort(merged.begin(), merged.end());
+	for (int i = 0; i < merged.size(); i++)
+		index[merged[i]] = i;
+	const int k = merged.size();
+	std::vector<qint64> result(size_t(k) * k, 0);
+	const MaskComparison * parts[2] = { this, &other };
+	for (int p = 0; p < 2; p++) {
+		const MaskComparison & part = *parts[p];
+		const int pk = part.ids.size();
+		std::vector<int> positions(pk);
+		for (int i = 0; i < pk; i++)
+			positions[i] = index.value(part.ids[i]);
+		for (int i = 0; i < pk; i++) {
+			for (int j = 0; j < pk; j++)
+				result[positions[i] * k + positions[j]] += part.confusion[i * pk + j];
+		}
+	}
+	ids = merged;
+	confusion.swap(result);
+}
+
+QString MaskComparison::report(const Id2Labels &id_labels) const {
+	QString text;
+	QTextStream out(&text);
+	out << "id,name,iou\n";
+	for (int i = 0; i < ids.size(); i++) {
+		const LabelInfo * label = id_labels.find(ids[i]);
+		out << ids[i] << "," << csvField(label != NULL ? label->name : QString()) << "," << iou(i) << "\n";
+	}
+	out << "\nconfusion (rows A, columns B)\n";
+	for (int j = 0; j < ids.size(); j++)
+		out << "," << ids[j];
+	out << "\n";
+	for (int i = 0; i < ids.size(); i++) {
+		out << ids[i];
+		for (int j = 0; j < ids.size(); j++)
+			out << "," << confusion[i * ids.size() + j];
+		out << "\n";
+	}
+	return text;
+}
+
+MaskComparison compareMasks(const cv::Mat &a, const cv::Mat &b, bool with_disagreement) {
+	MaskComparison result;
+	if (a.empty() || a.size() != b.size() || a.type() != CV_16UC1 || b.type() != CV_16UC1)
+		return result;
+
+	// ids present in either plane, mapped to dense indices
+	LabelHistogram histogram;
+	histogram.add(a);
+	histogram.add(b);
+	QMap<int, qint64> counts = histogram.counts();
+	std::vector<int> lut(65536, 0);
+	for (QMap<int, qint64>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+		lut[it.key()] = result.ids.size();
+		result.ids << it.key();
+	}
+	const int k = result.ids.size();
+
+	uchar * diff = NULL;
+	int step = 0;
+	if (with_disagreement) {
+		result.disagreement = QImage(a.cols, a.rows, QImage::Format_Indexed8);
+		result.disagreement.setColorTable(QVector<QRgb>() << qRgba(0, 0, 0, 0) << qRgba(255, 0, 0, 255));
+		diff = result.disagreement.bits();
+		step = result.disagreement.bytesPerLine();
+	}
+
+	int stripes = std::max(1, std::min(a.rows, cv::getNumThreads() * 4));
+	std::vector<std::vector<qint64> > partials(stripes);
+	cv::parallel_for_(cv::Range(0, stripes), ConfusionKernel(a, b, lut, k, partials, diff, step), stripes);
+
+	result.confusion.assign(size_t(k) * k, 0);
+	for (int s = 0; s < stripes; s++) {
+		for (size_t i = 0; i < result.confusion.size(); i++)
+			result.confusion[i] += partials[s][i];
+	}
+	return result;
+}
+
+namespace {
+
+struct CompareImage {
+	typedef ImageComparison result_type;
+
+	CompareImage(const QString &dir_a, const QString &dir_b) : _dir_a(dir_a), _dir_b(dir_b) {}
+	ImageComparison operator()(const QString &mask) const {
+		ImageComparison result;
+		result.image = mask;
+		cv::Mat a = loadLabelImage(_dir_a + "/" + mask);
+		cv::Mat b = loadLabelImage(_dir_b + "/" + mask);
+		result.ok = !a.empty() && a.size() == b.size();
+		if (result.ok)
+			result.comparison = compareMasks(a, b, false);
+		return result;
+	}
+
+	QString _dir_a;
+	QString _dir_b;
+};
+
+} // namespace
+
+QStringList commonMasks(const QString &dir_a, const QString &dir_b) {
+	QStringList masks;
+	QStringList files = QDir(dir_a).entryList(QStringList() << "*_mask.png", QDir::Files, QDir::Name);
+	for (int i = 0; i < files.size(); i++) {
+		if (files[i].endsWith("_color_mask.png") || files[i].endsWith("_watershed_mask.png"))
+			continue;
+		if (QFile::exists(dir_b + "/" + files[i]))
+			masks << files[i];
+	}
+	return masks;
+}
+
+QFuture<ImageComparison> compareMaskFiles(const QString &dir_a, const QString &dir_b, const QStringList &masks) {
+	return QtConcurrent::mapped(masks, CompareImage(dir_a, dir_b));
+}
+
+QList<ImageComparison> compareDirectories(const QString &dir_a, const QString &dir_b) {
+	return QtConcurrent::blockingMapped<QList<ImageComparison> >(commonMasks(dir_a, dir_b), CompareImage(dir_a, dir_b));
+}
+
+bool writeComparison(const QString &file, const QList<ImageComparison> &images, const Id2Labels &id_labels) {
+	QString base = file.endsWith(".csv", Qt::CaseInsensitive) ? file.left(file.size() - 4) : file;
+	QFile image_file(base + "_images.csv");
+	if (!image_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	QTextStream image_out(&image_file);
+	image_out << "mask,pixel_agreement,mean_iou\n";
+	MaskComparison total;
+	for (const ImageComparison &image : images) {
+		if (!image.ok) {
+			image_out << csvField(image.image) << ",,\n";
+			continue;
+		}
+		image_out << csvField(image.image) << "," << image.comparison.pixelAgreement() << "," << image.comparison.meanIoU() << "\n";
+		total.merge(image.comparison);
+	}
+
+	QFile label_file(base + "_labels.csv");
+	if (!label_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	QTextStream label_out(&label_file);
+	label_out << total.report(id_labels);
+	label_out << "\npixel_agreement," << total.pixelAgreement() << "\nmean_iou," << total.meanIoU() << "\n";
+	return true;
+}
+
+int runCompareCommand(const QStringList &arguments) {
+	int index = arguments.indexOf("--compare");
+	if (index < 0 || index + 3 >= arguments.size()) {
+		std::cerr << "usage: PixelAnnotationTool --compare <dir_a> <dir_b> <output.csv> [--config <config.json>]" << std::endl;
+		return 2;
+	}
+	Name2Labels labels = defaulfLabels();
+	int config = arguments.indexOf("--config");
+	if (config >= 0 && config + 1 < arguments.size() && !labels.readFile(arguments[config + 1])) {
+		std::cerr << "can't open " << arguments[config + 1].toStdString() << std::endl;
+		return 1;
+	}
+	Id2Labels id_labels = getId2Label(labels);
+
+	QList<ImageComparison> images = compareDirectories(arguments[index + 1], arguments[index + 2]);
+	if (!writeComparison(arguments[index + 3], images, id_labels)) {
+		std::cerr << "can't write " << arguments[index + 3].toStdString() << std::endl;
+		return 1;
+	}
+	std::cout << images.size() << " masks compared" << std::endl;
+	return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef MASK_COMPARE_H
+#define MASK_COMPARE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QImage>
+#include <QFuture>
+#include <opencv2/core/core.hpp>
+
+#include "labels.h"
+
+// Agreement of two label planes of the same image (annotator A vs B).
+// confusion[i * ids.size() + j] counts the pixels labeled ids[i] in A and
+// ids[j] in B.
+struct MaskComparison {
+	QVector<int>        ids         ;
+	std::vector<qint64> confusion   ;
+	QImage              disagreement; // Indexed8, 1 where A != B, empty in batch mode
+
+	qint64 pixelCount() const;
+	qint64 agreeingPixels() const;
+	double pixelAgreement() const;
+	double iou(int index) const;   // of ids[index]
+	double meanIoU() const;        // over the ids present in A or B
+	void   merge(const MaskComparison &other);
+	QString report(const Id2Labels &id_labels) const;
+};
+
+MaskComparison compareMasks(const cv::Mat &a, const cv::Mat &b, bool with_disagreement = true);
+
+struct ImageComparison {
+	QString        image     ;
+	bool           ok        ;
+	MaskComparison comparison;
+};
+
+// _mask.png files present in both directories
+QStringList commonMasks(const QString &dir_a, const QString &dir_b);
+// Compares the masks of the same name in both directories, on all cores.
+QFuture<ImageComparison> compareMaskFiles(const QString &dir_a, const QString &dir_b, const QStringList &masks);
+// Compares the _mask.png of the same name in both directories, in parallel.
+QList<ImageComparison> compareDirectories(const QString &dir_a, const QString &dir_b);
+bool writeComparison(const QString &file, const QList<ImageComparison> &images, const Id2Labels &id_labels);
+
+// Headless entry point : PixelAnnotationTool --compare <dir_a> <dir_b> <output.csv> [--config <config.json>]
+int runCompareCommand(const QStringList &arguments);
+
+#endif // MASK_COMPARE_H
@@ -0,0 +1,33 @@
+#include "polygon.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+AnnotationPolygon::AnnotationPolygon(std::string name) : _object_name(name) {}
+
+void AnnotationPolygon::movePoint(int index, cv::Point p) {
+    if (index >= 0 && index < size())
+        _points[index] = p;
+}
+
+int AnnotationPolygon::vertexAt(cv::Point p, int radius) const {
+    for (int i = 0; i < size(); i++) {
+        cv::Point d = _points[i] - p;
+        if (d.x * d.x + d.y * d.y <= radius * radius)
+            return i;
+    }
+    return -1;
+}
+
+cv::Rect AnnotationPolygon::boundingRect() const {
+    if (_points.empty())
+        return cv::Rect();
+    return cv::boundingRect(_points);
+}
+
+std::string AnnotationPolygon::toXML() const {
+    std::string text = "\t<polygon>\n\
+		<name>" + _object_name + "</name>\n";
+    for (cv::Point p : _points)
+        text += "\t\t<pt><x>" + std::to_string(p.x) + "</x><y>" + std::to_string(p.y) + "</y></pt>\n";
+    return text + "\t</polygon>\n";
+}
@@ -0,0 +1,34 @@
+#ifndef POLYGON_H
+#define POLYGON_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+// Polygon annotation : a few vertices standing for a large region of the
+// label plane. The label patch it covered before being rasterized is kept,
+// so moving a vertex only re-rasterizes the bounding rect of the polygon.
+class AnnotationPolygon {
+    public:
+        AnnotationPolygon(std::string name = "");
+        std::string getName() const { return _object_name; }
+        const std::vector<cv::Point> & getPoints() const { return _points; }
+        void addPoint(cv::Point p) { _points.push_back(p); }
+        void removeLastPoint() { if (!_points.empty()) _points.pop_back(); }
+        void movePoint(int index, cv::Point p);
+        int  size() const { return int(_points.size()); }
+        int  vertexAt(cv::Point p, int radius) const;
+        cv::Rect boundingRect() const;
+        std::string toXML() const;
+
+        // label patch under the polygon before its last rasterization, and
+        // the pixels of under_rect the rasterization covered (CV_8U)
+        cv::Mat  under     ;
+        cv::Mat  inside    ;
+        cv::Rect under_rect;
+    private:
+        std::string            _object_name;
+        std::vector<cv::Point> _points     ;
+};
+
+#endif // POLYGON_H
@@ -0,0 +1,57 @@
+#include "recolor.h"
+#include "utils.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QCryptographicHash>
+
+static const char * PALETTE_KEY = "pixel_annotation_palette";
+
+QByteArray paletteHash(const QVector<QRgb> &palette) {
+	QByteArray data(reinterpret_cast<const char*>(palette.constData()), palette.size() * int(sizeof(QRgb)));
+	return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+}
+
+bool saveColorMask(const QString &file, const QImage &color, const QByteArray &palette_hash) {
+	QImageWriter writer(file, "png");
+	writer.setText(PALETTE_KEY, QString::fromLatin1(palette_hash));
+	return writer.write(color);
+}
+
+QString colorMaskFile(const QString &mask_file) {
+	return mask_file.left(mask_file.size() - int(sizeof("_mask.png") - 1)) + "_color_mask.png";
+}
+
+QStringList maskFiles(const QString &dir) {
+	QStringList result;
+	QDir current_dir(dir);
+	QStringList files = current_dir.entryList(QStringList() << "*_mask.png", QDir::Files, QDir::Name);
+	for (int i = 0; i < files.size(); i++) {
+		if (files[i].endsWith("_color_mask.png") || files[i].endsWith("_watershed_mask.png"))
+			continue;
+		result << current_dir.absoluteFilePath(files[i]);
+	}
+	return result;
+}
+
+MaskRecolorer::MaskRecolorer(const QVector<QRgb> &palette) : _palette(palette), _hash(paletteHash(palette)) {}
+
+int MaskRecolorer::operator()(const QString &mask_file) const {
+	QString color_file = colorMaskFile(mask_file);
+	QFileInfo color_info(color_file);
+	if (color_info.exists() && color_info.lastModified() >= QFileInfo(mask_file).lastModified()) {
+		// only the text chunks are read, not the pixels
+		QImageReader reader(color_file, "png");
+		if (reader.text(PALETTE_KEY).toLatin1() == _hash)
+			return UP_TO_DATE;
+	}
+	cv::Mat id = loadLabelImage(mask_file);
+	if (id.empty())
+		return FAILED;
+	QImage color(id.cols, id.rows, QImage::Format_RGB888);
+	idToColor(id, _palette, &color);
+	return saveColorMask(color_file, color, _hash) ? RECOLORED : FAILED;
+}
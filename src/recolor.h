@@ -0,0 +1,32 @@
+#ifndef RECOLOR_H
+#define RECOLOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QImage>
+
+// The color masks written by the tool carry the hash of the palette they
+// were rendered with (png text chunk), so a palette change only rewrites
+// the stale ones.
+QByteArray paletteHash(const QVector<QRgb> &palette);
+bool saveColorMask(const QString &file, const QImage &color, const QByteArray &palette_hash);
+QString colorMaskFile(const QString &mask_file);
+QStringList maskFiles(const QString &dir);
+
+// Rebuilds the color mask of one id mask. Stateless, meant for QtConcurrent::mapped.
+class MaskRecolorer {
+public:
+	enum Status { RECOLORED, UP_TO_DATE, FAILED };
+	typedef int result_type;
+
+	explicit MaskRecolorer(const QVector<QRgb> &palette);
+	int operator()(const QString &mask_file) const;
+
+private:
+	QVector<QRgb> _palette;
+	QByteArray    _hash   ;
+};
+
+#endif // RECOLOR_H
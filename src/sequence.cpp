@@ -0,0 +1,207 @@
+#include "sequence.h"
+#include "dataset_index.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QRegExp>
+#include <QSaveFile>
+
+#include <cstring>
+
+static const char    FLOW_MAGIC[4] = { 'P', 'A', 'T', 'F' };
+static const quint32 FLOW_VERSION  = 1;
+static const int     FLOW_MAX_SIDE = 960;
+
+struct FlowHeader {
+	char    magic[4]     ;
+	quint32 version      ;
+	qint32  flow_width   ;
+	qint32  flow_height  ;
+	qint32  image_width  ;
+	qint32  image_height ;
+	qint64  previous_mtime;
+	qint64  next_mtime   ;
+};
+
+// "frame_000123.jpg" -> "frame_", 123, ".jpg". The extension is split off
+// first so that the digit of ".jp2" is not taken for the frame number.
+static bool splitFrameName(const QString &file_name, QString *prefix, qlonglong *number, QString *suffix) {
+	int dot = file_name.lastIndexOf('.');
+	QString base = dot < 0 ? file_name : file_name.left(dot);
+	QString extension = dot < 0 ? QString() : file_name.mid(dot);
+	QRegExp rx("^(.*\\D)?(\\d+)(\\D*)$");
+	if (!rx.exactMatch(base))
+		return false;
+	*prefix = rx.cap(1);
+	*number = rx.cap(2).toLongLong();
+	*suffix = rx.cap(3) + extension;
+	return true;
+}
+
+QString previousFrame(const QString &image_file) {
+	QFileInfo info(image_file);
+	QString prefix, suffix;
+	qlonglong number;
+	if (!splitFrameName(info.fileName(), &prefix, &number, &suffix))
+		return QString();
+
+	QString best;
+	qlonglong best_number = -1;
+	QStringList files = imageFiles(info.absolutePath());
+	for (int i = 0; i < files.size(); i++) {
+		QString p, s;
+		qlonglong n;
+		if (!splitFrameName(files[i], &p, &n, &s) || p != prefix || s != suffix)
+			continue;
+		if (n < number && n > best_number) {
+			best_number = n;
+			best = files[i];
+		}
+	}
+	return best.isEmpty() ? QString() : info.absolutePath() + "/" + best;
+}
+
+static QString flowCacheFile(const QString &previous_file, const QString &next_file) {
+	return annotationCacheFile(next_file, "." + QFileInfo(previous_file).fileName() + ".flow");
+}
+
+static FlowHeader makeHeader(const QString &previous_file, const QString &next_file, cv::Size flow, cv::Size image) {
+	FlowHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FLOW_MAGIC, sizeof(FLOW_MAGIC));
+	header.version = FLOW_VERSION;
+	header.flow_width = flow.width;
+	header.flow_height = flow.height;
+	header.image_width = image.width;
+	header.image_height = image.height;
+	header.previous_mtime = QFileInfo(previous_file).lastModified().toMSecsSinceEpoch();
+	header.next_mtime = QFileInfo(next_file).lastModified().toMSecsSinceEpoch();
+	return header;
+}
+
+static cv::Mat readFlow(const QString &previous_file, const QString &next_file, cv::Size *image_size) {
+	QFile file(flowCacheFile(previous_file, next_file));
+	if (!file.open(QIODevice::ReadOnly))
+		return cv::Mat();
+	FlowHeader header;
+	if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header)))
+		return cv::Mat();
+	cv::Size flow_size(header.flow_width, header.flow_height);
+	cv::Size size(header.image_width, header.image_height);
+	FlowHeader expected = makeHeader(previous_file, next_file, flow_size, size);
+	if (memcmp(&header, &expected, sizeof(header)) != 0 || flow_size.area() <= 0)
+		return cv::Mat();
+	cv::Mat flow(flow_size, CV_32FC2);
+	qint64 bytes = qint64(flow.total() * flow.elemSize());
+	if (file.read(reinterpret_cast<char*>(flow.data), bytes) != bytes)
+		return cv::Mat();
+	*image_size = size;
+	return flow;
+}
+
+static void writeFlow(const QString &previous_file, const QString &next_file, const cv::Mat &flow, cv::Size image_size) {
+	QString file_name = flowCacheFile(previous_file, next_file);
+	QDir().mkpath(QFileInfo(file_name).absolutePath());
+	QSaveFile file(file_name);
+	if (!file.open(QIODevice::WriteOnly))
+		return;
+	FlowHeader header = makeHeader(previous_file, next_file, flow.size(), image_size);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	cv::Mat data = flow.isContinuous() ? flow : flow.clone();
+	file.write(reinterpret_cast<const char*>(data.data), qint64(data.total() * data.elemSize()));
+	file.commit();
+}
+
+static cv::Mat loadGray(const QString &file, double scale) {
+	cv::Mat gray = cv::imread(file.toStdString(), cv::IMREAD_GRAYSCALE);
+	if (gray.empty() || scale == 1.)
+		return gray;
+	cv::Mat small;
+	cv::resize(gray, small, cv::Size(), scale, scale, cv::INTER_AREA);
+	return small;
+}
+
+// The flow is kept at the resolution it was computed at, and brought back
+// to the image size (vectors included) when it is used.
+static cv::Mat upscaleFlow(const cv::Mat &flow, cv::Size image_size) {
+	if (flow.size() == image_size)
+		return flow;
+	cv::Mat result;
+	cv::resize(flow, result, image_size, 0, 0, cv::INTER_LINEAR);
+	const float sx = float(image_size.width) / flow.cols;
+	const float sy = float(image_size.height) / flow.rows;
+	for (int y = 0; y < result.rows; y++) {
+		cv::Point2f * line = result.ptr<cv::Point2f>(y);
+		for (int x = 0; x < result.cols; x++) {
+			line[x].x *= sx;
+			line[x].y *= sy;
+		}
+	}
+	return result;
+}
+
+cv::Mat loadOrComputeFlow(const QString &previous_file, const QString &next_file) {
+	PAT_TRACE_SCOPE("opticalFlow");
+	cv::Size image_size;
+	cv::Mat flow = readFlow(previous_file, next_file, &image_size);
+	if (!flow.empty())
+		return upscaleFlow(flow, image_size);
+
+	cv::Mat next_full = cv::imread(next_file.toStdString(), cv::IMREAD_GRAYSCALE);
+	if (next_full.empty())
+		return cv::Mat();
+	image_size = next_full.size();
+	const double scale = std::min(1., double(FLOW_MAX_SIDE) / std::max(image_size.width, image_size.height));
+	cv::Mat next = next_full;
+	if (scale < 1.)
+		cv::resize(next_full, next, cv::Size(), scale, scale, cv::INTER_AREA);
+	cv::Mat previous = loadGray(previous_file, scale);
+	if (previous.size() != next.size())
+		return cv::Mat();
+
+	cv::calcOpticalFlowFarneback(next, previous, flow, 0.5, 4, 21, 3, 5, 1.1, 0);
+	writeFlow(previous_file, next_file, flow, image_size);
+	return upscaleFlow(flow, image_size);
+}
+
+cv::Mat warpLabels(const cv::Mat &previous_id, const cv::Mat &flow) {
+	cv::Mat map(flow.size(), CV_32FC2);
+	for (int y = 0; y < flow.rows; y++) {
+		const cv::Point2f * f = flow.ptr<cv::Point2f>(y);
+		cv::Point2f * m = map.ptr<cv::Point2f>(y);
+		for (int x = 0; x < flow.cols; x++)
+			m[x] = cv::Point2f(x + f[x].x, y + f[x].y);
+	}
+	cv::Mat result;
+	// nearest, labels can not be interpolated
+	cv::remap(previous_id, result, map, cv::Mat(), cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+	return result;
+}
+
+PropagatedMask propagateFromPreviousFrame(const QString &image_file) {
+	PAT_TRACE_SCOPE("propagateMask");
+	PropagatedMask result;
+	result.image_file = image_file;
+	result.previous_file = previousFrame(image_file);
+	if (result.previous_file.isEmpty())
+		return result;
+	QFileInfo previous(result.previous_file);
+	QString mask_file = previous.dir().absolutePath() + "/" + previous.baseName() + "_mask.png";
+	if (!QFile::exists(mask_file))
+		return result;
+
+	cv::Mat previous_id = loadLabelImage(mask_file);
+	cv::Mat flow = loadOrComputeFlow(result.previous_file, image_file);
+	if (previous_id.empty() || flow.empty() || previous_id.size() != flow.size())
+		return result;
+	result.id = warpLabels(previous_id, flow);
+	return result;
+}
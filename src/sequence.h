@@ -0,0 +1,30 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+
+// Frames of a sequence are the images of a directory whose names only differ
+// by a number, e.g. frame_000123.jpg. Returns the frame before image_file in
+// numeric order, or an empty string if it is not part of a sequence.
+QString previousFrame(const QString &image_file);
+
+// Dense flow from next to previous frame (CV_32FC2, at the image size), so
+// that next(x) ~ previous(x + flow(x)). Farneback is computed on a
+// downscaled gray image and cached beside the frames for the pair.
+cv::Mat loadOrComputeFlow(const QString &previous_file, const QString &next_file);
+
+// Warps a label plane of the previous frame onto the next one.
+cv::Mat warpLabels(const cv::Mat &previous_id, const cv::Mat &flow);
+
+struct PropagatedMask {
+	QString image_file   ;
+	QString previous_file;
+	cv::Mat id           ; // empty if there was nothing to propagate
+};
+
+// Propagates the saved mask of the previous frame onto image_file.
+// Meant to run in a worker thread.
+PropagatedMask propagateFromPreviousFrame(const QString &image_file);
+
+#endif // SEQUENCE_H
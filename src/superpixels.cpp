@@ -0,0 +1,226 @@
+#include "superpixels.h"
+#include "dataset_index.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+namespace {
+
+struct SlicCenter {
+	float l, a, b, x, y;
+};
+
+class SlicAssign : public cv::ParallelLoopBody {
+public:
+	SlicAssign(const cv::Mat &lab, const std::vector<SlicCenter> &centers, int grid_w, int grid_h, int step, float weight, cv::Mat &labels) :
+		_lab(lab), _centers(centers), _grid_w(grid_w), _grid_h(grid_h), _step(step), _weight(weight), _labels(labels) {}
+
+	void operator()(const cv::Range &rows) const override {
+		for (int y = rows.start; y < rows.end; y++) {
+			const uchar * lab = _lab.ptr<uchar>(y);
+			int * label = _labels.ptr<int>(y);
+			int gy = std::min(y / _step, _grid_h - 1);
+			for (int x = 0; x < _lab.cols; x++) {
+				int gx = std::min(x / _step, _grid_w - 1);
+				float l = lab[3 * x], a = lab[3 * x + 1], b = lab[3 * x + 2];
+				float best = FLT_MAX;
+				int best_index = gy * _grid_w + gx;
+				for (int cy = std::max(0, gy - 1); cy <= std::min(_grid_h - 1, gy + 1); cy++) {
+					for (int cx = std::max(0, gx - 1); cx <= std::min(_grid_w - 1, gx + 1); cx++) {
+						const SlicCenter & c = _centers[cy * _grid_w + cx];
+						float dl = l - c.l, da = a - c.a, db = b - c.b;
+						float dx = x - c.x, dy = y - c.y;
+						float d = dl * dl + da * da + db * db + _weight * (dx * dx + dy * dy);
+						if (d < best) {
+							best = d;
+							best_index = cy * _grid_w + cx;
+						}
+					}
+				}
+				label[x] = best_index;
+			}
+		}
+	}
+
+private:
+	const cv::Mat                 & _lab    ;
+	const std::vector<SlicCenter> & _centers;
+	int                             _grid_w ;
+	int                             _grid_h ;
+	int                             _step   ;
+	float                           _weight ;
+	cv::Mat                       & _labels ;
+};
+
+// Relabels the 4-connected components consecutively, merging the ones
+// smaller than min_size into their previously visited neighbour.
+cv::Mat enforceConnectivity(const cv::Mat &labels, int min_size) {
+	cv::Mat result(labels.size(), CV_32S, cv::Scalar(-1));
+	const int dx[4] = { -1, 0, 1, 0 };
+	const int dy[4] = { 0, -1, 0, 1 };
+	std::vector<cv::Point> component;
+	int next_label = 0;
+	for (int y = 0; y < labels.rows; y++) {
+		for (int x = 0; x < labels.cols; x++) {
+			if (result.at<int>(y, x) >= 0)
+				continue;
+			int adjacent = -1;
+			for (int k = 0; k < 4; k++) {
+				int nx = x + dx[k], ny = y + dy[k];
+				if (nx >= 0 && ny >= 0 && nx < labels.cols && ny < labels.rows && result.at<int>(ny, nx) >= 0)
+					adjacent = result.at<int>(ny, nx);
+			}
+			const int original = labels.at<int>(y, x);
+			component.clear();
+			component.push_back(cv::Point(x, y));
+			result.at<int>(y, x) = next_label;
+			for (size_t i = 0; i < component.size(); i++) {
+				cv::Point p = component[i];
+				for (int k = 0; k < 4; k++) {
+					int nx = p.x + dx[k], ny = p.y + dy[k];
+					if (nx < 0 || ny < 0 || nx >= labels.cols || ny >= labels.rows)
+						continue;
+					if (result.at<int>(ny, nx) < 0 && labels.at<int>(ny, nx) == original) {
+						result.at<int>(ny, nx) = next_label;
+						component.push_back(cv::Point(nx, ny));
+					}
+				}
+			}
+			if (int(component.size()) < min_size && adjacent >= 0) {
+				for (size_t i = 0; i < component.size(); i++)
+					result.at<int>(component[i]) = adjacent;
+			} else {
+				next_label++;
+			}
+		}
+	}
+	return result;
+}
+
+} // namespace
+
+int Superpixels::at(int x, int y) const {
+	if (x < 0 || y < 0 || x >= labels.cols || y >= labels.rows)
+		return -1;
+	return labels.at<int>(y, x);
+}
+
+QImage Superpixels::boundaries(QRgb color) const {
+	QImage image(labels.cols, labels.rows, QImage::Format_ARGB32_Premultiplied);
+	image.fill(Qt::transparent);
+	for (int y = 0; y < labels.rows; y++) {
+		const int * line = labels.ptr<int>(y);
+		const int * next = labels.ptr<int>(std::min(y + 1, labels.rows - 1));
+		QRgb * out = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < labels.cols; x++) {
+			if ((x + 1 < labels.cols && line[x] != line[x + 1]) || line[x] != next[x])
+				out[x] = color;
+		}
+	}
+	return image;
+}
+
+Superpixels Superpixels::fromLabels(const cv::Mat &labels) {
+	Superpixels result;
+	if (labels.empty())
+		return result;
+	labels.convertTo(result.labels, CV_32S);
+	std::vector<int> min_x, min_y, max_x, max_y;
+	for (int y = 0; y < result.labels.rows; y++) {
+		const int * line = result.labels.ptr<int>(y);
+		for (int x = 0; x < result.labels.cols; x++) {
+			int l = line[x];
+			if (l >= int(min_x.size())) {
+				min_x.resize(l + 1, INT_MAX); min_y.resize(l + 1, INT_MAX);
+				max_x.resize(l + 1, -1);      max_y.resize(l + 1, -1);
+			}
+			min_x[l] = std::min(min_x[l], x); max_x[l] = std::max(max_x[l], x);
+			min_y[l] = std::min(min_y[l], y); max_y[l] = std::max(max_y[l], y);
+		}
+	}
+	result.rects.resize(min_x.size());
+	for (size_t l = 0; l < min_x.size(); l++) {
+		if (max_x[l] >= 0)
+			result.rects[l] = cv::Rect(min_x[l], min_y[l], max_x[l] - min_x[l] + 1, max_y[l] - min_y[l] + 1);
+	}
+	return result;
+}
+
+cv::Mat computeSlic(const cv::Mat &bgr, int region_size, float compactness, int iterations) {
+	const int step = std::max(4, region_size);
+	cv::Mat lab;
+	cv::cvtColor(bgr, lab, cv::COLOR_BGR2Lab);
+
+	const int grid_w = std::max(1, (lab.cols + step / 2) / step);
+	const int grid_h = std::max(1, (lab.rows + step / 2) / step);
+	std::vector<SlicCenter> centers(grid_w * grid_h);
+	for (int gy = 0; gy < grid_h; gy++) {
+		for (int gx = 0; gx < grid_w; gx++) {
+			int x = std::min(gx * step + step / 2, lab.cols - 1);
+			int y = std::min(gy * step + step / 2, lab.rows - 1);
+			const uchar * pix = lab.ptr<uchar>(y) + 3 * x;
+			SlicCenter c = { float(pix[0]), float(pix[1]), float(pix[2]), float(x), float(y) };
+			centers[gy * grid_w + gx] = c;
+		}
+	}
+
+	const float weight = (compactness * compactness) / float(step * step);
+	cv::Mat labels(lab.size(), CV_32S);
+	std::vector<double> sums;
+	std::vector<int> counts;
+	for (int it = 0; it < iterations; it++) {
+		cv::parallel_for_(cv::Range(0, lab.rows), SlicAssign(lab, centers, grid_w, grid_h, step, weight, labels));
+
+		sums.assign(centers.size() * 5, 0.);
+		counts.assign(centers.size(), 0);
+		for (int y = 0; y < lab.rows; y++) {
+			const uchar * pix = lab.ptr<uchar>(y);
+			const int * label = labels.ptr<int>(y);
+			for (int x = 0; x < lab.cols; x++) {
+				double * s = &sums[5 * label[x]];
+				s[0] += pix[3 * x]; s[1] += pix[3 * x + 1]; s[2] += pix[3 * x + 2];
+				s[3] += x; s[4] += y;
+				counts[label[x]]++;
+			}
+		}
+		for (size_t i = 0; i < centers.size(); i++) {
+			if (counts[i] == 0) continue;
+			const double * s = &sums[5 * i];
+			SlicCenter c = { float(s[0] / counts[i]), float(s[1] / counts[i]), float(s[2] / counts[i]),
+			                 float(s[3] / counts[i]), float(s[4] / counts[i]) };
+			centers[i] = c;
+		}
+	}
+	return enforceConnectivity(labels, step * step / 4);
+}
+
+Superpixels loadOrComputeSuperpixels(const QString &image_file, const cv::Mat &bgr) {
+	QString cache_file = annotationCacheFile(image_file, ".superpixels.png");
+	QFileInfo cache(cache_file);
+	if (cache.exists() && cache.lastModified() >= QFileInfo(image_file).lastModified()) {
+		cv::Mat cached = cv::imread(cache_file.toStdString(), cv::IMREAD_UNCHANGED);
+		if (cached.size() == bgr.size() && cached.type() == CV_16UC1)
+			return Superpixels::fromLabels(cached);
+	}
+
+	// about 25 px wide superpixels, fewer on huge images so the indices fit in a 16-bit png
+	int region_size = std::max(25, int(std::ceil(std::sqrt(double(bgr.total()) / 60000.))));
+	cv::Mat labels = computeSlic(bgr, region_size);
+	Superpixels superpixels = Superpixels::fromLabels(labels);
+	if (superpixels.count() <= 65536) {
+		cv::Mat labels16;
+		labels.convertTo(labels16, CV_16U);
+		QDir().mkpath(QFileInfo(cache_file).absolutePath());
+		cv::imwrite(cache_file.toStdString(), labels16);
+	}
+	return superpixels;
+}
@@ -0,0 +1,33 @@
+#ifndef SUPERPIXELS_H
+#define SUPERPIXELS_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+#include <QImage>
+#include <vector>
+
+// Superpixel map of an image : CV_32S plane of segment indices and the
+// bounding rect of each segment, so that a segment can be painted in
+// O(segment size).
+struct Superpixels {
+	cv::Mat               labels;
+	std::vector<cv::Rect> rects ;
+
+	bool empty() const { return labels.empty(); }
+	int  count() const { return int(rects.size()); }
+	int  at(int x, int y) const;
+	QImage boundaries(QRgb color) const;
+
+	static Superpixels fromLabels(const cv::Mat &labels);
+};
+
+// SLIC superpixels (Achanta et al., TPAMI 2012) on a BGR image.
+// Pixels are assigned to the nearest of the 9 surrounding grid centers, rows
+// being processed in parallel. Returns consecutive CV_32S labels.
+cv::Mat computeSlic(const cv::Mat &bgr, int region_size, float compactness = 10.f, int iterations = 5);
+
+// Loads the superpixels cached beside the image, or computes and caches them.
+// Meant to run in a worker thread.
+Superpixels loadOrComputeSuperpixels(const QString &image_file, const cv::Mat &bgr);
+
+#endif // SUPERPIXELS_H
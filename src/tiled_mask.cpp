@@ -0,0 +1,68 @@
+#include "tiled_mask.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+TiledMask::TiledMask(const QString &dir) : _dir(dir) {}
+
+QString TiledMask::tileDir(const QString &image_file) {
+	QFileInfo file(image_file);
+	return file.dir().absolutePath() + "/" + file.baseName() + "_mask_tiles";
+}
+
+QString TiledMask::_tileFile(int tx, int ty) const {
+	return QString("%1/tile_%2_%3.png").arg(_dir).arg(tx).arg(ty);
+}
+
+cv::Mat TiledMask::_readTile(int tx, int ty) const {
+	QString file = _tileFile(tx, ty);
+	if (QFile::exists(file)) {
+		cv::Mat tile = loadLabelImage(file);
+		if (tile.rows == TILE_SIZE && tile.cols == TILE_SIZE)
+			return tile;
+	}
+	return cv::Mat(TILE_SIZE, TILE_SIZE, CV_16UC1, cv::Scalar(0));
+}
+
+cv::Mat TiledMask::read(cv::Rect roi) const {
+	PAT_TRACE_SCOPE("readMaskTiles");
+	cv::Mat result(roi.size(), CV_16UC1, cv::Scalar(0));
+	for (int ty = roi.y / TILE_SIZE; ty * TILE_SIZE < roi.br().y; ty++) {
+		for (int tx = roi.x / TILE_SIZE; tx * TILE_SIZE < roi.br().x; tx++) {
+			if (!QFile::exists(_tileFile(tx, ty)))
+				continue;
+			cv::Rect tile_rect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+			cv::Rect common = tile_rect & roi;
+			_readTile(tx, ty)(common - tile_rect.tl()).copyTo(result(common - roi.tl()));
+		}
+	}
+	return result;
+}
+
+int TiledMask::write(cv::Rect roi, const cv::Mat &id) {
+	PAT_TRACE_SCOPE("writeMaskTiles");
+	CV_Assert(id.size() == roi.size() && id.type() == CV_16UC1);
+	QDir().mkpath(_dir);
+	int written = 0;
+	for (int ty = roi.y / TILE_SIZE; ty * TILE_SIZE < roi.br().y; ty++) {
+		for (int tx = roi.x / TILE_SIZE; tx * TILE_SIZE < roi.br().x; tx++) {
+			cv::Rect tile_rect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+			cv::Rect common = tile_rect & roi;
+			cv::Mat tile = _readTile(tx, ty);
+			cv::Mat part = tile(common - tile_rect.tl());
+			const cv::Mat edited = id(common - roi.tl());
+			if (diffRect(part, edited).area() == 0)
+				continue;
+			edited.copyTo(part);
+			if (isFullZero(tile))
+				QFile::remove(_tileFile(tx, ty));
+			else
+				saveLabelImage(_tileFile(tx, ty), tile, true);
+			written++;
+		}
+	}
+	return written;
+}
@@ -0,0 +1,29 @@
+#ifndef TILED_MASK_H
+#define TILED_MASK_H
+
+#include <opencv2/core/core.hpp>
+#include <QString>
+
+// Label plane of an image too large to be held in memory, stored as 16-bit
+// png tiles in <dir>/<base>_mask_tiles/. Tiles without any label are not
+// stored, so the size on disk follows what was annotated.
+class TiledMask {
+public:
+	static const int TILE_SIZE = 1024;
+
+	explicit TiledMask(const QString &dir = QString());
+	static QString tileDir(const QString &image_file);
+
+	bool isNull() const { return _dir.isEmpty(); }
+	cv::Mat read(cv::Rect roi) const;
+	// Returns the number of tiles that were rewritten or removed.
+	int write(cv::Rect roi, const cv::Mat &id);
+
+private:
+	QString _tileFile(int tx, int ty) const;
+	cv::Mat _readTile(int tx, int ty) const;
+
+	QString _dir;
+};
+
+#endif // TILED_MASK_H
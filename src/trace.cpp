@@ -0,0 +1,111 @@
+#include "trace.h"
+
+#include <QFile>
+#include <QThread>
+#include <QTextStream>
+#include <QCoreApplication>
+#include <QMap>
+
+#include <cstring>
+
+Trace & Trace::instance() {
+	static Trace trace;
+	return trace;
+}
+
+Trace::Trace() : _next(0) {
+	_clock.start();
+}
+
+void Trace::_push(const Event &event) {
+	if (_events.size() < MAX_EVENTS) {
+		_events.push_back(event);
+	} else {
+		_events[_next] = event;
+		_next = (_next + 1) % MAX_EVENTS;
+	}
+}
+
+void Trace::complete(const char *name, qint64 start_us, qint64 duration_us) {
+	Event event = { name, 'X', quint64(quintptr(QThread::currentThreadId())), start_us, duration_us };
+	QMutexLocker lock(&_mutex);
+	_push(event);
+	Latest & latest = _last[name];
+	latest.ts = start_us;
+	latest.value = duration_us;
+}
+
+void Trace::counter(const char *name, qint64 value) {
+	Event event = { name, 'C', 0, now(), value };
+	QMutexLocker lock(&_mutex);
+	_push(event);
+	Latest & latest = _counters[name];
+	latest.ts = event.ts;
+	latest.value = value;
+}
+
+void Trace::clear() {
+	QMutexLocker lock(&_mutex);
+	_events.clear();
+	_next = 0;
+	_last.clear();
+	_counters.clear();
+}
+
+qint64 Trace::last(const char *name) const {
+	QMutexLocker lock(&_mutex);
+	const Latest * found = NULL;
+	for (LatestMap::const_iterator it = _last.begin(); it != _last.end(); ++it) {
+		if ((it->first == name || strcmp(it->first, name) == 0) && (found == NULL || it->second.ts > found->ts))
+			found = &it->second;
+	}
+	return found == NULL ? -1 : found->value;
+}
+
+// By name, the most recent value of the entries sharing it.
+QList<QPair<QString, qint64> > Trace::_merged(const LatestMap &values) {
+	QMap<QString, Latest> by_name;
+	for (LatestMap::const_iterator it = values.begin(); it != values.end(); ++it) {
+		QString name = QString::fromLatin1(it->first);
+		if (!by_name.contains(name) || it->second.ts > by_name[name].ts)
+			by_name[name] = it->second;
+	}
+	QList<QPair<QString, qint64> > result;
+	for (QMap<QString, Latest>::const_iterator it = by_name.begin(); it != by_name.end(); ++it)
+		result.push_back(qMakePair(it.key(), it.value().value));
+	return result;
+}
+
+QList<QPair<QString, qint64> > Trace::lastDurations() const {
+	QMutexLocker lock(&_mutex);
+	return _merged(_last);
+}
+
+QList<QPair<QString, qint64> > Trace::counters() const {
+	QMutexLocker lock(&_mutex);
+	return _merged(_counters);
+}
+
+bool Trace::exportChromeTrace(const QString &file) const {
+	QFile out_file(file);
+	if (!out_file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+
+	QMutexLocker lock(&_mutex);
+	QTextStream out(&out_file);
+	qint64 pid = QCoreApplication::applicationPid();
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (size_t i = 0; i < _events.size(); i++) {
+		// oldest first once the ring buffer has wrapped
+		const Event & e = _events[(_next + i) % _events.size()];
+		if (i > 0) out << ",\n";
+		out << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\",\"pid\":" << pid
+			<< ",\"tid\":" << e.tid << ",\"ts\":" << e.ts;
+		if (e.phase == 'X')
+			out << ",\"dur\":" << e.value << "}";
+		else
+			out << ",\"args\":{\"value\":" << e.value << "}}";
+	}
+	out << "\n]}\n";
+	return true;
+}
@@ -0,0 +1,83 @@
+#ifndef PIX_ANN_TRACE_H
+#define PIX_ANN_TRACE_H
+
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Lightweight instrumentation of the hot paths : scoped timers and counters
+// are kept in a bounded in-memory buffer and can be exported as a Chrome
+// trace json (chrome://tracing or https://ui.perfetto.dev).
+// Everything is compiled out unless PIXEL_ANNOTATION_TRACING is defined.
+class Trace {
+public:
+	static Trace & instance();
+
+	qint64 now() const { return _clock.nsecsElapsed() / 1000; } // us
+	void complete(const char *name, qint64 start_us, qint64 duration_us);
+	void counter(const char *name, qint64 value);
+	void clear();
+
+	qint64 last(const char *name) const; // last duration (us) of a scope, -1 if never run
+	QList<QPair<QString, qint64> > lastDurations() const;
+	QList<QPair<QString, qint64> > counters() const;
+	bool exportChromeTrace(const QString &file) const;
+
+private:
+	Trace();
+
+	struct Event {
+		const char * name ;
+		char         phase; // 'X' complete, 'C' counter
+		quint64      tid  ;
+		qint64       ts   ;
+		qint64       value; // duration for 'X', value for 'C'
+	};
+	void _push(const Event &event);
+
+	// Latest value of a name, keyed by the address of its literal so that the
+	// hot paths never build a string ; a name used in several translation
+	// units may have several entries, merged when read.
+	struct Latest {
+		qint64 ts   ;
+		qint64 value;
+	};
+	typedef std::map<const char*, Latest> LatestMap;
+	static QList<QPair<QString, qint64> > _merged(const LatestMap &values);
+
+	static const size_t MAX_EVENTS = 1 << 18;
+
+	QElapsedTimer                 _clock   ;
+	mutable QMutex                _mutex   ;
+	std::vector<Event>            _events  ; // ring buffer
+	size_t                        _next    ;
+	LatestMap                     _last    ;
+	LatestMap                     _counters;
+};
+
+class TraceScope {
+public:
+	explicit TraceScope(const char *name) : _name(name), _start(Trace::instance().now()) {}
+	~TraceScope() { Trace::instance().complete(_name, _start, Trace::instance().now() - _start); }
+private:
+	const char * _name ;
+	qint64       _start;
+};
+
+#ifdef PIXEL_ANNOTATION_TRACING
+#define PAT_TRACE_CONCAT_(a, b) a##b
+#define PAT_TRACE_CONCAT(a, b) PAT_TRACE_CONCAT_(a, b)
+#define PAT_TRACE_SCOPE(name) TraceScope PAT_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define PAT_TRACE_COUNTER(name, value) Trace::instance().counter(name, value)
+#else
+#define PAT_TRACE_SCOPE(name) do {} while (0)
+#define PAT_TRACE_COUNTER(name, value) do {} while (0)
+#endif
+
+#endif // PIX_ANN_TRACE_H
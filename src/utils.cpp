@@ -1,5 +1,9 @@
 #include "utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 //-------------------------------------------------------------------------------------------------------------
 QImage mat2QImage(cv::Mat const& src) {
 	cv::Mat temp; // make the same cv::Mat
@@ -16,35 +20,211 @@ cv::Mat qImage2Mat(QImage const& src) {
 	return result;
 }
 
-QImage idToColor(const QImage &image_id, const Id2Labels& id_label) {
-	QImage result(image_id.size(), QImage::Format_RGB888);
+// Reads a mask written either by the previous versions (8-bit, id repeated in
+// the 3 channels) or as a 16-bit single channel png.
+cv::Mat loadLabelImage(const QString &file) {
+	cv::Mat image = cv::imread(file.toStdString(), cv::IMREAD_UNCHANGED);
+	if (image.empty())
+		return image;
+	if (image.channels() > 1) {
+		std::vector<cv::Mat> channels;
+		cv::split(image, channels);
+		image = channels[0];
+	}
+	cv::Mat image_id;
+	image.convertTo(image_id, CV_16U);
+	return image_id;
+}
+
+// Masks whose ids all fit in 8 bits are kept in the legacy 3 channels format,
+// so that existing datasets and scripts are not affected.
+bool saveLabelImage(const QString &file, const cv::Mat &image_id, bool force_16bit) {
+	double max_id = 0;
+	if (!force_16bit)
+		cv::minMaxLoc(image_id, NULL, &max_id);
+	if (force_16bit || max_id > 255)
+		return cv::imwrite(file.toStdString(), image_id);
+
+	cv::Mat id8, id8c3;
+	image_id.convertTo(id8, CV_8U);
+	cv::cvtColor(id8, id8c3, cv::COLOR_GRAY2BGR);
+	return cv::imwrite(file.toStdString(), id8c3);
+}
+
+QImage idToColor(const cv::Mat &image_id, const Id2Labels& id_label) {
+	QImage result(image_id.cols, image_id.rows, QImage::Format_RGB888);
 	idToColor(image_id, id_label, &result);
 	return result;
 }
 
-void idToColor(const QImage &image_id, const Id2Labels& id_label, QImage *result) {
-	int id = 0;
-	uchar * pix;
-	for (int y = 0; y < image_id.height(); y++) {
-		const uchar * line_in = image_id.scanLine(y);
+void idToColor(const cv::Mat &image_id, const Id2Labels& id_label, QImage *result, cv::Rect roi) {
+	idToColor(image_id, id_label.palette(), result, roi);
+}
+
+// The palette overload does not touch the registry, so it can run in worker threads.
+void idToColor(const cv::Mat &image_id, const QVector<QRgb> &palette, QImage *result, cv::Rect roi) {
+	cv::Rect all(0, 0, image_id.cols, image_id.rows);
+	roi = (roi.area() == 0) ? all : (roi & all);
+	const QRgb * lut = palette.constData();
+	const int lut_size = palette.size();
+	const QRgb unknown = qRgb(255, 255, 255);
+	for (int y = roi.y; y < roi.y + roi.height; y++) {
+		const ushort * line_in = image_id.ptr<ushort>(y);
 		uchar * line_out = result->scanLine(y);
-		for (int x = 0; x < image_id.width()*3; x+=3) {
+		for (int x = roi.x; x < roi.x + roi.width; x++) {
 			int id = line_in[x];
-			QMap<int, const LabelInfo*>::const_iterator it = id_label.find(id);
-			if (it != id_label.end()) {
-				pix = &line_out[x];
-				const LabelInfo * label = *it;
-				*pix = label->color.red(); pix++;
-				*pix = label->color.green(); pix++;
-				*pix = label->color.blue();
-            } else {
-                pix = &line_out[x];
-                pix[0] = 255;
-                pix[1] = 255;
-                pix[2] = 255;
-            }
+			QRgb rgb = id < lut_size ? lut[id] : unknown;
+			uchar * pix = &line_out[x * 3];
+			pix[0] = qRed(rgb);
+			pix[1] = qGreen(rgb);
+			pix[2] = qBlue(rgb);
+		}
+	}
+}
+
+// 4-connected scanline flood fill of the region of the seed's id.
+// Returns the bounding rect of the filled pixels, and their number in filled.
+cv::Rect floodFillLabel(cv::Mat &image_id, cv::Point seed, ushort new_id, qint64 *filled) {
+	if (seed.x < 0 || seed.y < 0 || seed.x >= image_id.cols || seed.y >= image_id.rows)
+		return cv::Rect();
+	const ushort old_id = image_id.at<ushort>(seed);
+	if (old_id == new_id)
+		return cv::Rect();
+
+	int min_x = seed.x, max_x = seed.x, min_y = seed.y, max_y = seed.y;
+	qint64 count = 0;
+	std::vector<cv::Point> stack;
+	stack.push_back(seed);
+	while (!stack.empty()) {
+		cv::Point p = stack.back();
+		stack.pop_back();
+		ushort * line = image_id.ptr<ushort>(p.y);
+		if (line[p.x] != old_id)
+			continue;
+		int left = p.x, right = p.x;
+		while (left > 0 && line[left - 1] == old_id) left--;
+		while (right < image_id.cols - 1 && line[right + 1] == old_id) right++;
+		for (int x = left; x <= right; x++)
+			line[x] = new_id;
+		count += right - left + 1;
+		min_x = std::min(min_x, left);
+		max_x = std::max(max_x, right);
+		min_y = std::min(min_y, p.y);
+		max_y = std::max(max_y, p.y);
+
+		for (int y = p.y - 1; y <= p.y + 1; y += 2) {
+			if (y < 0 || y >= image_id.rows)
+				continue;
+			const ushort * next = image_id.ptr<ushort>(y);
+			bool in_span = false;
+			for (int x = left; x <= right; x++) {
+				if (next[x] != old_id) {
+					in_span = false;
+				} else if (!in_span) {
+					stack.push_back(cv::Point(x, y));
+					in_span = true;
+				}
+			}
+		}
+	}
+	if (filled != NULL)
+		*filled = count;
+	return cv::Rect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+}
+
+cv::Rect diffRect(const cv::Mat &a, const cv::Mat &b) {
+	CV_Assert(a.size() == b.size() && a.type() == b.type());
+	const size_t elem = a.elemSize();
+	const size_t row_bytes = a.cols * elem;
+	int min_x = a.cols, max_x = -1, min_y = a.rows, max_y = -1;
+	for (int y = 0; y < a.rows; y++) {
+		const uchar * la = a.ptr<uchar>(y);
+		const uchar * lb = b.ptr<uchar>(y);
+		if (memcmp(la, lb, row_bytes) == 0)
+			continue;
+		min_y = std::min(min_y, y);
+		max_y = y;
+		// only the columns outside the current bounds can widen it
+		int x = 0;
+		while (x < min_x && memcmp(la + x * elem, lb + x * elem, elem) == 0) x++;
+		min_x = std::min(min_x, x);
+		x = a.cols - 1;
+		while (x > max_x && memcmp(la + x * elem, lb + x * elem, elem) == 0) x--;
+		max_x = std::max(max_x, x);
+	}
+	if (max_y < 0)
+		return cv::Rect();
+	return cv::Rect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+}
+
+// Even-odd scanline rasterization of a closed polygon, its outline included.
+// Returns a CV_8UC1 mask covering roi, 255 inside the polygon.
+cv::Mat polygonMask(const std::vector<cv::Point> &points, cv::Rect roi) {
+	cv::Mat mask = cv::Mat::zeros(roi.size(), CV_8UC1);
+	if (points.size() < 2 || roi.area() == 0)
+		return mask;
+	std::vector<double> xs;
+	for (int y = roi.y; y < roi.y + roi.height; y++) {
+		// edges are half open in y so a vertex shared by two edges counts once
+		xs.clear();
+		for (size_t i = 0; i < points.size(); i++) {
+			const cv::Point & a = points[i];
+			const cv::Point & b = points[(i + 1) % points.size()];
+			if ((a.y <= y) == (b.y <= y))
+				continue;
+			xs.push_back(a.x + double(y - a.y) * (b.x - a.x) / double(b.y - a.y));
+		}
+		std::sort(xs.begin(), xs.end());
+		uchar * line = mask.ptr<uchar>(y - roi.y);
+		for (size_t i = 0; i + 1 < xs.size(); i += 2) {
+			int x0 = std::max(roi.x, int(std::ceil(xs[i])));
+			int x1 = std::min(roi.x + roi.width - 1, int(std::floor(xs[i + 1])));
+			if (x1 >= x0)
+				memset(line + x0 - roi.x, 255, x1 - x0 + 1);
 		}
 	}
+	std::vector<std::vector<cv::Point> > outline(1);
+	for (size_t i = 0; i < points.size(); i++)
+		outline[0].push_back(points[i] - roi.tl());
+	cv::polylines(mask, outline, true, cv::Scalar(255));
+	return mask;
+}
+
+LabelHistogram::LabelHistogram() : _bins(65536, 0) {}
+
+void LabelHistogram::addRow(const ushort *row, int size) {
+	if (size <= 0)
+		return;
+	ushort current = row[0];
+	int run_start = 0;
+	for (int x = 1; x < size; x++) {
+		if (row[x] == current)
+			continue;
+		if (_bins[current] == 0) _touched.push_back(current);
+		_bins[current] += x - run_start;
+		current = row[x];
+		run_start = x;
+	}
+	if (_bins[current] == 0) _touched.push_back(current);
+	_bins[current] += size - run_start;
+}
+
+void LabelHistogram::add(const cv::Mat &image_id) {
+	for (int y = 0; y < image_id.rows; y++)
+		addRow(image_id.ptr<ushort>(y), image_id.cols);
+}
+
+QMap<int, qint64> LabelHistogram::counts() const {
+	QMap<int, qint64> result;
+	for (size_t i = 0; i < _touched.size(); i++)
+		result[_touched[i]] = _bins[_touched[i]];
+	return result;
+}
+
+void LabelHistogram::reset() {
+	for (size_t i = 0; i < _touched.size(); i++)
+		_bins[_touched[i]] = 0;
+	_touched.clear();
 }
 
 QColor readableColor(const QColor & color)
@@ -118,46 +298,41 @@ cv::Mat convertMat32StoRGBC3(const cv::Mat& mat) {
 	return dst;
 }
 
-QImage watershed(const QImage& qimage, const QImage & qmarkers_mask) {
+cv::Mat watershed(const QImage& qimage, const cv::Mat & markers_id) {
 	cv::Mat image = qImage2Mat(qimage);
-	cv::Mat markers_mask = qImage2Mat(qmarkers_mask);
-	cv::Mat markers = cv::Mat::zeros(markers_mask.size(), CV_32S);
-	for (int y = 0; y < markers_mask.rows; y++) {
-		int* mark = markers.ptr<int>(y);
-		cv::Vec3b* mask = markers_mask.ptr<cv::Vec3b>(y);
-		for (int x = 0; x < markers_mask.cols; x++) {
-			mark[x] = mask[x][0];
-		}
-	}
+	cv::Mat markers;
+	markers_id.convertTo(markers, CV_32S);
 	cv::watershed(image, markers);
-	cv::Mat new_mask = convertMat32StoRGBC3(markers);
-	return mat2QImage(new_mask);
+	cv::Mat new_mask;
+	markers.convertTo(new_mask, CV_16U);
+	new_mask.setTo(cv::Scalar(WATERSHED_BORDER), markers == -1);
+	return new_mask;
 }
 
-QImage removeBorder(const QImage & mask_id, const Id2Labels & labels, cv::Size win_size) {
-	QImage result = mask_id.copy();
+cv::Mat removeBorder(const cv::Mat & mask_id, const Id2Labels & labels, cv::Size win_size) {
+	cv::Mat result = mask_id.clone();
+	const int half_w = win_size.width >> 1;
+	const int half_h = win_size.height >> 1;
 
-	for (int y = 1; y < mask_id.height() - 1; y++) {
-		const uchar * line_curr = mask_id.scanLine(y);
-		uchar * line_out = result.scanLine(y);
-		for (int X = 1; X < mask_id.width() - 1; X++) {
-			int x = X * 3;
+	for (int y = half_h; y < mask_id.rows - half_h; y++) {
+		const ushort * line_curr = mask_id.ptr<ushort>(y);
+		ushort * line_out = result.ptr<ushort>(y);
+		for (int x = half_w; x < mask_id.cols - half_w; x++) {
 			int id = line_curr[x];
-			if (labels.find(id) == labels.end()) {
+			if (!labels.contains(id)) {
 				std::map<int, int> mapk;
-				for (int yy = -(win_size.height >> 1); yy <= win_size.height >> 1; yy++) {
-					const uchar * l_curr = mask_id.scanLine(y + yy);
-					for (int xx = -(win_size.width >> 1); xx <= win_size.width >> 1; xx++) {
+				for (int yy = -half_h; yy <= half_h; yy++) {
+					const ushort * l_curr = mask_id.ptr<ushort>(y + yy);
+					for (int xx = -half_w; xx <= half_w; xx++) {
 						if (yy == 0 && xx == 0) continue;
-						if (mapk.find(l_curr[x+xx]) != mapk.end()) mapk[l_curr[x + xx]] ++;
-						else mapk[l_curr[x + xx]] = 1;
+						mapk[l_curr[x + xx]]++;
 					}
 				}
 				int id_max = 0;
 				int id_resul = mapk.begin()->first;
 				std::map<int, int>::iterator it = mapk.begin();
 				while (it != mapk.end()) {
-					if (it->first != 255) {
+					if (it->first != WATERSHED_BORDER) {
 						if (it->second > id_max) {
 							id_max = it->second;
 							id_resul = it->first;
@@ -166,23 +341,14 @@ QImage removeBorder(const QImage & mask_id, const Id2Labels & labels, cv::Size w
 					it++;
 				}
 				line_out[x] = id_resul;
-				line_out[x + 1] = id_resul;
-				line_out[x + 2] = id_resul;
 			}
 		}
 	}
 	return result;
 }
 
-bool isFullZero(const QImage& image) {
-	for (int y = 0; y < image.height(); y++) {
-		const uchar * line = image.scanLine(y);
-		for (int x = 0; x < image.bytesPerLine(); x++) {
-			if (line[x] > 0)
-				return false;
-		}
-	}
-	return true;
+bool isFullZero(const cv::Mat& image) {
+	return image.empty() || cv::countNonZero(image) == 0;
 }
 //-------------------------------------------------------------------------------------------------------------
 
@@ -221,3 +387,11 @@ std::string generate_hex(const unsigned int len) {
     }        
     return ss.str();
 }
+
+// Quoted when it holds a separator, a quote or a line break (RFC 4180).
+QString csvField(const QString &text) {
+	if (!text.contains(',') && !text.contains('"') && !text.contains('\n') && !text.contains('\r'))
+		return text;
+	QString escaped = text;
+	return "\"" + escaped.replace("\"", "\"\"") + "\"";
+}
@@ -7,19 +7,45 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <iostream>
 #include <QImage>
+#include <QMap>
 
 cv::Mat qImage2Mat(QImage const& src);
 QImage mat2QImage(cv::Mat const& src);
-QImage idToColor(const QImage &image_id, const Id2Labels& id_label);
-void idToColor(const QImage &image_id, const Id2Labels& id_label, QImage *result);
+// Label planes are single channel CV_16UC1 images holding the label id of each pixel.
+static const ushort WATERSHED_BORDER = 0xffff;
+cv::Mat loadLabelImage(const QString &file);
+bool saveLabelImage(const QString &file, const cv::Mat &image_id, bool force_16bit = false);
+QImage idToColor(const cv::Mat &image_id, const Id2Labels& id_label);
+void idToColor(const cv::Mat &image_id, const Id2Labels& id_label, QImage *result, cv::Rect roi = cv::Rect());
+void idToColor(const cv::Mat &image_id, const QVector<QRgb> &palette, QImage *result, cv::Rect roi = cv::Rect());
+cv::Rect floodFillLabel(cv::Mat &image_id, cv::Point seed, ushort new_id, qint64 *filled = NULL);
+cv::Mat polygonMask(const std::vector<cv::Point> &points, cv::Rect roi);
+// Bounding rect of the pixels that differ between two planes of the same size and type.
+cv::Rect diffRect(const cv::Mat &a, const cv::Mat &b);
+
+// Pixel count of each label id of CV_16UC1 planes. Rows are counted by runs
+// of equal ids (masks are mostly long runs), so the inner loop is a single
+// compare per pixel, and only the bins that were hit are read back or reset.
+class LabelHistogram {
+public:
+	LabelHistogram();
+	void addRow(const ushort *row, int size);
+	void add(const cv::Mat &image_id);
+	QMap<int, qint64> counts() const;
+	void reset();
+private:
+	std::vector<qint64> _bins   ;
+	std::vector<ushort> _touched;
+};
 inline bool operator<(const QColor & a, const QColor & b) { return a.rgb() < b.rgb(); }
 QColor invColor(const QColor & color);
 QColor readableColor(const QColor & color);
+QString csvField(const QString &text);
 QVector<QColor> colorMap(int size);
 cv::Mat convertMat32StoRGBC3(const cv::Mat &mat);
-QImage watershed(const QImage& qimage, const QImage & qmarkers_mask);
-QImage removeBorder(const QImage & mask_id, const Id2Labels & labels, cv::Size win_size = cv::Size(3,3));
-bool isFullZero(const QImage& image);
+cv::Mat watershed(const QImage& qimage, const cv::Mat & markers_id);
+cv::Mat removeBorder(const cv::Mat & mask_id, const Id2Labels & labels, cv::Size win_size = cv::Size(3,3));
+bool isFullZero(const cv::Mat& image);
 int rgbToInt(uchar r, uchar g, uchar b);
 void intToRgb(int value, uchar &r, uchar &g, uchar &b);
 unsigned char random_char();